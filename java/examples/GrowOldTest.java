@@ -0,0 +1,28 @@
+//
+// GrowOldTest.java
+//
+// regression test for the generational garbage collector. The
+// StringBuffer held by an old object outgrows its chunk and is moved
+// into the nursery while the int arrays keep triggering collections
+// of the young objects. Must print 300 'A's with NVM_USE_GENERATIONAL_GC
+// and without NVM_USE_INCREMENTAL_GC in config.h.
+//
+
+class GrowOldTest {
+  StringBuffer buf;
+
+  GrowOldTest() {
+    buf = new StringBuffer();
+  }
+
+  public static void main(String[] args) {
+    GrowOldTest old = new GrowOldTest();
+
+    for(int i = 0; i < 300; i++) {
+      old.buf.append('A');
+      int[] garbage = new int[20];
+    }
+
+    System.out.println(old.buf.toString());
+  }
+}
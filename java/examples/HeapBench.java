@@ -0,0 +1,30 @@
+//
+// HeapBench.java
+//
+// benchmark for heap allocation, based on StringAndHeapTest. Every
+// string concatenation allocates a few short lived objects while the
+// list built first stays alive. Run it on the unix vm with and
+// without NVM_USE_HEAP_HANDLES in config.h and compare the run times.
+//
+
+class HeapBench {
+  HeapBench next;
+
+  HeapBench(HeapBench next) {
+    this.next = next;
+  }
+
+  public static void main(String[] args) {
+    HeapBench list = null;
+    String str = null;
+
+    // objects which stay on the heap all the time
+    for(int i = 0; i < 30; i++)
+      list = new HeapBench(list);
+
+    for(int j = 2000; j > 0; j--)
+      str = "TEST " + j + " + TEST " + (j % 3) + " TEST";
+
+    System.out.println(str);
+  }
+}
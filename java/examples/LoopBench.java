@@ -0,0 +1,34 @@
+//
+// LoopBench.java
+//
+// benchmark for the superinstructions. The loop in run() contains
+// all sequences NanoVMTool replaces by fused instructions. Run it
+// on the unix vm with and without "superinstructions yes" in
+// UnixTest.config and compare the run times.
+//
+
+class LoopBench {
+  int step;
+
+  int run(int n) {
+    int sum = 0;
+
+    for(int i = 0; i < n; i++) {     // iload_x, iload_y, if_icmp / iinc, goto
+      sum += step;                   // aload_0, getfield
+      if(sum > n)                    // iload_x, iload_y, if_icmp
+	sum = i + 1;                 // iload_x, iconst_c, iadd, istore_y
+    }
+    return sum;
+  }
+
+  public static void main(String[] args) {
+    LoopBench bench = new LoopBench();
+    int sum = 0;
+
+    bench.step = 3;
+    for(int i = 0; i < 100; i++)
+      sum = bench.run(30000);
+
+    System.out.println("sum = " + sum);
+  }
+}
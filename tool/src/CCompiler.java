@@ -0,0 +1,561 @@
+//
+//  NanoVMTool, Converter and Upload Tool for the NanoVM
+//  Copyright (C) 2005 by Till Harbaum <Till@Harbaum.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//  Parts of this tool are based on public domain code written by Kimberley
+//  Burchett: http://www.kimbly.com/code/classfile/
+//
+
+//
+// CCompiler.java
+//
+// translates the bytecode of methods into c functions which are
+// linked into the vm (see vm/src/nvmaot.h). The generated code
+// does exactly what the interpreter does for each instruction, but
+// saves fetching and dispatching them
+//
+
+import java.io.*;
+import java.util.*;
+
+public class CCompiler {
+  // java bytecode instructions not used by the CodeTranslator
+  final static int OP_ICONST_M1     = 0x02;
+  final static int OP_ICONST_5      = 0x08;
+  final static int OP_BIPUSH        = 0x10;
+  final static int OP_POP           = 0x57;
+  final static int OP_POP2          = 0x58;
+  final static int OP_DUP           = 0x59;
+  final static int OP_DUP2          = 0x5c;
+  final static int OP_ISUB          = 0x64;
+  final static int OP_IMUL          = 0x68;
+  final static int OP_IDIV          = 0x6c;
+  final static int OP_IREM          = 0x70;
+  final static int OP_INEG          = 0x74;
+  final static int OP_ISHL          = 0x78;
+  final static int OP_ISHR          = 0x7a;
+  final static int OP_IUSHR         = 0x7c;
+  final static int OP_IAND          = 0x7e;
+  final static int OP_IOR           = 0x80;
+  final static int OP_IXOR          = 0x82;
+  final static int OP_IFLE          = 0x9e;
+  final static int OP_RETURN        = 0xb1;
+
+  // array type used by the vm for arrays of references
+  final static int T_OBJECT         = 12;
+
+  // c operators of the conditional branches
+  final static String[] CONDITIONS = { "==", "!=", "<", ">=", ">", "<=" };
+
+  // bytecode of all methods before it is fused into superinstructions
+  static byte[][] sources;
+
+  // the bytecode as written into the nvm file
+  static byte[][] codes;
+
+  // remember the code of method i
+  public static void addMethod(int i, byte[] source, byte[] code) {
+    if(sources == null) {
+      sources = new byte[ClassLoader.totalMethods()][];
+      codes = new byte[ClassLoader.totalMethods()][];
+    }
+
+    sources[i] = source;
+    codes[i] = code;
+  }
+
+  static String getName(int i) {
+    return ClassLoader.getClassInfoFromMethodIndex(i).getName() + "." +
+      ClassLoader.getMethod(i).getName();
+  }
+
+  static boolean isVirtual(int cmd) {
+    return cmd == CodeTranslator.OP_INVOKEVIRTUAL;
+  }
+
+  static boolean isInvoke(int cmd) {
+    return (cmd == CodeTranslator.OP_INVOKEVIRTUAL) ||
+      (cmd == CodeTranslator.OP_INVOKESPECIAL) ||
+      (cmd == CodeTranslator.OP_INVOKESTATIC);
+  }
+
+  // compiled methods can only call compiled methods. Thus everything
+  // that may be called from a selected method is compiled as well.
+  // This includes all methods overriding a method called virtually
+  static boolean[] select() {
+    boolean[] selected = new boolean[ClassLoader.totalMethods()];
+    boolean changed = true;
+
+    for(int i=0;i<ClassLoader.totalMethods();i++)
+      selected[i] = Config.compileMethod(getName(i));
+
+    while(changed) {
+      changed = false;
+
+      for(int i=0;i<ClassLoader.totalMethods();i++) {
+	byte[] code = sources[i];
+
+	if(!selected[i])
+	  continue;
+
+	for(int j=0;j<code.length;j+=CodeTranslator.length(code, j)) {
+	  int cmd = CodeTranslator.unsigned(code[j]);
+
+	  if(!isInvoke(cmd))
+	    continue;
+
+	  // natives don't need to be compiled
+	  int index = 256 * CodeTranslator.unsigned(code[j+1]) +
+	    CodeTranslator.unsigned(code[j+2]);
+	  if((index>>8) >= NativeMapper.lowestNativeId)
+	    continue;
+
+	  for(int k=0;k<ClassLoader.totalMethods();k++) {
+	    if(!selected[k] && ((k == index) || (isVirtual(cmd) &&
+	       (MethodIdTable.getEntry(k) == MethodIdTable.getEntry(index))))) {
+	      System.out.println(getName(k) + " is called from " +
+				 getName(i) + ", compiling it as well");
+	      selected[k] = changed = true;
+	    }
+	  }
+	}
+      }
+    }
+
+    return selected;
+  }
+
+  // sum over the bytecode, used by the vm to make sure the compiled
+  // code belongs to the method
+  static int checksum(byte[] code) {
+    int sum = 0;
+
+    for(int i=0;i<code.length;i++)
+      sum += CodeTranslator.unsigned(code[i]);
+
+    return sum & 0xffff;
+  }
+
+  static String hex16(int val) {
+    String str = "000" + Integer.toHexString(val & 0xffff);
+    return "0x" + str.substring(str.length()-4);
+  }
+
+  // translate a single instruction into c
+  static String compileInstruction(byte[] code, int i) {
+    int cmd = CodeTranslator.unsigned(code[i]);
+
+    // instructions addressing locals
+    if((cmd == CodeTranslator.OP_ILOAD) || (cmd == CodeTranslator.OP_FLOAD))
+      return "NVM_AOT_PUSH(locals[" + CodeTranslator.unsigned(code[i+1]) + "]);";
+
+    if((cmd >= CodeTranslator.OP_ILOAD_0) &&
+       (cmd <= CodeTranslator.OP_ILOAD_3))
+      return "NVM_AOT_PUSH(locals[" + (cmd - CodeTranslator.OP_ILOAD_0) + "]);";
+
+    if((cmd >= CodeTranslator.OP_FLOAD_0) &&
+       (cmd <= CodeTranslator.OP_FLOAD_3))
+      return "NVM_AOT_PUSH(locals[" + (cmd - CodeTranslator.OP_FLOAD_0) + "]);";
+
+    if((cmd == CodeTranslator.OP_ISTORE) || (cmd == CodeTranslator.OP_FSTORE))
+      return "locals[" + CodeTranslator.unsigned(code[i+1]) + "] = NVM_AOT_POP();";
+
+    if((cmd >= CodeTranslator.OP_ISTORE_0) &&
+       (cmd <= CodeTranslator.OP_ISTORE_3))
+      return "locals[" + (cmd - CodeTranslator.OP_ISTORE_0) + "] = NVM_AOT_POP();";
+
+    if((cmd >= CodeTranslator.OP_FSTORE_0) &&
+       (cmd <= CodeTranslator.OP_FSTORE_3))
+      return "locals[" + (cmd - CodeTranslator.OP_FSTORE_0) + "] = NVM_AOT_POP();";
+
+    if((cmd >= OP_ICONST_M1) && (cmd <= OP_ICONST_5))
+      return "NVM_AOT_PUSH(" + (cmd - CodeTranslator.OP_ICONST_0) + ");";
+
+    // conditional branches
+    if((cmd >= CodeTranslator.OP_IFEQ) && (cmd <= OP_IFLE))
+      return "if(NVM_AOT_POP_INT() " + CONDITIONS[cmd - CodeTranslator.OP_IFEQ] +
+	" 0) goto l" + (i + CodeTranslator.get16(code, i+1)) + ";";
+
+    if((cmd >= CodeTranslator.OP_IF_ICMPEQ) &&
+       (cmd <= CodeTranslator.OP_IF_ICMPLE))
+      return "b = NVM_AOT_POP_INT(); if(NVM_AOT_POP_INT() " +
+	CONDITIONS[cmd - CodeTranslator.OP_IF_ICMPEQ] + " b) goto l" +
+	(i + CodeTranslator.get16(code, i+1)) + ";";
+
+    if(isInvoke(cmd))
+      return "NVM_AOT_INVOKE(" +
+	hex16(CodeTranslator.get16(code, i+1)) + ", " +
+	(isVirtual(cmd)?"TRUE":"FALSE") + ");";
+
+    switch(cmd) {
+      case CodeTranslator.OP_NOP:
+	return "";
+
+      case OP_BIPUSH:
+	return "NVM_AOT_PUSH(" + code[i+1] + ");";
+
+      case CodeTranslator.OP_SIPUSH:
+	return "NVM_AOT_PUSH(nvm_int2stack(" + CodeTranslator.get16(code, i+1) + "));";
+
+      case CodeTranslator.OP_LDC:
+	return "NVM_AOT_PUSH(nvmfile_get_constant(" +
+	  CodeTranslator.unsigned(code[i+1]) + "));";
+
+      case CodeTranslator.OP_IINC:
+	return "locals[" + CodeTranslator.unsigned(code[i+1]) + "] = " +
+	  "nvm_int2stack(nvm_stack2int(locals[" +
+	  CodeTranslator.unsigned(code[i+1]) + "]) + " + code[i+2] + ");";
+
+      case OP_POP:
+	return "NVM_AOT_DROP(1);";
+
+      case OP_POP2:
+	return "NVM_AOT_DROP(2);";
+
+      case OP_DUP:
+	return "NVM_AOT_PUSH(NVM_AOT_PEEK(0));";
+
+      case OP_DUP2:
+	return "NVM_AOT_PUSH(NVM_AOT_PEEK(1)); NVM_AOT_PUSH(NVM_AOT_PEEK(1));";
+
+      case CodeTranslator.OP_DUP_X1:
+	return "{ nvm_stack_t w1 = NVM_AOT_POP(), w2 = NVM_AOT_POP(); " +
+	  "NVM_AOT_PUSH(w1); NVM_AOT_PUSH(w2); NVM_AOT_PUSH(w1); }";
+
+      case CodeTranslator.OP_DUP_X2:
+	return "{ nvm_stack_t w1 = NVM_AOT_POP(), w2 = NVM_AOT_POP(), " +
+	  "w3 = NVM_AOT_POP(); NVM_AOT_PUSH(w1); NVM_AOT_PUSH(w2); " +
+	  "NVM_AOT_PUSH(w3); NVM_AOT_PUSH(w1); }";
+
+      case CodeTranslator.OP_DUP2_X1:
+	return "{ nvm_stack_t w1 = NVM_AOT_POP(), w2 = NVM_AOT_POP(), " +
+	  "w3 = NVM_AOT_POP(); NVM_AOT_PUSH(w1); NVM_AOT_PUSH(w2); " +
+	  "NVM_AOT_PUSH(w3); NVM_AOT_PUSH(w1); NVM_AOT_PUSH(w2); }";
+
+      case CodeTranslator.OP_DUP2_X2:
+	return "{ nvm_stack_t w1 = NVM_AOT_POP(), w2 = NVM_AOT_POP(), " +
+	  "w3 = NVM_AOT_POP(), w4 = NVM_AOT_POP(); NVM_AOT_PUSH(w1); " +
+	  "NVM_AOT_PUSH(w2); NVM_AOT_PUSH(w3); NVM_AOT_PUSH(w4); " +
+	  "NVM_AOT_PUSH(w1); NVM_AOT_PUSH(w2); }";
+
+      case CodeTranslator.OP_SWAP:
+	return "{ nvm_stack_t w1 = NVM_AOT_POP(), w2 = NVM_AOT_POP(); " +
+	  "NVM_AOT_PUSH(w1); NVM_AOT_PUSH(w2); }";
+
+      case CodeTranslator.OP_IADD:
+	return "b = NVM_AOT_POP_INT(); a = NVM_AOT_POP_INT(); " +
+	  "NVM_AOT_PUSH(nvm_int2stack(a + b));";
+
+      case OP_ISUB:
+	return "b = NVM_AOT_POP_INT(); a = NVM_AOT_POP_INT(); " +
+	  "NVM_AOT_PUSH(nvm_int2stack(a - b));";
+
+      case OP_IMUL:
+	return "b = NVM_AOT_POP_INT(); a = NVM_AOT_POP_INT(); " +
+	  "NVM_AOT_PUSH(nvm_int2stack(a * b));";
+
+      case OP_IDIV:
+	return "b = NVM_AOT_POP_INT(); a = NVM_AOT_POP_INT(); " +
+	  "if(!b) error(ERROR_VM_DIVISION_BY_ZERO); " +
+	  "NVM_AOT_PUSH(nvm_int2stack(nvm_int_div(a, b)));";
+
+      case OP_IREM:
+	return "b = NVM_AOT_POP_INT(); a = NVM_AOT_POP_INT(); " +
+	  "NVM_AOT_PUSH(nvm_int2stack(nvm_int_rem(a, b)));";
+
+      case OP_ISHL:
+	return "b = NVM_AOT_POP_INT(); a = NVM_AOT_POP_INT(); " +
+	  "NVM_AOT_PUSH(nvm_int2stack(a << b));";
+
+      case OP_ISHR:
+	return "b = NVM_AOT_POP_INT(); a = NVM_AOT_POP_INT(); " +
+	  "NVM_AOT_PUSH(nvm_int2stack(a >> b));";
+
+      case OP_IUSHR:
+	return "b = NVM_AOT_POP_INT(); a = NVM_AOT_POP_INT(); " +
+	  "NVM_AOT_PUSH(nvm_int2stack((nvm_uint_t)a >> b));";
+
+      case OP_IAND:
+	return "b = NVM_AOT_POP_INT(); a = NVM_AOT_POP_INT(); " +
+	  "NVM_AOT_PUSH(nvm_int2stack(a & b));";
+
+      case OP_IOR:
+	return "b = NVM_AOT_POP_INT(); a = NVM_AOT_POP_INT(); " +
+	  "NVM_AOT_PUSH(nvm_int2stack(a | b));";
+
+      case OP_IXOR:
+	return "b = NVM_AOT_POP_INT(); a = NVM_AOT_POP_INT(); " +
+	  "NVM_AOT_PUSH(nvm_int2stack(a ^ b));";
+
+      case OP_INEG:
+	return "NVM_AOT_PUSH(nvm_int2stack(-NVM_AOT_POP_INT()));";
+
+      case CodeTranslator.OP_GOTO:
+	return "goto l" + (i + CodeTranslator.get16(code, i+1)) + ";";
+
+      case CodeTranslator.OP_TABLESWITCH: {
+	int lo = CodeTranslator.get32(code, i+5);
+	int hi = CodeTranslator.get32(code, i+9);
+	String str = "switch(NVM_AOT_POP_INT()) {";
+
+	for(int j=0;j<hi-lo+1;j++)
+	  str += "\n    case " + (lo+j) + ": goto l" +
+	    (i + CodeTranslator.get32(code, i+13+4*j)) + ";";
+
+	return str + "\n    default: goto l" +
+	  (i + CodeTranslator.get32(code, i+1)) + ";\n  }";
+      }
+
+      case CodeTranslator.OP_LOOKUPSWITCH: {
+	String str = "switch(NVM_AOT_POP_INT()) {";
+
+	for(int j=0;j<CodeTranslator.get32(code, i+5);j++)
+	  str += "\n    case " + CodeTranslator.get32(code, i+9+8*j) +
+	    ": goto l" + (i + CodeTranslator.get32(code, i+13+8*j)) + ";";
+
+	return str + "\n    default: goto l" +
+	  (i + CodeTranslator.get32(code, i+1)) + ";\n  }";
+      }
+
+      case CodeTranslator.OP_IRETURN:
+      case CodeTranslator.OP_FRETURN:
+	return "NVM_AOT_RETURN(TRUE);";
+
+      case OP_RETURN:
+	return "NVM_AOT_RETURN(FALSE);";
+
+      case CodeTranslator.OP_GETSTATIC:
+	return "NVM_AOT_PUSH(stack_get_static(" +
+	  CodeTranslator.get16(code, i+1) + "));";
+
+      case CodeTranslator.OP_PUTSTATIC:
+	return "stack_set_static(" + CodeTranslator.get16(code, i+1) +
+	  ", NVM_AOT_POP());";
+
+      case CodeTranslator.OP_GETFIELD:
+	return "NVM_AOT_PUSH(NVM_AOT_FIELD(NVM_AOT_POP(), " +
+	  CodeTranslator.get16(code, i+1) + "));";
+
+      case CodeTranslator.OP_PUTFIELD:
+	return "v = NVM_AOT_POP(); NVM_AOT_PUTFIELD(NVM_AOT_POP(), " +
+	  CodeTranslator.get16(code, i+1) + ", v);";
+
+      case CodeTranslator.OP_NEW:
+	return "NVM_AOT_NEW(" + hex16(CodeTranslator.get16(code, i+1)) + ");";
+
+      case CodeTranslator.OP_NEWARRAY:
+	return "NVM_AOT_NEWARRAY(" + CodeTranslator.unsigned(code[i+1]) + ");";
+
+      case CodeTranslator.OP_ANEWARRAY:
+	return "NVM_AOT_NEWARRAY(" + T_OBJECT + ");";
+
+      case CodeTranslator.OP_MULTIANEWARRAY:
+	return "NVM_AOT_MULTIANEWARRAY(" + CodeTranslator.unsigned(code[i+1]) +
+	  ", " + CodeTranslator.unsigned(code[i+2]) + ");";
+
+      case CodeTranslator.OP_ARRAYLENGTH:
+	return "NVM_AOT_PUSH(array_length(NVM_AOT_POP() & ~NVM_TYPE_MASK));";
+
+      case CodeTranslator.OP_IALOAD:
+	return "a = NVM_AOT_POP_INT(); " +
+	  "NVM_AOT_PUSH(array_iaload(NVM_AOT_POP() & ~NVM_TYPE_MASK, a));";
+
+      case CodeTranslator.OP_BALOAD:
+	return "a = NVM_AOT_POP_INT(); " +
+	  "NVM_AOT_PUSH(array_baload(NVM_AOT_POP() & ~NVM_TYPE_MASK, a));";
+
+      case CodeTranslator.OP_CALOAD:
+	return "a = NVM_AOT_POP_INT(); " +
+	  "NVM_AOT_PUSH(array_caload(NVM_AOT_POP() & ~NVM_TYPE_MASK, a));";
+
+      case CodeTranslator.OP_SALOAD:
+	return "a = NVM_AOT_POP_INT(); " +
+	  "NVM_AOT_PUSH(array_saload(NVM_AOT_POP() & ~NVM_TYPE_MASK, a));";
+
+      case CodeTranslator.OP_AALOAD:
+	return "a = NVM_AOT_POP_INT(); " +
+	  "NVM_AOT_PUSH(array_iaload(NVM_AOT_POP() & ~NVM_TYPE_MASK, a));";
+
+      case CodeTranslator.OP_FALOAD:
+	return "a = NVM_AOT_POP_INT(); NVM_AOT_PUSH(nvm_float2stack(" +
+	  "array_faload(NVM_AOT_POP() & ~NVM_TYPE_MASK, a)));";
+
+      case CodeTranslator.OP_IASTORE:
+	return "b = NVM_AOT_POP_INT(); a = NVM_AOT_POP_INT(); " +
+	  "array_iastore(NVM_AOT_POP() & ~NVM_TYPE_MASK, a, b);";
+
+      case CodeTranslator.OP_BASTORE:
+	return "b = NVM_AOT_POP_INT(); a = NVM_AOT_POP_INT(); " +
+	  "array_bastore(NVM_AOT_POP() & ~NVM_TYPE_MASK, a, b);";
+
+      case CodeTranslator.OP_CASTORE:
+      case CodeTranslator.OP_SASTORE:
+	return "b = NVM_AOT_POP_INT(); a = NVM_AOT_POP_INT(); " +
+	  "array_sastore(NVM_AOT_POP() & ~NVM_TYPE_MASK, a, b);";
+
+      case CodeTranslator.OP_AASTORE:
+	return "b = NVM_AOT_POP_INT(); a = NVM_AOT_POP_INT(); " +
+	  "array_aastore(NVM_AOT_POP() & ~NVM_TYPE_MASK, a, b);";
+
+      case CodeTranslator.OP_FASTORE:
+	return "f = NVM_AOT_POP_FLOAT(); a = NVM_AOT_POP_INT(); " +
+	  "array_fastore(NVM_AOT_POP() & ~NVM_TYPE_MASK, a, f);";
+
+      case CodeTranslator.OP_FCONST_0:
+      case CodeTranslator.OP_FCONST_1:
+      case CodeTranslator.OP_FCONST_2:
+	return "NVM_AOT_PUSH(nvm_float2stack(" +
+	  (cmd - CodeTranslator.OP_FCONST_0) + ".0));";
+
+      case CodeTranslator.OP_FADD:
+	return "g = NVM_AOT_POP_FLOAT(); f = NVM_AOT_POP_FLOAT(); " +
+	  "NVM_AOT_PUSH(nvm_float2stack(f + g));";
+
+      case CodeTranslator.OP_FSUB:
+	return "g = NVM_AOT_POP_FLOAT(); f = NVM_AOT_POP_FLOAT(); " +
+	  "NVM_AOT_PUSH(nvm_float2stack(f - g));";
+
+      case CodeTranslator.OP_FMUL:
+	return "g = NVM_AOT_POP_FLOAT(); f = NVM_AOT_POP_FLOAT(); " +
+	  "NVM_AOT_PUSH(nvm_float2stack(f * g));";
+
+      case CodeTranslator.OP_FDIV:
+	return "g = NVM_AOT_POP_FLOAT(); f = NVM_AOT_POP_FLOAT(); " +
+	  "if(!g) error(ERROR_VM_DIVISION_BY_ZERO); " +
+	  "NVM_AOT_PUSH(nvm_float2stack(f / g));";
+
+      case CodeTranslator.OP_FNEG:
+	return "NVM_AOT_PUSH(nvm_float2stack(-NVM_AOT_POP_FLOAT()));";
+
+      case CodeTranslator.OP_I2F:
+	return "NVM_AOT_PUSH(nvm_float2stack(NVM_AOT_POP_INT()));";
+
+      case CodeTranslator.OP_F2I:
+	return "NVM_AOT_PUSH(nvm_int2stack((nvm_int_t)NVM_AOT_POP_FLOAT()));";
+
+      case CodeTranslator.OP_FCMPL:
+      case CodeTranslator.OP_FCMPG:
+	return "g = NVM_AOT_POP_FLOAT(); f = NVM_AOT_POP_FLOAT(); " +
+	  "NVM_AOT_PUSH(nvm_int2stack((f < g)?-1:(f > g)));";
+    }
+
+    // the vm doesn't support this instruction either
+    return "error(ERROR_VM_UNSUPPORTED_OPCODE);";
+  }
+
+  // translate a whole method into a c function
+  static String compileMethod(int index) {
+    byte[] code = sources[index];
+    boolean[] target = new boolean[code.length];
+    String body = "", decl = "";
+
+    // mark all branch targets, they get a label
+    for(int i=0;i<code.length;i+=CodeTranslator.length(code, i)) {
+      int cmd = CodeTranslator.unsigned(code[i]);
+
+      if(((cmd >= CodeTranslator.OP_IFEQ) &&
+	  (cmd <= CodeTranslator.OP_IF_ICMPLE)) ||
+	 (cmd == CodeTranslator.OP_GOTO))
+	target[i + CodeTranslator.get16(code, i+1)] = true;
+
+      if(cmd == CodeTranslator.OP_TABLESWITCH) {
+	target[i + CodeTranslator.get32(code, i+1)] = true;
+	for(int j=0;j<CodeTranslator.get32(code, i+9) -
+	      CodeTranslator.get32(code, i+5) + 1;j++)
+	  target[i + CodeTranslator.get32(code, i+13+4*j)] = true;
+      }
+
+      if(cmd == CodeTranslator.OP_LOOKUPSWITCH) {
+	target[i + CodeTranslator.get32(code, i+1)] = true;
+	for(int j=0;j<CodeTranslator.get32(code, i+5);j++)
+	  target[i + CodeTranslator.get32(code, i+13+8*j)] = true;
+      }
+    }
+
+    for(int i=0;i<code.length;i+=CodeTranslator.length(code, i)) {
+      String insn = compileInstruction(code, i);
+
+      if(target[i])
+	body += "l" + i + ":\n";
+
+      if(insn.length() > 0)
+	body += "  " + insn + "\n";
+      else if(target[i])
+	body += "  ;\n";
+    }
+
+    // declare the stack pointer and the temporary variables used
+    decl += "  nvm_stack_t *sp = stack_get_sp();\n";
+    if(body.indexOf(" a = ") >= 0) decl += "  nvm_int_t a;\n";
+    if(body.indexOf(" b = ") >= 0) decl += "  nvm_int_t b;\n";
+    if(body.indexOf(" v = ") >= 0) decl += "  nvm_stack_t v;\n";
+    if(body.indexOf(" f = ") >= 0) decl += "  nvm_float_t f;\n";
+    if(body.indexOf(" g = ") >= 0) decl += "  nvm_float_t g;\n";
+
+    MethodInfo methodInfo = ClassLoader.getMethod(index);
+    return "// " + getName(index) + ":" + methodInfo.getSignature() + "\n" +
+      "static u08_t nvm_aot_" + index + "(nvm_stack_t *locals) {\n" +
+      decl + "\n" + body + "}\n\n";
+  }
+
+  // write all selected methods into a c file
+  public static void write(String fileName) {
+    boolean[] selected = select();
+    String table = "";
+
+    System.out.println("Writing compiled methods to file " + fileName);
+
+    try {
+      File outputFile = new File(fileName);
+      FileOutputStream out = new FileOutputStream(outputFile);
+
+      out.write(("/* " + fileName + ", autogenerated from " +
+		 ClassLoader.getClassInfo(0).getName() +
+		 " class */\n\n").getBytes());
+      out.write("#include \"nvmaot.h\"\n\n".getBytes());
+
+      for(int i=0;i<ClassLoader.totalMethods();i++) {
+	if(!selected[i])
+	  continue;
+
+	System.out.println("Compiling " + getName(i));
+	out.write(compileMethod(i).getBytes());
+
+	table += "  { " + i + ", " +
+	  hex16((ClassLoader.getClassIndex(i) << 8) +
+		MethodIdTable.getEntry(i)) + ", " +
+	  codes[i].length + ", " + hex16(checksum(codes[i])) + ", " +
+	  "nvm_aot_" + i + " },\n";
+      }
+
+      if(table.length() == 0) {
+	System.out.println("ERROR: No method selected for compilation");
+	System.exit(-1);
+      }
+
+      out.write(("const nvm_aot_method_t nvm_aot_methods[] = {\n" +
+		 table + "};\n\n").getBytes());
+      out.write(("const u08_t nvm_aot_method_count = " +
+		 "sizeof(nvm_aot_methods)/sizeof(nvm_aot_method_t);\n")
+		.getBytes());
+      out.close();
+    } catch(IOException e) {
+      System.out.println("Error writing c file: " + e.toString());
+      System.exit(-1);
+    }
+  }
+}
@@ -248,6 +248,36 @@ public class ClassInfo extends CommonInfo {
     return sum;
   }
 
+  // set a bit in map for every non-static field slot of this class
+  // and its super classes that holds a reference. The slots are
+  // numbered the same way ConstPool numbers non static field refs
+  public void getReferenceMap(byte[] map) {
+    int slot = 0;
+
+    String className = getName();
+    while(NativeMapper.getNativeClassId(ClassLoader.
+		   getSuperClassName(className)) == -1) {
+      className = ClassLoader.getSuperClassName(className);
+      slot += ClassLoader.getClassInfo(className).nonStaticFields();
+    }
+
+    for(int i=0;i<fields.size();i++) {
+      FieldInfo fieldInfo = (FieldInfo)fields.elementAt(i);
+
+      if((fieldInfo.getAccessFlags() & AccessFlags.STATIC) == 0) {
+	char type = fieldInfo.getSignature().charAt(0);
+	if((type == 'L') || (type == '['))
+	  map[slot/8] |= 1<<(slot%8);
+
+	slot++;
+      }
+    }
+
+    // fields inherited from super classes (only non-native ones)
+    if(getSuperClassIndex() < NativeMapper.lowestNativeId) 
+      ClassLoader.getClassInfo(getSuperClassIndex()).getReferenceMap(map);
+  }
+
   public int getSuperClassIndex() {
     int index = ClassLoader.getClassIndex(getSuperClassName());
 
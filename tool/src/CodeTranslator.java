@@ -28,10 +28,10 @@ public class CodeTranslator {
      0, -1,  0,  0,  0,  0,  0,  0,  0, -1, -1,  0,  0,  0, -1, -1, // 00
      1,  2,  1, -1, -1,  1, -1,  1, -1,  1,  0,  0,  0,  0, -1, -1, // 10
     -1, -1,  0,  0,  0,  0, -1, -1, -1, -1,  0,  0,  0,  0,  0, -1, // 20
-     0, -1,  0,  0, -1, -1,  1, -1,  1, -1, -1,  0,  0,  0,  0, -1, // 30
+     0, -1,  0,  0,  0,  0,  1, -1,  1, -1, -1,  0,  0,  0,  0, -1, // 30
 
     -1, -1, -1,  0,  0,  0,  0, -1, -1, -1, -1,  0,  0,  0,  0,  0, // 40
-    -1,  0, -1,  0,  0, -1, -1,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 50
+    -1,  0, -1,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, // 50
      0, -1,  0, -1,  0, -1,  0, -1,  0, -1,  0, -1,  0, -1,  0, -1, // 60
      0, -1,  0, -1,  0, -1,  0, -1,  0, -1,  0, -1,  0, -1,  0, -1, // 70
 
@@ -40,7 +40,7 @@ public class CodeTranslator {
      2,  2,  2,  2,  2, -1, -1,  2, -1, -1,  0,  0,  0, -1,  0, -1, // a0
     -1,  0,  2,  2,  2,  2,  2,  2,  2, -1, -1,  2,  1,  2,  0, -1, // b0
 
-    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, // c0
+    -1, -1, -1, -1, -1,  2, -1, -1, -1, -1, -1,  2,  0,  0, -1, -1, // c0
     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, // d0
     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, // e0
     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, // f0
@@ -49,7 +49,9 @@ public class CodeTranslator {
   // some java bytecode instructions
   final static int OP_NOP           = 0x00;
   final static int OP_ACONST_NULL   = 0x01;
+  final static int OP_ICONST_M1     = 0x02;
   final static int OP_ICONST_0      = 0x03;
+  final static int OP_ICONST_5      = 0x08;
   final static int OP_SIPUSH        = 0x11;
   final static int OP_LDC           = 0x12;
   final static int OP_ILOAD         = 0x15;
@@ -72,9 +74,14 @@ public class CodeTranslator {
   final static int OP_ASTORE_1      = 0x4c;
   final static int OP_ASTORE_2      = 0x4d;
   final static int OP_ASTORE_3      = 0x4e;
+  final static int OP_IADD          = 0x60;
+  final static int OP_IINC          = 0x84;
   final static int OP_I2B           = 0x91;
   final static int OP_I2C           = 0x92;
   final static int OP_I2S           = 0x93;
+  final static int OP_IF_ICMPEQ      = 0x9f;
+  final static int OP_IF_ICMPLE      = 0xa4;
+  final static int OP_GOTO          = 0xa7;
   final static int OP_TABLESWITCH   = 0xaa;
   final static int OP_LOOKUPSWITCH  = 0xab;
   final static int OP_IRETURN       = 0xac;
@@ -106,6 +113,8 @@ public class CodeTranslator {
   final static int  OP_FALOAD       = 0x30; // only if array and floating point compiled in
   final static int  OP_AALOAD       = 0x32; // only if array compiled in
   final static int  OP_BALOAD       = 0x33; // only if array compiled in
+  final static int  OP_CALOAD       = 0x34; // only if array compiled in
+  final static int  OP_SALOAD       = 0x35; // only if array compiled in
   final static int  OP_FSTORE       = 0x38; // only if floating point compiled in
   final static int  OP_FSTORE_0     = 0x43; // only if floating point compiled in
   final static int  OP_FSTORE_1     = 0x44; // only if floating point compiled in
@@ -115,6 +124,8 @@ public class CodeTranslator {
   final static int  OP_FASTORE      = 0x51; // only if array and floating point compiled in
   final static int  OP_AASTORE      = 0x53; // only if array compiled in
   final static int  OP_BASTORE      = 0x54; // only if array compiled in
+  final static int  OP_CASTORE      = 0x55; // only if array compiled in
+  final static int  OP_SASTORE      = 0x56; // only if array compiled in
   final static int  OP_DUP_X1       = 0x5a; // only if extended stack ops compiled in
   final static int  OP_DUP_X2       = 0x5b; // only if extended stack ops compiled in
   final static int  OP_DUP2_X1      = 0x5d; // only if extended stack ops compiled in
@@ -134,7 +145,39 @@ public class CodeTranslator {
   final static int  OP_NEWARRAY     = 0xbc; // only if array compiled in
   final static int  OP_ANEWARRAY    = 0xbd; // only if array compiled in
   final static int  OP_ARRAYLENGTH  = 0xbe; // only if array compiled in
+  final static int  OP_MULTIANEWARRAY = 0xc5; // only if array of objects compiled in
 
+  // new of an object not escaping the method (see EscapeAnalysis),
+  // only if scoped allocation compiled in
+  final static int  OP_NEW_SCOPED   = 0xcb;
+
+  // aaload followed by an access to the row it loaded,
+  // only if flat arrays compiled in
+  final static int  OP_ARRAYLOAD_2D  = 0xcc;
+  final static int  OP_ARRAYSTORE_2D = 0xcd;
+
+  // array types used by the vm
+  final static String ARRAY_TYPES = "....ZCFDBSIJ";
+  final static int  T_OBJECT        = 12;
+  final static int  T_FLAT          = 0x80; // two dimensional, one chunk
+
+  // superinstructions replacing frequent instruction sequences.
+  // Each one occupies exactly the bytes of the sequence it replaces
+  final static int OP_ILOAD_ILOAD_IF_ICMPEQ    = 0xd0; // up to 0xd5 (le)
+  final static int OP_ILOAD_ICONST_IADD_ISTORE = 0xd6;
+  final static int OP_ILOAD_GETFIELD           = 0xd7;
+  final static int OP_IINC_GOTO                = 0xd8;
+
+  // names of the fusions for the statistics
+  final static String[] FUSION_NAMES = {
+    "iload_x/iload_y/if_icmp<cond>",
+    "iload_x/iconst_c/iadd/istore_y",
+    "iload_x/getfield",
+    "iinc/goto",
+  };
+
+  // number of times each fusion has been applied
+  static int[] fusions = new int[FUSION_NAMES.length];
 
   
   static int unsigned(int i) {
@@ -156,6 +199,15 @@ public class CodeTranslator {
     return val;
   }
 
+  static int get16(byte[] code, int i) {
+    return (short)(256 * unsigned(code[i]) + unsigned(code[i+1]));
+  }
+
+  static void set16(byte[] code, int i, int val) {
+    code[i+1] = signed(val & 0xff);
+    code[i+0] = signed((val >> 8) & 0xff);
+  }
+
   static void set32(byte[] code, int i, int val) {
     code[i+3] = signed(val >> 0);
     code[i+2] = signed(val >> 8);
@@ -251,6 +303,22 @@ public class CodeTranslator {
 	code[i+2] = signed(index&0xff);
       }
 
+      if(cmd == OP_MULTIANEWARRAY) {
+	int index = 256 * unsigned(code[i+1]) + unsigned(code[i+2]);
+	int dims = unsigned(code[i+3]);
+	ConstPool cp = classInfo.getConstPool();
+	String type = cp.getEntryAtIndex(
+	  cp.getEntryAtIndex(index).getClassNameIndex()).getString();
+	System.out.println("multianewarray " + type + ", " + dims + " dims");
+
+	// the vm only needs to know the type of the innermost arrays
+	// it creates. The last byte becomes a nop
+	code[i+1] = signed((type.length() > dims+1)?T_OBJECT:
+			   ARRAY_TYPES.indexOf(type.charAt(dims)));
+	code[i+2] = signed(dims);
+	code[i+3] = signed(OP_NOP);
+      }
+
       if(cmd == OP_TABLESWITCH) {
         UsedFeatures.add(UsedFeatures.TABLESWITCH);
 	//System.out.println("tableswitch");
@@ -262,7 +330,7 @@ public class CodeTranslator {
         i++;
         while (i%4!=0) {
           code[i-1]=signed(OP_NOP);
-          code[i]=signed(OP_LOOKUPSWITCH);
+          code[i]=signed(OP_TABLESWITCH);
           i++;
           delta++;
         }
@@ -304,6 +372,22 @@ public class CodeTranslator {
           set32(code, i, get32(code, i) - delta); // realloc label
           i+=4;
         }
+
+        // the vm does a binary search on the keys, so make sure
+        // they are sorted (javac already does this)
+        int table = i - 8*count;
+        for (int j=1; j<count; j++) {
+          int key = get32(code, table+8*j);
+          int offset = get32(code, table+8*j+4);
+          int k = j;
+          while (k>0 && get32(code, table+8*(k-1)) > key) {
+            set32(code, table+8*k,   get32(code, table+8*(k-1)));
+            set32(code, table+8*k+4, get32(code, table+8*(k-1)+4));
+            k--;
+          }
+          set32(code, table+8*k,   key);
+          set32(code, table+8*k+4, offset);
+        }
         i--;
       }
       
@@ -324,6 +408,8 @@ public class CodeTranslator {
       if(cmd == OP_IALOAD)       UsedFeatures.add(UsedFeatures.ARRAY);
       if(cmd == OP_FALOAD)       UsedFeatures.add(UsedFeatures.ARRAY + UsedFeatures.FLOAT);
       if(cmd == OP_BALOAD)       UsedFeatures.add(UsedFeatures.ARRAY);
+      if(cmd == OP_CALOAD)       UsedFeatures.add(UsedFeatures.ARRAY);
+      if(cmd == OP_SALOAD)       UsedFeatures.add(UsedFeatures.ARRAY);
       if(cmd == OP_FSTORE)       UsedFeatures.add(UsedFeatures.FLOAT);
       if(cmd == OP_FSTORE_0)     UsedFeatures.add(UsedFeatures.FLOAT);
       if(cmd == OP_FSTORE_1)     UsedFeatures.add(UsedFeatures.FLOAT);
@@ -332,6 +418,8 @@ public class CodeTranslator {
       if(cmd == OP_IASTORE)      UsedFeatures.add(UsedFeatures.ARRAY);
       if(cmd == OP_FASTORE)      UsedFeatures.add(UsedFeatures.ARRAY + UsedFeatures.FLOAT);
       if(cmd == OP_BASTORE)      UsedFeatures.add(UsedFeatures.ARRAY);
+      if(cmd == OP_CASTORE)      UsedFeatures.add(UsedFeatures.ARRAY);
+      if(cmd == OP_SASTORE)      UsedFeatures.add(UsedFeatures.ARRAY);
       if(cmd == OP_FADD)         UsedFeatures.add(UsedFeatures.FLOAT);
       if(cmd == OP_FSUB)         UsedFeatures.add(UsedFeatures.FLOAT);
       if(cmd == OP_FMUL)         UsedFeatures.add(UsedFeatures.FLOAT);
@@ -346,6 +434,7 @@ public class CodeTranslator {
       if(cmd == OP_NEWARRAY)     UsedFeatures.add(UsedFeatures.ARRAY);
       if(cmd == OP_ANEWARRAY)    UsedFeatures.add(UsedFeatures.ARRAY);
       if(cmd == OP_ARRAYLENGTH)  UsedFeatures.add(UsedFeatures.ARRAY);
+      if(cmd == OP_MULTIANEWARRAY) UsedFeatures.add(UsedFeatures.ARRAY);
       if(cmd == OP_DUP_X1)       UsedFeatures.add(UsedFeatures.EXTSTACK);
       if(cmd == OP_DUP_X2)       UsedFeatures.add(UsedFeatures.EXTSTACK);
       if(cmd == OP_DUP2_X1)      UsedFeatures.add(UsedFeatures.EXTSTACK);
@@ -354,4 +443,294 @@ public class CodeTranslator {
       i += PARAMETER_BYTES[cmd];
     }
   }
+
+  // length of a translated instruction. Switch padding has already
+  // been replaced by nops, so the switch data directly follows
+  static int length(byte[] code, int i) {
+    int cmd = unsigned(code[i]);
+
+    if(cmd == OP_TABLESWITCH)
+      return 13 + 4 * (get32(code, i+9) - get32(code, i+5) + 1);
+
+    if(cmd == OP_LOOKUPSWITCH)
+      return 9 + 8 * get32(code, i+5);
+
+    return 1 + PARAMETER_BYTES[cmd];
+  }
+
+  static boolean isShortLoad(int cmd) {
+    return (cmd >= OP_ILOAD_0) && (cmd <= OP_ILOAD_3);
+  }
+
+  static boolean isShortStore(int cmd) {
+    return (cmd >= OP_ISTORE_0) && (cmd <= OP_ISTORE_3);
+  }
+
+  // mark all branch targets
+  static boolean[] targets(byte[] code) {
+    boolean[] target = new boolean[code.length];
+
+    for(int i=0;i<code.length;i+=length(code, i)) {
+      int cmd = unsigned(code[i]);
+
+      if(((cmd >= OP_IFEQ) && (cmd <= OP_IF_ICMPLE)) || (cmd == OP_GOTO))
+	target[i + get16(code, i+1)] = true;
+
+      if(cmd == OP_TABLESWITCH) {
+	target[i + get32(code, i+1)] = true;
+	for(int j=0;j<get32(code, i+9) - get32(code, i+5) + 1;j++)
+	  target[i + get32(code, i+13+4*j)] = true;
+      }
+
+      if(cmd == OP_LOOKUPSWITCH) {
+	target[i + get32(code, i+1)] = true;
+	for(int j=0;j<get32(code, i+5);j++)
+	  target[i + get32(code, i+13+8*j)] = true;
+      }
+    }
+
+    return target;
+  }
+
+  // replace frequent sequences of translated instructions by
+  // superinstructions. Sequences that are entered somewhere in
+  // the middle by a branch are left alone
+  public static void fuse(byte[] code) {
+    boolean[] target = targets(code);
+
+    for(int i=0;i<code.length;) {
+      int cmd = unsigned(code[i]);
+      int len = length(code, i);
+      int next[] = { -1, -1, -1 };
+
+      // get the (up to) three following instructions
+      for(int j=0, k=i+len;j<3;j++) {
+	next[j] = ((k < code.length) && !target[k])?unsigned(code[k]):-1;
+	if(next[j] < 0) break;
+	k += length(code, k);
+      }
+
+      // iload_x, iload_y, if_icmp<cond> -> compare locals x and y
+      if(isShortLoad(cmd) && isShortLoad(next[0]) &&
+	 (next[1] >= OP_IF_ICMPEQ) && (next[1] <= OP_IF_ICMPLE)) {
+	int offset = get16(code, i+3) + 2;
+
+	if(offset == (short)offset) {
+	  code[i+0] = signed(OP_ILOAD_ILOAD_IF_ICMPEQ + next[1] - OP_IF_ICMPEQ);
+	  code[i+1] = signed(cmd - OP_ILOAD_0);
+	  code[i+2] = signed(next[0] - OP_ILOAD_0);
+	  set16(code, i+3, offset);
+	  fusions[0]++;
+	  len = 5;
+	}
+      }
+
+      // iload_x, iconst_c, iadd, istore_y -> local y = local x + c
+      else if(isShortLoad(cmd) && 
+	      (next[0] >= OP_ICONST_M1) && (next[0] <= OP_ICONST_5) &&
+	      (next[1] == OP_IADD) && isShortStore(next[2])) {
+	code[i+0] = signed(OP_ILOAD_ICONST_IADD_ISTORE);
+	code[i+1] = signed(((cmd - OP_ILOAD_0) << 4) | (next[2] - OP_ISTORE_0));
+	code[i+2] = signed(next[0] - OP_ICONST_0);
+	code[i+3] = signed(OP_NOP);
+	fusions[1]++;
+	len = 4;
+      }
+
+      // iload_x, getfield -> get field of object in local x
+      else if(isShortLoad(cmd) && (next[0] == OP_GETFIELD) &&
+	      (code[i+2] == 0)) {
+	code[i+0] = signed(OP_ILOAD_GETFIELD);
+	code[i+1] = signed(cmd - OP_ILOAD_0);
+	code[i+2] = code[i+3];
+	code[i+3] = signed(OP_NOP);
+	fusions[2]++;
+	len = 4;
+      }
+
+      // iinc, goto -> increment and jump
+      else if((cmd == OP_IINC) && (next[0] == OP_GOTO)) {
+	int offset = get16(code, i+4) + 3;
+
+	if(offset == (short)offset) {
+	  code[i+0] = signed(OP_IINC_GOTO);
+	  set16(code, i+3, offset);
+	  code[i+5] = signed(OP_NOP);
+	  fusions[3]++;
+	  len = 6;
+	}
+      }
+
+      // the vm must support superinstructions to run this code
+      if(unsigned(code[i]) >= OP_ILOAD_ILOAD_IF_ICMPEQ)
+	UsedFeatures.add(UsedFeatures.SUPERINSN);
+
+      i += len;
+    }
+  }
+
+  // items popped and pushed by the translated instructions the
+  // accesses of a two dimensional array may be mixed with, null
+  // for all others
+  static int[] stackEffect(int cmd) {
+    if((cmd == OP_NOP) || (cmd == OP_IINC))
+      return new int[] { 0, 0 };
+
+    // constants, locals and static fields
+    if(((cmd >= OP_ICONST_M1) && (cmd <= OP_LDC)) ||
+       ((cmd >= OP_ILOAD) && (cmd <= OP_FLOAD_3)) || (cmd == OP_GETSTATIC))
+      return new int[] { 0, 1 };
+
+    // arithmetic
+    if(((cmd >= OP_IADD) && (cmd <= 0x73)) ||
+       ((cmd >= 0x78) && (cmd <= 0x83)) ||
+       (cmd == OP_FCMPL) || (cmd == OP_FCMPG))
+      return new int[] { 2, 1 };
+    if(((cmd >= 0x74) && (cmd <= 0x77)) || (cmd == OP_I2F) || (cmd == OP_F2I))
+      return new int[] { 1, 1 };
+
+    // arrays and fields
+    if((cmd >= OP_IALOAD) && (cmd <= OP_SALOAD))
+      return new int[] { 2, 1 };
+    if((cmd >= OP_IASTORE) && (cmd <= OP_SASTORE))
+      return new int[] { 3, 0 };
+    if(cmd == OP_ARRAYLOAD_2D)
+      return new int[] { 3, 1 };
+    if(cmd == OP_ARRAYSTORE_2D)
+      return new int[] { 4, 0 };
+    if((cmd == OP_GETFIELD) || (cmd == OP_ARRAYLENGTH))
+      return new int[] { 1, 1 };
+
+    return null;
+  }
+
+  // the instruction taking the item pushed by the one at i as its
+  // first operand, -1 if it can't be told from the straight code
+  // following it
+  static int consumer(byte[] code, boolean[] target, int i) {
+    int height = 1;
+
+    for(int j=i+length(code, i);(j < code.length) && !target[j];
+	j+=length(code, j)) {
+      int[] effect = stackEffect(unsigned(code[j]));
+
+      if(effect == null)
+	return -1;
+
+      if(effect[0] >= height)
+	return (effect[0] == height)?j:-1;
+
+      height += effect[1] - effect[0];
+    }
+
+    return -1;
+  }
+
+  // number of the local the instruction at i changes, -1 if none
+  static int storedLocal(byte[] code, int i) {
+    int cmd = unsigned(code[i]);
+
+    if((cmd == OP_ISTORE) || (cmd == OP_FSTORE) || (cmd == OP_IINC))
+      return unsigned(code[i+1]);
+    if((cmd >= OP_ISTORE_0) && (cmd <= OP_FSTORE_3))
+      return (cmd - OP_ISTORE_0) & 3;
+    return -1;
+  }
+
+  // number of the local the instruction at i pushes, -1 if none
+  static int loadedLocal(byte[] code, int i) {
+    int cmd = unsigned(code[i]);
+
+    if((cmd == OP_ILOAD) || (cmd == OP_FLOAD))
+      return unsigned(code[i+1]);
+    if((cmd >= OP_ILOAD_0) && (cmd <= OP_FLOAD_3))
+      return (cmd - OP_ILOAD_0) & 3;
+    return -1;
+  }
+
+  // number of two dimensional arrays found, of those stored flat
+  // and of accesses done by a single instruction
+  static int arrays2d = 0, flattened = 0, accesses2d = 0;
+
+  // access elements of two dimensional arrays with a single
+  // instruction. A rectangular array of values is stored in a
+  // single chunk if it's kept in a local (not one of the args
+  // arguments) that is only used for such accesses and to get its
+  // length. None of its rows can be seen anywhere else then
+  public static void flatten(byte[] code, int args) {
+    boolean[] target = targets(code);
+
+    // aaload, then load from or store into the row loaded
+    for(int i=0;i<code.length;i+=length(code, i)) {
+      int j;
+
+      if((unsigned(code[i]) != OP_AALOAD) ||
+	 ((j = consumer(code, target, i)) < 0))
+	continue;
+
+      if((unsigned(code[j]) >= OP_IALOAD) &&
+	 (unsigned(code[j]) <= OP_SALOAD))
+	code[j] = signed(OP_ARRAYLOAD_2D);
+      else if((unsigned(code[j]) >= OP_IASTORE) &&
+	      (unsigned(code[j]) <= OP_SASTORE))
+	code[j] = signed(OP_ARRAYSTORE_2D);
+      else
+	continue;
+
+      code[i] = signed(OP_NOP);
+      accesses2d++;
+
+      // the vm must support the 2d instructions to run this code
+      UsedFeatures.add(UsedFeatures.FLAT);
+    }
+
+    for(int i=0;i<code.length;i+=length(code, i)) {
+      // multianewarray of values with two dimensions, followed by
+      // the nop replacing its last byte and a store into a local
+      if((unsigned(code[i]) != OP_MULTIANEWARRAY) ||
+	 (unsigned(code[i+2]) != 2))
+	continue;
+
+      arrays2d++;
+
+      int store = i + length(code, i) + 1;
+      int local = (store < code.length)?storedLocal(code, store):-1;
+      boolean flat = (unsigned(code[i+1]) != T_OBJECT) &&
+	(local >= args) && !target[store] &&
+	(unsigned(code[store]) != OP_IINC);
+
+      for(int j=0;flat && (j<code.length);j+=length(code, j)) {
+	if((j != store) && (storedLocal(code, j) == local))
+	  flat = false;
+
+	if(loadedLocal(code, j) == local) {
+	  int k = consumer(code, target, j);
+
+	  flat = (k >= 0) &&
+	    ((unsigned(code[k]) == OP_ARRAYLOAD_2D) ||
+	     (unsigned(code[k]) == OP_ARRAYSTORE_2D) ||
+	     (unsigned(code[k]) == OP_ARRAYLENGTH));
+	}
+      }
+
+      if(flat) {
+	code[i+1] = signed(unsigned(code[i+1]) | T_FLAT);
+	flattened++;
+	UsedFeatures.add(UsedFeatures.FLAT);
+      }
+    }
+  }
+
+  public static void printFlattened() {
+    System.out.println("Two dimensional arrays: " + flattened + " of " +
+		       arrays2d + " stored flat, " + accesses2d +
+		       " accesses fused");
+  }
+
+  // print how often each superinstruction has been used
+  public static void printFusions() {
+    System.out.println("Superinstructions:");
+    for(int i=0;i<FUSION_NAMES.length;i++)
+      System.out.println("  " + FUSION_NAMES[i] + ": " + fusions[i]);
+  }
 }
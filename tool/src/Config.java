@@ -41,6 +41,11 @@ public class Config {
   static int target = TARGET_NONE;
   static String targetFile = null;
   static int targetSpeed = -1;
+  static boolean superInstructions = false;
+  static boolean scopedObjects = false;
+  static boolean flatArrays = false;
+  static boolean fullWords = false;
+  static Vector compileMethods = new Vector();
 
   static public int getTarget() {
     return target;
@@ -58,6 +63,28 @@ public class Config {
     return targetSpeed;
   }
 
+  static public boolean useSuperInstructions() {
+    return superInstructions;
+  }
+
+  static public boolean useScopedObjects() {
+    return scopedObjects;
+  }
+
+  static public boolean useFlatArrays() {
+    return flatArrays;
+  }
+
+  static public boolean useFullWords() {
+    return fullWords;
+  }
+
+  // methods to be compiled to c, all if none have been named
+  static public boolean compileMethod(String name) {
+    return compileMethods.isEmpty() || compileMethods.contains("all") ||
+      compileMethods.contains(name);
+  }
+
   static public int getMaxSize() {
     return maxSize;   // asuro
   }
@@ -133,6 +160,16 @@ public class Config {
 	    targetFile = value;
 	  } else if(name.equalsIgnoreCase("speed") && (value != null)) {
 	    targetSpeed = Integer.parseInt(value);
+	  } else if(name.equalsIgnoreCase("superinstructions") && (value != null)) {
+	    superInstructions = value.equalsIgnoreCase("yes");
+	  } else if(name.equalsIgnoreCase("scopedobjects") && (value != null)) {
+	    scopedObjects = value.equalsIgnoreCase("yes");
+	  } else if(name.equalsIgnoreCase("flatarrays") && (value != null)) {
+	    flatArrays = value.equalsIgnoreCase("yes");
+	  } else if(name.equalsIgnoreCase("fullwords") && (value != null)) {
+	    fullWords = value.equalsIgnoreCase("yes");
+	  } else if(name.equalsIgnoreCase("compile") && (value != null)) {
+	    compileMethods.addElement(value);
 	  } else {
 	    System.out.println("ERROR: Unknown config entry \"" + name + "\"");
 	    System.exit(-1);
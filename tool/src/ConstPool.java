@@ -292,6 +292,11 @@ public class ConstPool {
 
   static int encodeFloat(float val) {
     int ival = Float.floatToRawIntBits(val);
+
+    // the vm keeps floats as they are
+    if(Config.useFullWords())
+      return ival;
+
     boolean sign = ival<0;
     int exponent = ((ival>>23)&0xff);
     ival &= 0x007fffff;
@@ -310,6 +315,9 @@ public class ConstPool {
   }
 
   static int encodeInt(int val) {
+    if(Config.useFullWords())
+      return val;
+
     val = val & 0x7fffffff;
     return val;
   }
@@ -0,0 +1,481 @@
+//
+//  NanoVMTool, Converter and Upload Tool for the NanoVM
+//  Copyright (C) 2005 by Till Harbaum <Till@Harbaum.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+//
+// EscapeAnalysis.java
+//
+// finds objects that never leave the method creating them. They
+// aren't stored in a field, a static or an array, aren't returned
+// and are only handed to methods that don't keep them either. The
+// vm gives such objects back as soon as the method returns (see
+// heap_scope_release() in vm/src/heap.c).
+//
+// References can't be told from other values in the bytecode, so
+// every stack slot and local is tracked for possibly holding the
+// object in question. Anything not understood counts as an escape
+//
+
+import java.util.*;
+
+public class EscapeAnalysis {
+  // methods the object is handed to are followed this deep
+  final static int MAX_DEPTH = 3;
+
+  // java bytecode instructions not used by the CodeTranslator
+  final static int OP_POP           = 0x57;
+  final static int OP_POP2          = 0x58;
+  final static int OP_DUP           = 0x59;
+  final static int OP_DUP2          = 0x5c;
+  final static int OP_IF_ACMPNE     = 0xa6;
+  final static int OP_RETURN        = 0xb1;
+
+  // scoped new instructions (by code offset) of every method
+  static Vector scoped = new Vector();
+  static int allocations = 0, found = 0;
+
+  // the slots that may hold the object at some instruction
+  static class State {
+    boolean[] stack, locals;
+    int sp = 0;
+
+    State(int maxStack, int maxLocals) {
+      stack = new boolean[maxStack];
+      locals = new boolean[maxLocals];
+    }
+
+    State copy() {
+      State s = new State(stack.length, locals.length);
+      System.arraycopy(stack, 0, s.stack, 0, stack.length);
+      System.arraycopy(locals, 0, s.locals, 0, locals.length);
+      s.sp = sp;
+      return s;
+    }
+
+    void push(boolean v) { stack[sp++] = v; }
+    boolean pop()        { return stack[--sp]; }
+
+    // true if anything is new to this state
+    boolean merge(State s) {
+      boolean changed = false;
+
+      for(int i=0;i<sp;i++)
+	if(s.stack[i] && !stack[i]) { stack[i] = true; changed = true; }
+      for(int i=0;i<locals.length;i++)
+	if(s.locals[i] && !locals[i]) { locals[i] = true; changed = true; }
+
+      return changed;
+    }
+  }
+
+  // length of an (untranslated) java bytecode instruction
+  static int length(byte[] code, int i) {
+    int cmd = CodeTranslator.unsigned(code[i]);
+
+    switch(cmd) {
+    case 0x10: case 0x12: case 0x15: case 0x16: case 0x17: case 0x18:
+    case 0x19: case 0x36: case 0x37: case 0x38: case 0x39: case 0x3a:
+    case 0xa9: case 0xbc:
+      return 2;
+
+    case 0x11: case 0x13: case 0x14: case 0x84: case 0xb2: case 0xb3:
+    case 0xb4: case 0xb5: case 0xb6: case 0xb7: case 0xb8: case 0xbb:
+    case 0xbd: case 0xc0: case 0xc1: case 0xc6: case 0xc7:
+      return 3;
+
+    case 0xc5:
+      return 4;
+
+    case 0xb9: case 0xba: case 0xc8: case 0xc9:
+      return 5;
+
+    // switch data is aligned to 4 bytes
+    case CodeTranslator.OP_TABLESWITCH: {
+      int j = (i + 4) & ~3;
+      return j - i + 12 + 4 * (CodeTranslator.get32(code, j+8) -
+			       CodeTranslator.get32(code, j+4) + 1);
+    }
+
+    case CodeTranslator.OP_LOOKUPSWITCH: {
+      int j = (i + 4) & ~3;
+      return j - i + 8 + 8 * CodeTranslator.get32(code, j+4);
+    }
+    }
+
+    if((cmd >= 0x99) && (cmd <= 0xa8))
+      return 3;
+
+    return 1;
+  }
+
+  // number of arguments of a method including the object reference
+  static int arguments(String type, boolean isStatic) {
+    MethodInfo methodInfo = new MethodInfo(
+      (short)(isStatic?AccessFlags.STATIC:0), "", type);
+    return methodInfo.getArgs();
+  }
+
+  // the methods an invoke may end up in, null if unknown. A virtual
+  // call may reach an overriding method of any class
+  static Vector implementations(int cmd, String className,
+				String name, String type) {
+    Vector methods = new Vector();
+    ClassInfo classInfo = ClassLoader.getClassInfo(className);
+
+    while((classInfo != null) && !classInfo.providesMethod(name, type))
+      classInfo = ClassLoader.getClassInfo(classInfo.getSuperClassName());
+
+    if(classInfo == null)
+      return null;
+
+    methods.addElement(classInfo);
+
+    if(cmd == CodeTranslator.OP_INVOKEVIRTUAL) {
+      for(int i=0;i<ClassLoader.totalClasses();i++) {
+	ClassInfo other = ClassLoader.getClassInfo(i);
+	if((other != classInfo) && other.providesMethod(name, type))
+	  methods.addElement(other);
+      }
+    }
+
+    return methods;
+  }
+
+  // native string buffers return themselves from append() and don't
+  // keep any reference
+  static boolean isBuffer(String className) {
+    return className.equals("java/lang/StringBuffer") ||
+      className.equals("java/lang/StringBuilder");
+  }
+
+  // simulate an invoke. Returns true if the object may escape
+  static boolean invoke(ConstPool cp, int cmd, int index, State s,
+			int depth) {
+    ConstPoolEntry entry = cp.getEntryAtIndex(index);
+    String className = cp.getClassName(entry);
+    String name = cp.getMethodName(entry);
+    String type = cp.getMethodType(entry);
+    boolean isStatic = (cmd == CodeTranslator.OP_INVOKESTATIC);
+    boolean[] args = new boolean[arguments(type, isStatic)];
+    boolean result = false;
+
+    for(int i=args.length-1;i>=0;i--)
+      args[i] = s.pop();
+
+    for(int i=0;i<args.length;i++) {
+      if(!args[i])
+	continue;
+
+      if(NativeMapper.methodIsNative(className, name, type)) {
+	// only the object itself may be passed to harmless methods
+	if(isStatic || (i != 0))
+	  return true;
+
+	if(isBuffer(className))
+	  result = type.endsWith(")L" + className + ";");
+	else if(!className.equals("java/lang/Object") ||
+		!name.equals("<init>"))
+	  return true;
+      } else {
+	Vector methods = implementations(cmd, className, name, type);
+
+	if((methods == null) || (depth >= MAX_DEPTH))
+	  return true;
+
+	for(int j=0;j<methods.size();j++) {
+	  ClassInfo classInfo = (ClassInfo)methods.elementAt(j);
+	  MethodInfo methodInfo = classInfo.getMethod(
+	    classInfo.getMethodIndex(name, type));
+
+	  if(escapes(classInfo, methodInfo, -1, i, depth+1))
+	    return true;
+	}
+      }
+    }
+
+    if(!type.endsWith(")V"))
+      s.push(result);
+
+    return false;
+  }
+
+  // continue at target with state s. Returns false if the stack
+  // depths don't match
+  static boolean branch(State[] states, Vector todo, int target, State s) {
+    if((target < 0) || (target >= states.length))
+      return false;
+
+    if(states[target] == null) {
+      states[target] = s.copy();
+      todo.addElement(new Integer(target));
+    } else if(states[target].sp != s.sp)
+      return false;
+    else if(states[target].merge(s))
+      todo.addElement(new Integer(target));
+
+    return true;
+  }
+
+  // may the object created by the new instruction at site (or given
+  // in local param if site is -1) be referenced once the method has
+  // returned?
+  static boolean escapes(ClassInfo classInfo, MethodInfo methodInfo,
+			 int site, int param, int depth) {
+    CodeInfo codeInfo = methodInfo.getCodeInfo();
+    if(codeInfo == null)
+      return true;
+
+    ConstPool cp = classInfo.getConstPool();
+    byte[] code = codeInfo.getBytecode();
+    State[] states = new State[code.length];
+    Vector todo = new Vector();
+
+    // no exception handlers, the vm doesn't throw any
+    if((codeInfo.getExceptionTable() != null) &&
+       (codeInfo.getExceptionTable().length > 0))
+      return true;
+
+    states[0] = new State(codeInfo.getMaxStack(), codeInfo.getMaxLocals());
+    if(param >= 0)
+      states[0].locals[param] = true;
+    todo.addElement(new Integer(0));
+
+    while(!todo.isEmpty()) {
+      int pc = ((Integer)todo.lastElement()).intValue();
+      todo.removeElementAt(todo.size()-1);
+
+      State s = states[pc].copy();
+      int cmd = CodeTranslator.unsigned(code[pc]);
+      int next = pc + length(code, pc);
+      boolean v1, v2, v3, v4;
+
+      try {
+	// constants and static fields
+	if((cmd <= 0x14) || (cmd == CodeTranslator.OP_GETSTATIC))
+	  s.push(false);
+
+	// loads
+	else if(cmd <= 0x19)
+	  s.push(s.locals[CodeTranslator.unsigned(code[pc+1])]);
+	else if(cmd <= 0x2d)
+	  s.push(s.locals[(cmd - 0x1a) & 3]);
+
+	// array loads
+	else if(cmd <= 0x35) {
+	  s.pop(); s.pop(); s.push(false);
+	}
+
+	// stores
+	else if(cmd <= 0x3a)
+	  s.locals[CodeTranslator.unsigned(code[pc+1])] = s.pop();
+	else if(cmd <= 0x4e)
+	  s.locals[(cmd - 0x3b) & 3] = s.pop();
+
+	// array stores, the object may be stored into an array
+	else if(cmd <= 0x56) {
+	  v1 = s.pop(); s.pop(); s.pop();
+	  if(v1) return true;
+	}
+
+	else if(cmd == OP_POP)
+	  s.pop();
+	else if(cmd == OP_POP2) {
+	  s.pop(); s.pop();
+	}
+	else if(cmd == OP_DUP) {
+	  v1 = s.pop(); s.push(v1); s.push(v1);
+	}
+	else if(cmd == CodeTranslator.OP_DUP_X1) {
+	  v1 = s.pop(); v2 = s.pop();
+	  s.push(v1); s.push(v2); s.push(v1);
+	}
+	else if(cmd == CodeTranslator.OP_DUP_X2) {
+	  v1 = s.pop(); v2 = s.pop(); v3 = s.pop();
+	  s.push(v1); s.push(v3); s.push(v2); s.push(v1);
+	}
+	else if(cmd == OP_DUP2) {
+	  v1 = s.pop(); v2 = s.pop();
+	  s.push(v2); s.push(v1); s.push(v2); s.push(v1);
+	}
+	else if(cmd == CodeTranslator.OP_DUP2_X1) {
+	  v1 = s.pop(); v2 = s.pop(); v3 = s.pop();
+	  s.push(v2); s.push(v1); s.push(v3); s.push(v2); s.push(v1);
+	}
+	else if(cmd == CodeTranslator.OP_DUP2_X2) {
+	  v1 = s.pop(); v2 = s.pop(); v3 = s.pop(); v4 = s.pop();
+	  s.push(v2); s.push(v1); s.push(v4); s.push(v3);
+	  s.push(v2); s.push(v1);
+	}
+	else if(cmd == CodeTranslator.OP_SWAP) {
+	  v1 = s.pop(); v2 = s.pop();
+	  s.push(v1); s.push(v2);
+	}
+
+	// arithmetic on values the object can't be one of
+	else if(((cmd >= 0x60) && (cmd <= 0x73)) ||
+		((cmd >= 0x78) && (cmd <= 0x83)) ||
+		((cmd >= 0x94) && (cmd <= 0x98))) {
+	  s.pop(); s.pop(); s.push(false);
+	}
+	else if(((cmd >= 0x74) && (cmd <= 0x77)) ||
+		((cmd >= 0x85) && (cmd <= 0x93))) {
+	  s.pop(); s.push(false);
+	}
+	else if(cmd == CodeTranslator.OP_IINC) {
+	  // only changes an int local
+	}
+
+	// conditional branches
+	else if(((cmd >= CodeTranslator.OP_IFEQ) && (cmd <= OP_IF_ACMPNE)) ||
+		(cmd == CodeTranslator.OP_IFNULL) ||
+		(cmd == CodeTranslator.OP_IFNONNULL)) {
+	  s.pop();
+	  if((cmd >= CodeTranslator.OP_IF_ICMPEQ) && (cmd <= OP_IF_ACMPNE))
+	    s.pop();
+	  if(!branch(states, todo, pc + CodeTranslator.get16(code, pc+1), s))
+	    return true;
+	}
+
+	else if(cmd == CodeTranslator.OP_GOTO) {
+	  if(!branch(states, todo, pc + CodeTranslator.get16(code, pc+1), s))
+	    return true;
+	  next = -1;
+	}
+
+	else if((cmd == CodeTranslator.OP_TABLESWITCH) ||
+		(cmd == CodeTranslator.OP_LOOKUPSWITCH)) {
+	  int j = (pc + 4) & ~3;
+	  int entries = (cmd == CodeTranslator.OP_TABLESWITCH)?
+	    (CodeTranslator.get32(code, j+8) - CodeTranslator.get32(code, j+4) + 1):
+	    CodeTranslator.get32(code, j+4);
+
+	  s.pop();
+	  if(!branch(states, todo, pc + CodeTranslator.get32(code, j), s))
+	    return true;
+
+	  for(int k=0;k<entries;k++) {
+	    int offset = (cmd == CodeTranslator.OP_TABLESWITCH)?
+	      CodeTranslator.get32(code, j+12+4*k):
+	      CodeTranslator.get32(code, j+12+8*k);
+	    if(!branch(states, todo, pc + offset, s))
+	      return true;
+	  }
+	  next = -1;
+	}
+
+	// returning the object makes it escape
+	else if((cmd >= CodeTranslator.OP_IRETURN) &&
+		(cmd <= CodeTranslator.OP_ARETURN)) {
+	  if(s.pop()) return true;
+	  next = -1;
+	}
+	else if(cmd == OP_RETURN)
+	  next = -1;
+
+	// so does storing it into a field. Storing into its
+	// own fields is fine
+	else if(cmd == CodeTranslator.OP_PUTSTATIC) {
+	  if(s.pop()) return true;
+	}
+	else if(cmd == CodeTranslator.OP_GETFIELD) {
+	  s.pop(); s.push(false);
+	}
+	else if(cmd == CodeTranslator.OP_PUTFIELD) {
+	  v1 = s.pop(); s.pop();
+	  if(v1) return true;
+	}
+
+	else if((cmd >= CodeTranslator.OP_INVOKEVIRTUAL) &&
+		(cmd <= CodeTranslator.OP_INVOKESTATIC)) {
+	  if(invoke(cp, cmd, 256 * CodeTranslator.unsigned(code[pc+1]) +
+		    CodeTranslator.unsigned(code[pc+2]), s, depth))
+	    return true;
+	}
+
+	// every object created here is the one in question
+	else if(cmd == CodeTranslator.OP_NEW)
+	  s.push(pc == site);
+
+	else if((cmd >= CodeTranslator.OP_NEWARRAY) &&
+		(cmd <= CodeTranslator.OP_ARRAYLENGTH)) {
+	  s.pop(); s.push(false);
+	}
+	else if(cmd == CodeTranslator.OP_MULTIANEWARRAY) {
+	  for(int i=0;i<CodeTranslator.unsigned(code[pc+3]);i++)
+	    s.pop();
+	  s.push(false);
+	}
+
+	// anything else isn't understood
+	else
+	  return true;
+
+      } catch(ArrayIndexOutOfBoundsException e) {
+	return true;
+      }
+
+      if((next >= 0) && !branch(states, todo, next, s))
+	return true;
+    }
+
+    return false;
+  }
+
+  // look for scoped objects in all methods. Has to be done before
+  // any bytecode is translated as called methods are inspected too
+  public static void analyze() {
+    for(int i=0;i<ClassLoader.totalMethods();i++) {
+      ClassInfo classInfo = ClassLoader.getClassInfoFromMethodIndex(i);
+      MethodInfo methodInfo = ClassLoader.getMethod(i);
+      byte[] code = methodInfo.getCodeInfo().getBytecode();
+      boolean[] sites = new boolean[code.length];
+
+      for(int pc=0;pc<code.length;pc+=length(code, pc)) {
+	if(CodeTranslator.unsigned(code[pc]) == CodeTranslator.OP_NEW) {
+	  allocations++;
+	  if(!escapes(classInfo, methodInfo, pc, -1, 0)) {
+	    sites[pc] = true;
+	    found++;
+	  }
+	}
+      }
+
+      scoped.addElement(sites);
+    }
+  }
+
+  // replace the new instructions of scoped objects in the translated
+  // code of method i. Their operands stay the same
+  public static void markScoped(int i, byte[] code) {
+    boolean[] sites = (boolean[])scoped.elementAt(i);
+
+    for(int pc=0;pc<code.length;pc++) {
+      if(sites[pc]) {
+	code[pc] = CodeTranslator.signed(CodeTranslator.OP_NEW_SCOPED);
+
+	// the vm must support scoped objects to run this code
+	UsedFeatures.add(UsedFeatures.SCOPED);
+      }
+    }
+  }
+
+  public static void printScoped() {
+    System.out.println("Scoped objects: " + found + " of " +
+		       allocations + " allocations");
+  }
+}
@@ -26,6 +26,27 @@
 
 public class MethodIdTable {
   private static int[] mindex;
+  private static int slots;
+
+  // methods that may be called via invokevirtual and thus need
+  // a slot in the virtual method tables
+  private static boolean isVirtual(MethodInfo methodInfo) {
+    return ((methodInfo.getAccessFlags() & AccessFlags.STATIC) == 0) &&
+      !methodInfo.getName().equals("<init>");
+  }
+
+  // use same id on all methods with same name and signature
+  private static void assign(int i, int id) {
+    for(int j = i;j<ClassLoader.totalMethods();j++) {
+      if(ClassLoader.getMethod(i).getName().equals(
+	   ClassLoader.getMethod(j).getName()) &&
+	 ClassLoader.getMethod(i).getSignature().equals(
+	   ClassLoader.getMethod(j).getSignature())) {
+
+	mindex[j] = id;
+      }
+    }
+  }
 
   // build the complete method id table
   public static void build() {
@@ -34,23 +55,18 @@ public class MethodIdTable {
     // clear index table
     for(int i=0;i<ClassLoader.totalMethods();i++) mindex[i] = -1;
 
-    // generate table
-    for(int i=0,id = 0;i<ClassLoader.totalMethods();i++) {
-      // entry has not been set yet
-      if(mindex[i] == -1) {
-	// use same id on all methods mit same name and signature
-	for(int j = i;j<ClassLoader.totalMethods();j++) {
-	  if(ClassLoader.getMethod(i).getName().equals(
-	       ClassLoader.getMethod(j).getName()) &&
-	     ClassLoader.getMethod(i).getSignature().equals(
-	       ClassLoader.getMethod(j).getSignature())) {
-	    
-	    mindex[j] = id;
-	  }
-	}
-	id++;
-      }
-    }
+    // generate table, virtual methods get the lowest ids, so the
+    // id can directly be used as a slot in the virtual method tables
+    int id = 0;
+    for(int i=0;i<ClassLoader.totalMethods();i++)
+      if((mindex[i] == -1) && isVirtual(ClassLoader.getMethod(i)))
+	assign(i, id++);
+
+    slots = id;
+
+    for(int i=0;i<ClassLoader.totalMethods();i++)
+      if(mindex[i] == -1)
+	assign(i, id++);
   }
 
   // get one entry from the method id table
@@ -58,4 +74,24 @@ public class MethodIdTable {
     return mindex[i];
   }
 
+  // number of slots in the virtual method table of each class
+  public static int getVTableSlots() {
+    return slots;
+  }
+
+  // get index of the method invoked for slot on an object of class
+  // classIndex. This is the method with this id in the class itself
+  // or in the nearest super class implementing it
+  public static int getVTableEntry(int classIndex, int slot) {
+    while((classIndex >= 0) && (classIndex < ClassLoader.totalClasses())) {
+      for(int i=0;i<ClassLoader.totalMethods();i++)
+	if((ClassLoader.getClassIndex(i) == classIndex) && (mindex[i] == slot))
+	  return i;
+
+      classIndex = ClassLoader.getClassInfo(classIndex).getSuperClassIndex();
+    }
+
+    // no class in the chain implements this method
+    return 0xff;
+  }
 }
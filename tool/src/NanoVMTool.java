@@ -24,6 +24,7 @@ public class NanoVMTool {
   public static void usage() {
     System.out.println("Usage: NanoVMTool [options] config classpath class");
     System.out.println("Options:");
+    System.out.println("    -a name   write methods compiled to c file");
     System.out.println("    -c        write c header file");
     System.out.println("    -f name   force output file name");
   }
@@ -32,6 +33,7 @@ public class NanoVMTool {
     int curArg = 0;
     boolean writeHeader = false;
     String outputFileName = null;
+    String aotFileName = null;
 
     System.out.println("NanoVMTool " + Version.version + 
 		       " - (c) 2005-2007 by Till Harbaum");
@@ -39,6 +41,10 @@ public class NanoVMTool {
     // parse options
     while((args.length > curArg) && (args[curArg].charAt(0) == '-')) {
       switch(args[curArg].charAt(1)) {
+	case 'a':
+	  aotFileName = args[++curArg];
+	  break;
+
 	case 'c':
 	  writeHeader = true;
 	  break;
@@ -76,6 +82,6 @@ public class NanoVMTool {
 		       ClassLoader.totalClasses() + " classes");
 
     // for first tries: write converted file to disk
-    UVMWriter writer = new UVMWriter(writeHeader);
+    UVMWriter writer = new UVMWriter(writeHeader, aotFileName);
   }
 }
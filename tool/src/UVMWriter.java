@@ -29,7 +29,7 @@ import java.util.*;
 
 public class UVMWriter {
   static final int MAGIC   = 0xBE000000;
-  static final int VERSION = 2;
+  static final int VERSION = 4;
 
   byte[] outputBuffer;
   int cur;
@@ -66,7 +66,11 @@ public class UVMWriter {
 
   // write uvm file header
   void writeHeader() throws ConvertException {
-    int offset = 15;    // header size: 15 bytes
+    int offset = 21;    // header size: 21 bytes
+
+    // constants are written for full word ints and floats
+    if(Config.useFullWords())
+      UsedFeatures.add(UsedFeatures.FULLWORDS);
 
     write32(MAGIC|UsedFeatures.get());
     write8(VERSION);
@@ -81,11 +85,25 @@ public class UVMWriter {
     offset += 4 * ClassLoader.totalConstantEntries(); // constant value size: 4bytes
     write16(offset);
 
-    // offset to method data
+    // offset to virtual method tables
     offset += 2 * ClassLoader.totalStrings(); // string indices
     offset += ClassLoader.totalStringSize();  // string data
+    int vtableOffset = offset;
+
+    // offset to reference maps
+    offset += ClassLoader.totalClasses() * MethodIdTable.getVTableSlots();
+    int refMapOffset = offset;
+
+    // offset to method data
+    offset += ClassLoader.totalClasses() * getRefMapBytes();
     write16(offset);
     write8(ClassLoader.totalStaticFields());  // static fields
+
+    write16(vtableOffset);
+    write8(MethodIdTable.getVTableSlots());   // vtable entries per class
+
+    write16(refMapOffset);
+    write8(getRefMapBytes());                 // reference map bytes per class
   }
 
   // write all class headers
@@ -129,13 +147,57 @@ public class UVMWriter {
     }
   }
 
+  // write the virtual method tables of all classes, one byte
+  // (the method index) per slot
+  void writeVTables() throws ConvertException {
+    System.out.println("Writing " + ClassLoader.totalClasses() + 
+		       " virtual method tables with " + 
+		       MethodIdTable.getVTableSlots() + " slots");
+
+    for(int i=0;i<ClassLoader.totalClasses();i++)
+      for(int j=0;j<MethodIdTable.getVTableSlots();j++)
+	write8(MethodIdTable.getVTableEntry(i, j));
+  }
+
+  // reference map of a class, one bit per non-static field slot
+  // (field ids are 8 bit, so there are at most 256 slots)
+  static byte[] getRefMap(int index) {
+    byte map[] = new byte[32];
+    ClassLoader.getClassInfo(index).getReferenceMap(map);
+    return map;
+  }
+
+  // bytes needed to hold the reference maps of all classes
+  static int getRefMapBytes() {
+    int bytes = 0;
+
+    for(int i=0;i<ClassLoader.totalClasses();i++) {
+      byte map[] = getRefMap(i);
+      for(int j=bytes;j<map.length;j++)
+	if(map[j] != 0) bytes = j+1;
+    }
+    return bytes;
+  }
+
+  // write the reference maps of all classes, the garbage collector
+  // uses them to find the fields of an object that hold references
+  void writeRefMaps() throws ConvertException {
+    int bytes = getRefMapBytes();
+
+    System.out.println("Writing " + ClassLoader.totalClasses() + 
+		       " reference maps with " + bytes + " bytes");
+
+    for(int i=0;i<ClassLoader.totalClasses();i++) {
+      byte map[] = getRefMap(i);
+      for(int j=0;j<bytes;j++)
+	write8(map[j]);
+    }
+  }
+
   // write all methods
   void writeMethods() throws ConvertException {
     int codeOffset = 0;
 
-    // build the method id table
-    MethodIdTable.build();
-      
     // write all Method headers
     for(int i=0;i<ClassLoader.totalMethods();i++) {
       MethodInfo methodInfo = ClassLoader.getMethod(i);
@@ -153,6 +215,10 @@ public class UVMWriter {
       codeOffset += methodInfo.getCodeInfo().getBytecode().length;
     }
 
+    // find objects to be freed when their method returns
+    if(Config.useScopedObjects())
+      EscapeAnalysis.analyze();
+
     // write bytecode
     for(int i=0;i<ClassLoader.totalMethods();i++) {
       ClassInfo classInfo = ClassLoader.getClassInfoFromMethodIndex(i);
@@ -167,6 +233,22 @@ public class UVMWriter {
 
       // adjust references etc
       CodeTranslator.translate(classInfo, code);
+      byte source[] = (byte[])code.clone();
+
+      // compiled code leaves all objects to the garbage collector
+      if(Config.useScopedObjects())
+	EscapeAnalysis.markScoped(i, code);
+
+      // access two dimensional arrays by a single instruction
+      if(Config.useFlatArrays())
+	CodeTranslator.flatten(code, methodInfo.getArgs());
+
+      // replace frequent instruction sequences
+      if(Config.useSuperInstructions())
+	CodeTranslator.fuse(code);
+
+      // keep unfused code for the c compiler
+      CCompiler.addMethod(i, source, code);
 
       // and write bytecode
       for(int j=0;j<code.length;j++)
@@ -174,9 +256,18 @@ public class UVMWriter {
 
       System.out.println(""); 
     }
+
+    if(Config.useSuperInstructions())
+      CodeTranslator.printFusions();
+
+    if(Config.useScopedObjects())
+      EscapeAnalysis.printScoped();
+
+    if(Config.useFlatArrays())
+      CodeTranslator.printFlattened();
   }
 
-  public UVMWriter(boolean writeHeader) {
+  public UVMWriter(boolean writeHeader, String aotFileName) {
     System.out.println("Generating unified class file ...");
 
     // create output buffer and reset output pointer
@@ -184,12 +275,20 @@ public class UVMWriter {
     cur = 0;
 
     try {
+      MethodIdTable.build();   // build the method id table
+
       writeHeader();           // write file header
       writeClassHeaders();     // write class headers
       writeConstantEntries();  // write all 32-bit constants
       writeStrings();          // write all string data
+      writeVTables();          // write virtual method tables
+      writeRefMaps();          // write field reference maps
       writeMethods();          // write method headers and byte code
       updateHeader();          // update feature values
+
+      // write methods compiled to c when -a option was given
+      if(aotFileName != null)
+	CCompiler.write(aotFileName);
       
       // overwrite target config when -c option was given
       if(writeHeader) {
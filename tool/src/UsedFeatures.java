@@ -34,6 +34,10 @@ public class UsedFeatures {
   static final int ARRAY        = (1<<4);
   static final int INHERITANCE  = (1<<5);
   static final int EXTSTACK     = (1<<6);
+  static final int SUPERINSN    = (1<<7);
+  static final int SCOPED       = (1<<8);
+  static final int FLAT         = (1<<9);
+  static final int FULLWORDS    = (1<<10);
 
   private static int features;
 
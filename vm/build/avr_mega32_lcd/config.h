@@ -19,7 +19,9 @@
 // #define NVMCOMM2
 
 #define CODESIZE 1024
-#define HEAPSIZE (2048-256)    // NanoVM itself requires 256 Bytes RAM
+#define HEAPSIZE (2048-256-128) // NanoVM itself requires 256 Bytes RAM + tables
+#define NVM_METHOD_TABLE_SIZE 16  // max. number of methods in nvm file
+#define NVM_CLASS_TABLE_SIZE  4   // max. number of classes in nvm file
 
 // avr and lcd specific native init routines
 #define NATIVE_INIT  { native_init(); native_lcd_init(); }
@@ -17,6 +17,8 @@
 
 #define CODESIZE 512
 #define HEAPSIZE 768
+#define NVM_METHOD_TABLE_SIZE 8   // max. number of methods in nvm file
+#define NVM_CLASS_TABLE_SIZE  4   // max. number of classes in nvm file
 
 // avr specific native init routines
 #define NATIVE_INIT  native_init()
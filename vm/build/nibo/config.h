@@ -18,6 +18,8 @@
 
 #define CODESIZE 8192          // maximum java program size
 #define HEAPSIZE 1024          // only 1204 to use 8 bit heap entries...
+#define NVM_METHOD_TABLE_SIZE 64  // max. number of methods in nvm file
+#define NVM_CLASS_TABLE_SIZE  16  // max. number of classes in nvm file
 
 
 // use flash to store java program
@@ -34,9 +36,18 @@
 #define NVM_USE_TABLESWITCH      // support switch instruction
 #define NVM_USE_LOOKUPSWITCH     // support switch instruction
 #define NVM_USE_INHERITANCE      // support for inheritance
+#define NVM_USE_INLINE_CACHE     // cache methods resolved by invokevirtual
+#define NVM_INLINE_CACHE_SIZE 16 // entries in inline cache (5 bytes each)
+#define NVM_USE_HEAP_HANDLES     // find heap objects through a handle table
+#define NVM_HEAP_HANDLES 64      // max. number of heap objects (2 bytes each)
+#define NVM_USE_INCREMENTAL_GC   // collect garbage in small steps
+#define NVM_USE_GENERATIONAL_GC  // collect new objects on their own
+#define NVM_USE_SCOPED_ALLOC     // free objects not escaping a method on return
 #define NVM_USE_32BIT_WORD
 #define NVM_USE_FLOAT
 #define NVM_USE_EXTSTACKOPS      // enable extended dup opcodes
+#define NVM_USE_SUPERINSN        // support fused instructions
+#define NVM_USE_CACHED_STACK     // keep stack pointer and top of stack in registers
 
 // native setup
 #define NVM_USE_MATH             // enable native math functions
@@ -5,8 +5,10 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
-#define CODESIZE 32768
-#define HEAPSIZE 768
+#define CODESIZE 32768          // default, see NVM_USE_SIZE_OPTIONS
+#define HEAPSIZE 1024           // default, see NVM_USE_SIZE_OPTIONS
+#define NVM_METHOD_TABLE_SIZE 255 // max. number of methods in nvm file
+#define NVM_CLASS_TABLE_SIZE  16  // max. number of classes in nvm file
 
 #define WDT_NO_STATISTICS  // all eeprom required for uvmfile
 
@@ -16,10 +18,30 @@
 
 #define NVM_USE_STACK_CHECK      // enable check if method returns empty stack
 #define NVM_USE_ARRAY            // enable arrays
+#define NVM_USE_OBJ_ARRAY        // enable arrays of objects
+#define NVM_USE_FLAT_ARRAYS      // keep two dimensional arrays in one chunk
 #define NVM_USE_SWITCH           // support switch instructions
 #define NVM_USE_INHERITANCE      // support for inheritance
+#define NVM_USE_INLINE_CACHE     // cache methods resolved by invokevirtual
+#define NVM_INLINE_CACHE_SIZE 256 // entries in inline cache
+#define NVM_USE_HEAP_HANDLES     // find heap objects through a handle table
+#define NVM_HEAP_HANDLES 128     // max. number of heap objects
+#define NVM_HEAP_ALIGN 4         // start chunks and array elements at 4 byte boundaries
+#define NVM_USE_INCREMENTAL_GC   // collect garbage in small steps
+#define NVM_USE_GENERATIONAL_GC  // collect new objects on their own
+#define NVM_USE_SCOPED_ALLOC     // free objects not escaping a method on return
+#define NVM_USE_OBJECT_POOLS     // keep small objects in pages of equal size
+#define NVM_USE_SIZE_OPTIONS     // heap and code size may be given on the command line (-H, -C)
 #define NVM_USE_FLOAT            // floating point support
 #define NVM_USE_32BIT_WORD       // 32 bit integer
+#define NVM_USE_FULL_WORDS       // ints and floats use all 32 bits of a stack item
+#define NVM_USE_COMPUTED_GOTO    // dispatch opcodes using gcc computed gotos
+#define NVM_USE_PREDECODE        // run pre-decoded ram copy of the code
+#define NVM_USE_SUPERINSN        // support fused instructions
+#define NVM_USE_CACHED_STACK     // keep stack pointer and top of stack in registers
+#ifdef __x86_64__
+#define NVM_USE_JIT              // translate methods into native code (-j)
+#endif
 
 // native setup
 #define NVM_USE_MATH             // enable native math functions
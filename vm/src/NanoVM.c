@@ -34,6 +34,10 @@
 #include "nvmfile.h"
 #include "vm.h"
 
+#ifdef NVM_USE_JIT
+#include "unix/jit.h"
+#endif
+
 // hooks for init routines
 
 #include "native_impl.h"
@@ -53,6 +57,33 @@
 #include "native_lcd.h"
 #endif
 
+#ifdef NVM_USE_SIZE_OPTIONS
+#include <stdlib.h>
+
+// a size given on the command line, in bytes or with a k or M suffix
+static u32_t size_option(char *name, char *arg, u32_t max) {
+  char *end;
+  unsigned long size;
+
+  if(!arg) {
+    printf("Option %s requires a size\n", name);
+    exit(-1);
+  }
+
+  size = strtoul(arg, &end, 0);
+  if((*end == 'k') || (*end == 'K')) { size <<= 10; end++; }
+  else if(*end == 'M')                { size <<= 20; end++; }
+
+  if(*end || !size || (size > max)) {
+    printf("Illegal size %s for option %s (max. %lu bytes)\n",
+	   arg, name, (unsigned long)max);
+    exit(-1);
+  }
+
+  return size;
+}
+#endif
+
 int main(int argc, char **argv) {
 
 #ifndef CTBOT
@@ -81,6 +112,23 @@ int main(int argc, char **argv) {
     if(argv[i][1] == 'q')
       quiet = TRUE;
 
+#ifdef NVM_USE_JIT
+    if(argv[i][1] == 'j')
+      jit_enabled = TRUE;
+#endif
+
+#ifdef NVM_USE_SIZE_OPTIONS
+    // the size follows as a separate argument
+    if(argv[i][1] == 'H') {
+      heap_size = size_option(argv[i], argv[i+1], HEAP_SIZE_MAX);
+      i++;
+    } else if(argv[i][1] == 'C') {
+      // the file format uses 16 bit offsets
+      nvmfile_size = size_option(argv[i], argv[i+1], 0xffff);
+      i++;
+    }
+#endif
+
     i++;
   }
 
@@ -114,6 +162,18 @@ int main(int argc, char **argv) {
 
   heap_garbage_collect();
   heap_show();
+
+#ifdef NVM_USE_INLINE_CACHE
+  if(!quiet)
+    printf("inline cache: %lu hits, %lu misses\n",
+	   (unsigned long)vm_icache_hits, (unsigned long)vm_icache_misses);
+#endif
+
+#ifdef NVM_USE_INCREMENTAL_GC
+  if(!quiet)
+    printf("garbage collector: %u cycles, longest pause %u bytes\n",
+	   heap_gc_cycles, heap_gc_longest_pause);
+#endif
 #endif // UNIX
 
   DEBUGF("main() returned\n");
@@ -25,78 +25,281 @@
 #include "vm.h"
 #include "array.h"
 #include "heap.h"
+#include "stack.h"
 
 #ifdef NVM_USE_ARRAY
 
-u08_t array_typelen(u08_t type) {
-  if((type == T_BOOLEAN)||(type == T_CHAR)||(type == T_BYTE))
+// the type of an array is kept right in front of its elements
+#define ARRAY_TYPE(ptr)  (((u08_t*)(ptr))[-1])
+
+static u08_t array_typelen(u08_t type) {
+  if(type == T_BYTE)
     return sizeof(nvm_byte_t);
   
-  if(type == T_SHORT)
+  if((type == T_SHORT)||(type == T_CHAR))
     return sizeof(nvm_short_t);
   if(type == T_INT)
     return sizeof(nvm_int_t);
+#ifdef NVM_USE_FLOAT
+  if(type == T_FLOAT)
+    return sizeof(nvm_float_t);
+#endif
+  if(type == T_OBJECT)
+    return sizeof(nvm_ref_t);
 
   error(ERROR_ARRAY_ILLEGAL_TYPE);
   return 0;  // to make compiler happy
 }
 
-heap_id_t array_new(nvm_int_t length, u08_t type) {
-  DEBUGF("newarray type %d len = %d: ", type, length);
-  DEBUGF("total size = %d bytes\n", length * array_typelen(type));
+// bytes taken by the elements, booleans are packed eight to a byte
+static heap_size_t array_bytes(u08_t type, heap_size_t length) {
+  if(type == T_BOOLEAN)
+    return (length+7)/8;
 
-  heap_id_t id = heap_alloc(FALSE, 1 + length * array_typelen(type));
+  return length * array_typelen(type);
+}
 
-  // store type in first byte
-  *(u08_t*)(heap_get_addr(id)) = type;
+// bytes taken by the elements of an existing array
+heap_size_t array_size(void *elements, heap_size_t length) {
+#ifdef NVM_USE_FLAT_ARRAYS
+  // a flat array has length rows, their size is in front of them
+  if(ARRAY_TYPE(elements) & T_FLAT)
+    return sizeof(nvm_word_t) + array_bytes(ARRAY_TYPE(elements) & ~T_FLAT,
+				    length * *(nvm_word_t*)elements);
+#endif
 
-  return id;
+  return array_bytes(ARRAY_TYPE(elements), length);
+}
+
+heap_id_t array_new(nvm_int_t length, u08_t type) {
+  DEBUGF("newarray type %d len = %d: ", type, length);
+  DEBUGF("total size = %d bytes\n", array_bytes(type, length));
+
+  // the garbage collector follows references in object arrays
+  return heap_alloc_array(type, length, array_bytes(type, length));
 }
 
 nvm_int_t array_length(heap_id_t id) {
-  DEBUGF("arraylength %d = %d/%d\n", id, 
-	 heap_get_len(id),
-	 array_typelen(*(u08_t*)heap_get_addr(id)));
+  DEBUGF("arraylength %d = %d\n", id, heap_get_count(id));
 
-  return(heap_get_len(id)/
-	 array_typelen(*(u08_t*)heap_get_addr(id)));
+  return heap_get_count(id);
 }
  
+// bastore and baload are used for byte and boolean arrays
 void array_bastore(heap_id_t id, nvm_int_t index, nvm_byte_t value) {
-  nvm_byte_t * ptr = (nvm_byte_t *)heap_get_addr(id) + 1;
+  nvm_byte_t * ptr = (nvm_byte_t *)heap_get_addr(id);
   DEBUGF("bastore id=%x, index=%d, value=%d\n", id, index, value);
-  ptr[index] = value;
+
+  if(ARRAY_TYPE(ptr) != T_BOOLEAN)
+    ptr[index] = value;
+  else if(value & 1)
+    ptr[index>>3] |= 1<<(index&7);
+  else
+    ptr[index>>3] &= ~(1<<(index&7));
 }
 
 nvm_byte_t array_baload(heap_id_t id, nvm_int_t index) {
-  nvm_byte_t * ptr = (nvm_byte_t*)heap_get_addr(id) + 1;
+  nvm_byte_t * ptr = (nvm_byte_t*)heap_get_addr(id);
   DEBUGF("baload id=%x, index=%d\n", id, index);
+
+  if(ARRAY_TYPE(ptr) == T_BOOLEAN)
+    return (ptr[index>>3] >> (index&7)) & 1;
+
+  return ptr[index];
+}
+
+// sastore is used for char arrays as well
+void array_sastore(heap_id_t id, nvm_int_t index, nvm_short_t value) {
+  nvm_short_t * ptr = (nvm_short_t *)heap_get_addr(id);
+  DEBUGF("sastore id=%x, index=%d, value=%d\n", id, index, value);
+  ptr[index] = value;
+}
+
+nvm_short_t array_saload(heap_id_t id, nvm_int_t index) {
+  nvm_short_t * ptr = (nvm_short_t*)heap_get_addr(id);
+  DEBUGF("saload id=%x, index=%d\n", id, index);
+  return ptr[index];
+}
+
+// chars are unsigned
+nvm_int_t array_caload(heap_id_t id, nvm_int_t index) {
+  u16_t * ptr = (u16_t*)heap_get_addr(id);
+  DEBUGF("caload id=%x, index=%d\n", id, index);
   return ptr[index];
 }
 
 void array_iastore(heap_id_t id, nvm_int_t index, nvm_int_t value) {
-  nvm_int_t * ptr = (nvm_int_t *)((u08_t*)heap_get_addr(id) + 1);
+  nvm_int_t * ptr = (nvm_int_t *)heap_get_addr(id);
   DEBUGF("iastore id=%x, index=%d, value=%d\n", id, index, value);
   ptr[index] = value;
   HEAP_CHECK();
 }
 
 nvm_int_t array_iaload(heap_id_t id, nvm_int_t index) {
-  nvm_int_t * ptr = (nvm_int_t *)((u08_t*)heap_get_addr(id) + 1);
+  nvm_int_t * ptr = (nvm_int_t *)heap_get_addr(id);
   DEBUGF("iaload id=%x, index=%d\n", id, index);
   return ptr[index];
 }
 
+#ifdef NVM_USE_OBJ_ARRAY
+void array_aastore(heap_id_t id, nvm_int_t index, nvm_ref_t value) {
+  nvm_ref_t * ptr = (nvm_ref_t *)heap_get_addr(id);
+  DEBUGF("aastore id=%x, index=%d, value=%x\n", id, index, value);
+  HEAP_WRITE_BARRIER(id, ptr[index], value);
+  ptr[index] = value;
+}
+#endif
+
+#ifdef NVM_USE_OBJ_ARRAY
+// give each element of the array id a new array of its own. counts
+// holds the lengths of the dimensions still to be created
+static void array_fill_multi(heap_id_t id, nvm_stack_t *counts,
+			     u08_t dims, u08_t type) {
+  nvm_int_t i, length = array_length(id);
+
+  for(i=0;i<length;i++) {
+    heap_id_t row = array_new(nvm_stack2int(counts[0]),
+			      (dims > 1)?T_OBJECT:type);
+
+    // the row is reachable before anything else is allocated
+    array_aastore(id, i, row | NVM_TYPE_HEAP);
+    if(dims > 1)
+      array_fill_multi(row, counts+1, dims-1, type);
+  }
+}
+
+#ifdef NVM_USE_FLAT_ARRAYS
+static heap_id_t array_new_flat(nvm_int_t rows, nvm_int_t cols, u08_t type) {
+  heap_id_t id;
+
+  DEBUGF("newarray (flat) type %d %dx%d\n", type, rows, cols);
+  id = heap_alloc_array(type | T_FLAT, rows,
+			sizeof(nvm_word_t) + array_bytes(type, rows*cols));
+  *(nvm_word_t*)heap_get_addr(id) = cols;
+  return id;
+}
+#endif
+
+// multianewarray: replace the lengths of the dims dimensions on the
+// stack by the new array. type is the one of the innermost arrays
+void array_new_multi(u08_t type, u08_t dims) {
+  nvm_stack_t *counts = stack_get_sp() + 1 - dims;
+  heap_id_t id;
+
+#ifdef NVM_USE_FLAT_ARRAYS
+  if(type & T_FLAT)
+    id = array_new_flat(nvm_stack2int(counts[0]), nvm_stack2int(counts[1]),
+			type & ~T_FLAT);
+  else
+#endif
+    id = array_new(nvm_stack2int(counts[0]), (dims > 1)?T_OBJECT:type);
+
+  // the array is kept on the stack while its rows are created
+  counts[0] = id | NVM_TYPE_HEAP;
+#ifdef NVM_USE_FLAT_ARRAYS
+  if(!(type & T_FLAT))
+#endif
+    array_fill_multi(id, counts+1, dims-1, type);
+
+  stack_add_sp(1 - dims);
+}
+#endif
+
+#ifdef NVM_USE_FLAT_ARRAYS
+// element index of an array of the given type at ptr
+static nvm_stack_t array_get(void *ptr, u08_t type, nvm_int_t index) {
+  switch(type) {
+    case T_BOOLEAN:
+      return (((u08_t*)ptr)[index>>3] >> (index&7)) & 1;
+    case T_BYTE:
+      return nvm_int2stack(((nvm_byte_t*)ptr)[index]);
+    case T_SHORT:
+      return nvm_int2stack(((nvm_short_t*)ptr)[index]);
+    case T_CHAR:
+      return ((u16_t*)ptr)[index];
+#ifdef NVM_USE_FLOAT
+    case T_FLOAT:
+      return nvm_float2stack(((nvm_float_t*)ptr)[index]);
+#endif
+    case T_OBJECT:
+      return ((nvm_ref_t*)ptr)[index];
+  }
+
+  return nvm_int2stack(((nvm_int_t*)ptr)[index]);
+}
+
+static void array_put(heap_id_t id, void *ptr, u08_t type,
+		      nvm_int_t index, nvm_stack_t value) {
+  switch(type) {
+    case T_BOOLEAN:
+      if(value & 1)
+	((u08_t*)ptr)[index>>3] |= 1<<(index&7);
+      else
+	((u08_t*)ptr)[index>>3] &= ~(1<<(index&7));
+      break;
+    case T_BYTE:
+      ((nvm_byte_t*)ptr)[index] = value;
+      break;
+    case T_SHORT:
+    case T_CHAR:
+      ((nvm_short_t*)ptr)[index] = value;
+      break;
+#ifdef NVM_USE_FLOAT
+    case T_FLOAT:
+      ((nvm_float_t*)ptr)[index] = nvm_stack2float(value);
+      break;
+#endif
+    case T_OBJECT:
+      HEAP_WRITE_BARRIER(id, ((nvm_ref_t*)ptr)[index], value);
+      ((nvm_ref_t*)ptr)[index] = value;
+      break;
+    default:
+      ((nvm_int_t*)ptr)[index] = nvm_stack2int(value);
+      break;
+  }
+}
+
+// element col of row row. The element of a flat array is found by
+// a single address computation, other ones by loading the row first
+nvm_stack_t array_load2(heap_id_t id, nvm_int_t row, nvm_int_t col) {
+  void *ptr = heap_get_addr(id);
+  DEBUGF("arrayload id=%x, index=%d/%d\n", id, row, col);
+
+  if(ARRAY_TYPE(ptr) & T_FLAT)
+    return array_get((nvm_word_t*)ptr+1, ARRAY_TYPE(ptr) & ~T_FLAT,
+		     row * *(nvm_word_t*)ptr + col);
+
+  id = ((nvm_ref_t*)ptr)[row] & ~NVM_TYPE_MASK;
+  ptr = heap_get_addr(id);
+  return array_get(ptr, ARRAY_TYPE(ptr), col);
+}
+
+void array_store2(heap_id_t id, nvm_int_t row, nvm_int_t col,
+		  nvm_stack_t value) {
+  void *ptr = heap_get_addr(id);
+  DEBUGF("arraystore id=%x, index=%d/%d, value=%x\n", id, row, col, value);
+
+  if(ARRAY_TYPE(ptr) & T_FLAT)
+    array_put(id, (nvm_word_t*)ptr+1, ARRAY_TYPE(ptr) & ~T_FLAT,
+	      row * *(nvm_word_t*)ptr + col, value);
+  else {
+    id = ((nvm_ref_t*)ptr)[row] & ~NVM_TYPE_MASK;
+    ptr = heap_get_addr(id);
+    array_put(id, ptr, ARRAY_TYPE(ptr), col, value);
+  }
+}
+#endif
+
 #ifdef NVM_USE_FLOAT
 void array_fastore(heap_id_t id, nvm_int_t index, nvm_float_t value) {
-  nvm_float_t * ptr = (nvm_float_t*)((u08_t*)heap_get_addr(id) + 1);
+  nvm_float_t * ptr = (nvm_float_t*)heap_get_addr(id);
   DEBUGF("iastore id=%x, index=%d, value=%f\n", id, index, value);
   ptr[index] = value;
   HEAP_CHECK();
 }
 
 nvm_float_t array_faload(heap_id_t id, nvm_int_t index) {
-  nvm_float_t * ptr = (nvm_float_t*)((u08_t*)heap_get_addr(id) + 1);
+  nvm_float_t * ptr = (nvm_float_t*)heap_get_addr(id);
   DEBUGF("iaload id=%x, index=%d\n", id, index);
   return ptr[index];
 }
@@ -30,13 +30,37 @@
 #define T_SHORT   9
 #define T_INT 	 10
 #define T_LONG 	 11  // not allowed in mvm
+#define T_OBJECT 12  // nvm internal: array of references
 
+#ifdef NVM_USE_FLAT_ARRAYS
+#ifndef NVM_USE_OBJ_ARRAY
+#error NVM_USE_FLAT_ARRAYS requires NVM_USE_OBJ_ARRAY
+#endif
+
+// nvm internal: set in the type of a two dimensional array whose
+// rows are stored one after another in a single chunk
+#define T_FLAT   0x80
+#endif
+
+heap_size_t array_size(void *elements, heap_size_t length);
 heap_id_t   array_new(nvm_int_t length, u08_t type);
 nvm_int_t   array_length(heap_id_t id);
 void	    array_bastore(heap_id_t id, nvm_int_t index, nvm_byte_t value);
 nvm_byte_t  array_baload(heap_id_t id, nvm_int_t index);
+void        array_sastore(heap_id_t id, nvm_int_t index, nvm_short_t value);
+nvm_short_t array_saload(heap_id_t id, nvm_int_t index);
+nvm_int_t   array_caload(heap_id_t id, nvm_int_t index);
 void        array_iastore(heap_id_t id, nvm_int_t index, nvm_int_t value);
 nvm_int_t   array_iaload(heap_id_t id, nvm_int_t index);
+#ifdef NVM_USE_OBJ_ARRAY
+void        array_aastore(heap_id_t id, nvm_int_t index, nvm_ref_t value);
+void        array_new_multi(u08_t type, u08_t dims);
+#endif
+#ifdef NVM_USE_FLAT_ARRAYS
+nvm_stack_t array_load2(heap_id_t id, nvm_int_t row, nvm_int_t col);
+void        array_store2(heap_id_t id, nvm_int_t row, nvm_int_t col,
+			 nvm_stack_t value);
+#endif
 #ifdef NVM_USE_FLOAT
 void        array_fastore(heap_id_t id, nvm_int_t index, nvm_float_t value);
 nvm_float_t array_faload(heap_id_t id, nvm_int_t index);
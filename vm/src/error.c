@@ -42,12 +42,14 @@ char *error_msg[] = {
   "ARRAY: illegal type",             // G
   "NATIVE: unknown method",          // H
   "NATIVE: unknown class",           // I
-  "NVMFILE: unsupported features or not a valid nvm file",   // J
-  "NVMFILE: wrong nvm file version", // K
-  "VM: illegal reference",           // L
-  "VM: unsupported opcode",          // M
-  "VM: division by zero",            // N
-  "VM: stack corrupted",             // O
+  "NATIVE: illegal argument",        // J
+  "NVMFILE: unsupported features or not a valid nvm file",   // K
+  "NVMFILE: wrong nvm file version", // L
+  "NVMFILE: too many methods or classes", // M
+  "VM: illegal reference",           // N
+  "VM: unsupported opcode",          // O
+  "VM: division by zero",            // P
+  "VM: stack corrupted",             // Q
 };
 #else
 #include "uart.h"
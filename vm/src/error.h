@@ -43,8 +43,9 @@
 #define ERROR_NVMFILE_BASE                (ERROR_NATIVE_BASE+3)
 #define ERROR_NVMFILE_MAGIC               (ERROR_NVMFILE_BASE+0)
 #define ERROR_NVMFILE_VERSION             (ERROR_NVMFILE_BASE+1)
+#define ERROR_NVMFILE_TABLE_SIZE          (ERROR_NVMFILE_BASE+2)
 
-#define ERROR_VM_BASE                     (ERROR_NVMFILE_BASE+2)
+#define ERROR_VM_BASE                     (ERROR_NVMFILE_BASE+3)
 #define ERROR_VM_ILLEGAL_REFERENCE        (ERROR_VM_BASE+0)
 #define ERROR_VM_UNSUPPORTED_OPCODE       (ERROR_VM_BASE+1)
 #define ERROR_VM_DIVISION_BY_ZERO         (ERROR_VM_BASE+2)
@@ -36,18 +36,183 @@
 #include "heap.h"
 #include "stack.h"
 #include "vm.h"
+#include "nvmfile.h"
+#include "native.h"
+#include "array.h"
 
-u08_t heap[HEAPSIZE];
-u16_t heap_base = 0;
+#ifdef NVM_USE_SIZE_OPTIONS
+#include <stdlib.h>
+#endif
+
+#ifdef NVM_USE_SIZE_OPTIONS
+// allocated by heap_init() once the size is known
+u08_t *heap;
+heap_size_t heap_size = HEAPSIZE;
+#else
+u08_t heap[HEAPSIZE] __attribute__((aligned(NVM_HEAP_ALIGN)));
+#endif
+heap_size_t heap_base = 0;
 
-#define HEAP_ID_FREE 0
+#define HEAP_ID_FREE     0
+#ifdef NVM_USE_SIZE_OPTIONS
+#define HEAP_ID_REPLACED ((heap_id_t)~0)  // chunk left behind by heap_realloc()
+#else
+#define HEAP_ID_REPLACED 0xff  // chunk left behind by heap_realloc()
+#endif
 
+// the header of every chunk. Objects don't store their length but
+// the id of their class, the size of their fields follows from it.
+// Arrays store their number of elements
 typedef struct {
   heap_id_t id;
-  unsigned int fieldref:1;
-  unsigned int len:15;
+  unsigned int refs:2;   // HEAP_REFS_xxx
+  unsigned int len:8*sizeof(heap_size_t)-2;  // in bytes, class id of objects, array length
 } __attribute__((packed)) heap_t;
 
+// the first value too big for the len field
+#define HEAP_LEN_LIMIT  ((heap_size_t)1<<(8*sizeof(heap_size_t)-2))
+
+// chunks are padded to keep the next one aligned
+#define HEAP_ALIGNED(size)  (((sizeof(heap_t)+(size)+NVM_HEAP_ALIGN-1) & \
+			      ~(NVM_HEAP_ALIGN-1)) - sizeof(heap_t))
+
+#define HEAP_LEN(h)  (((h)->refs == HEAP_REFS_FIELDS)?			\
+  HEAP_ALIGNED(HEAP_FIELDS_SIZE((h)->len)):				\
+  ((h)->refs == HEAP_REFS_ARRAY)?HEAP_ALIGNED(HEAP_ARRAY_SIZE(h)):(h)->len)
+#define HEAP_FIELDS_SIZE(class)  \
+  (nvmfile_get_class_fields(class)*sizeof(nvm_word_t))
+
+// the elements of an array start at the first aligned offset behind
+// the header, the byte right in front of them holds the array type
+#define HEAP_ARRAY_DATA      HEAP_ALIGNED(1)
+#define HEAP_ELEMENTS(h)     ((u08_t*)((h)+1) + HEAP_ARRAY_DATA)
+#define HEAP_ARRAY_TYPE(h)   (HEAP_ELEMENTS(h)[-1])
+#ifdef NVM_USE_ARRAY
+#define HEAP_ARRAY_SIZE(h)   \
+  (HEAP_ARRAY_DATA + array_size(HEAP_ELEMENTS(h), (h)->len))
+#else
+#define HEAP_ARRAY_SIZE(h)   0
+#endif
+
+#if !defined(NVM_USE_SIZE_OPTIONS) && (HEAPSIZE > 0x4000)
+#error HEAPSIZE must not exceed 16k
+#endif
+
+#ifdef NVM_USE_SCOPED_ALLOC
+// objects of the methods currently running, the one allocated last
+// on top. Their owner is the method whose locals start at that
+// offset into the stack, an id of 0 means the collector took it
+static struct {
+  heap_id_t id;
+  heap_size_t owner;
+} heap_scoped[NVM_SCOPED_OBJECTS];
+static u08_t heap_scoped_cnt = 0;
+
+static void heap_scope_forget(void);
+#endif
+
+#ifdef NVM_USE_HEAP_HANDLES
+// offset of every chunk in the heap indexed by its id. Unused ids
+// are marked and form a list, each one holding the next unused id
+#ifdef NVM_USE_SIZE_OPTIONS
+// as many as the heap size asks for, allocated by heap_init()
+heap_id_t heap_handles;
+static heap_size_t *heap_handle;
+static u08_t *heap_marks;
+#else
+static heap_size_t heap_handle[HEAP_HANDLES];
+static u08_t heap_marks[(HEAP_HANDLES+7)/8];
+#endif
+static heap_id_t heap_free_ids;  // first unused id, 0 if none left
+#define HEAP_HANDLE(id)   heap_handle[(id)-1]
+#define HEAP_HANDLE_FREE  ((heap_size_t)1<<(8*sizeof(heap_size_t)-1))
+
+// one bit per id set by the garbage collector for objects in use
+#define HEAP_BITMAP_BYTES  ((HEAP_HANDLES+7)/8)
+#define HEAP_MARKED(id)  (heap_marks[((id)-1)>>3] & (1<<(((id)-1)&7)))
+#define HEAP_MARK(id)    (heap_marks[((id)-1)>>3] |= (1<<(((id)-1)&7)))
+
+#ifdef NVM_USE_OBJECT_POOLS
+// handles of pooled objects point right at the object and are flagged
+#define HEAP_HANDLE_POOL  (HEAP_HANDLE_FREE>>1)
+#define HEAP_POOLED(id)   (HEAP_HANDLE(id) & HEAP_HANDLE_POOL)
+#define HEAP_OFFSET(id)   (HEAP_HANDLE(id) & ~HEAP_HANDLE_POOL)
+
+// a page is a chunk holding NVM_POOL_SLOTS objects of the same size.
+// It knows their ids, so moving or sweeping it doesn't have to look
+// at all the others
+typedef struct {
+  heap_id_t next;  // next page for that size, 0 if none
+  u16_t used;      // one bit per slot holding an object
+  heap_id_t ids[NVM_POOL_SLOTS];  // id of the object in each used slot
+} __attribute__((packed)) heap_page_t;
+
+#define HEAP_PAGE(page)  ((heap_page_t*)&heap[HEAP_HANDLE(page)+sizeof(heap_t)])
+#define HEAP_PAGE_FULL   ((u16_t)((1L<<NVM_POOL_SLOTS)-1))
+
+// the object sizes there are pages for (0 if unused), first page of each
+static struct {
+  u08_t size;
+  heap_id_t page;
+} heap_pool[NVM_POOL_SIZES];
+#else
+#define HEAP_POOLED(id)   FALSE
+#define HEAP_OFFSET(id)   HEAP_HANDLE(id)
+#endif
+
+#ifdef NVM_USE_GENERATIONAL_GC
+// objects below heap_old have been allocated since the last collection
+// (the nursery). Old objects references got stored into since then
+// are remembered by id
+static heap_size_t heap_old;
+#ifdef NVM_USE_SIZE_OPTIONS
+static u08_t *heap_remembered;
+#else
+static u08_t heap_remembered[(HEAP_HANDLES+7)/8];
+#endif
+#define HEAP_REMEMBERED(id) (heap_remembered[((id)-1)>>3] & (1<<(((id)-1)&7)))
+#define HEAP_REMEMBER(id)   (heap_remembered[((id)-1)>>3] |= (1<<(((id)-1)&7)))
+
+static void heap_collect_young(void);
+#endif
+
+#ifdef NVM_USE_INCREMENTAL_GC
+// state of the incremental collector
+#define HEAP_GC_IDLE     0
+#define HEAP_GC_MARK     1  // scanning the objects on the mark stack
+#define HEAP_GC_RESCAN   2  // mark stack overflowed, scan all marked objects
+#define HEAP_GC_COMPACT  3  // removing garbage
+
+static u08_t heap_gc_phase = HEAP_GC_IDLE;
+static heap_id_t heap_mark_stack[NVM_GC_MARK_STACK];
+static heap_id_t heap_gc_rescan;  // next id to be scanned again
+static heap_size_t heap_gc_scan;        // next chunk to be checked for garbage
+static heap_size_t heap_gc_work;        // bytes scanned or moved in this pause
+bool_t heap_gc_marking = FALSE;
+u16_t heap_gc_cycles = 0;
+heap_size_t heap_gc_longest_pause = 0;
+
+static void heap_gc_slice(void);
+#endif
+
+// link all unmarked ids, lowest first
+static void heap_link_free_ids(void) {
+  heap_id_t id;
+
+  heap_free_ids = 0;
+  for(id=HEAP_HANDLES;id;id--) {
+    if(!HEAP_MARKED(id)) {
+      HEAP_HANDLE(id) = HEAP_HANDLE_FREE | heap_free_ids;
+      heap_free_ids = id;
+    }
+  }
+
+#ifdef NVM_USE_SCOPED_ALLOC
+  heap_scope_forget();
+#endif
+}
+#endif
+
 // return the real heap base (where memory can be "stolen"
 // from
 u08_t *heap_get_base(void) {
@@ -56,7 +221,7 @@ u08_t *heap_get_base(void) {
 
 // a version of memcpy that can only copy overlapping chunks
 // if the target address is higher
-void heap_memcpy_up(u08_t *dst, u08_t *src, u16_t len) {
+void heap_memcpy_up(u08_t *dst, u08_t *src, heap_size_t len) {
   dst += len;  src += len;
   while(len--) *--dst = *--src;
 }
@@ -65,7 +230,7 @@ void heap_memcpy_up(u08_t *dst, u08_t *src, u16_t len) {
 // make some sanity checks on the heap in order to detect 
 // heap curruption as early as possible
 void heap_check(void) {
-  u16_t current = heap_base;
+  heap_size_t current = heap_base;
   heap_t *h = (heap_t*)&heap[current];
 
   if(h->id != HEAP_ID_FREE) {
@@ -75,10 +240,10 @@ void heap_check(void) {
   
   current += h->len + sizeof(heap_t);
 
-  while(current < sizeof(heap)) {
+  while(current < HEAP_SIZE) {
     h = (heap_t*)&heap[current];
     if(h->id != HEAP_ID_FREE) {
-      if(h->len > sizeof(heap)) {
+      if(HEAP_LEN(h) > HEAP_SIZE) {
 	DEBUGF("heap_check(): single chunk too big\n");
 	heap_show();
 	error(ERROR_HEAP_ILLEGAL_CHUNK_SIZE);
@@ -89,16 +254,16 @@ void heap_check(void) {
       error(ERROR_HEAP_CORRUPTED);
     }
     
-    if(h->len+sizeof(heap_t) > sizeof(heap) - current) {
+    if(HEAP_LEN(h)+sizeof(heap_t) > HEAP_SIZE - current) {
       DEBUGF("heap_check(): total size error\n");
       heap_show();
       error(ERROR_HEAP_CORRUPTED);
     }
 
-    current += h->len + sizeof(heap_t);
+    current += HEAP_LEN(h) + sizeof(heap_t);
   }
 
-  if(current != sizeof(heap)) {
+  if(current != HEAP_SIZE) {
     DEBUGF("heap_check(): heap sum mismatch\n");
     heap_show();
     error(ERROR_HEAP_CORRUPTED);
@@ -107,28 +272,28 @@ void heap_check(void) {
 #endif
 
 void heap_show(void) {
-  u16_t current = heap_base;
+  heap_size_t current = heap_base;
 
   DEBUGF("Heap:\n");
-  while(current < sizeof(heap)) {
+  while(current < HEAP_SIZE) {
     heap_t *h = (heap_t*)&heap[current];
     if(h->id == HEAP_ID_FREE) {
       DEBUGF("- %d free bytes\n", h->len);
     } else {
-      DEBUGF("- chunk id %x with %d bytes:\n", h->id, h->len);
+      DEBUGF("- chunk id %x with %d bytes:\n", h->id, HEAP_LEN(h));
 
-      if(h->len > sizeof(heap))
+      if(HEAP_LEN(h) > HEAP_SIZE)
 	error(ERROR_HEAP_ILLEGAL_CHUNK_SIZE);
 
-      DEBUG_HEXDUMP(h+1, h->len);
+      DEBUG_HEXDUMP(h+1, HEAP_LEN(h));
     }
 
-    if(h->len+sizeof(heap_t) > sizeof(heap) - current) {
+    if(HEAP_LEN(h)+sizeof(heap_t) > HEAP_SIZE - current) {
       DEBUGF("heap_show(): total size error\n");
       error(ERROR_HEAP_CORRUPTED);
     }
 
-    current += h->len + sizeof(heap_t);
+    current += HEAP_LEN(h) + sizeof(heap_t);
   }
 
   DEBUGF("- %d bytes stolen\n", heap_base);
@@ -137,17 +302,29 @@ void heap_show(void) {
 // search for chunk with id in heap and return chunk header
 // address
 heap_t *heap_search(heap_id_t id) {
-  u16_t current = heap_base;
+#ifdef NVM_USE_HEAP_HANDLES
+  if((id == HEAP_ID_FREE) || (id > HEAP_HANDLES) ||
+     (HEAP_HANDLE(id) & HEAP_HANDLE_FREE))
+    return NULL;
+
+  return (heap_t*)&heap[HEAP_HANDLE(id)];
+#else
+  heap_size_t current = heap_base;
 
-  while(current < sizeof(heap)) {
+  while(current < HEAP_SIZE) {
     heap_t *h = (heap_t*)&heap[current];
     if(h->id == id) return h;
-    current += h->len + sizeof(heap_t);
+    current += HEAP_LEN(h) + sizeof(heap_t);
   }
   return NULL;
+#endif
 }
 
 heap_id_t heap_new_id(void) {
+#ifdef NVM_USE_HEAP_HANDLES
+  // it's taken from the list once the chunk has been allocated
+  return heap_free_ids;
+#else
   heap_id_t id;
 
   for(id=1;id;id++) 
@@ -155,10 +332,11 @@ heap_id_t heap_new_id(void) {
       return id;
 
   return 0;
+#endif
 }
 
-bool_t heap_alloc_internal(heap_id_t id, bool_t fieldref, u16_t size) {
-  u16_t req = size + sizeof(heap_t);  // total mem required
+bool_t heap_alloc_internal(heap_id_t id, u08_t refs, heap_size_t size) {
+  heap_size_t req = size + sizeof(heap_t);  // total mem required
 
   // search for free block
   heap_t *h = (heap_t*)&heap[heap_base];
@@ -170,8 +348,13 @@ bool_t heap_alloc_internal(heap_id_t id, bool_t fieldref, u16_t size) {
     // and create the new chunk behind this one
     h = (heap_t*)&heap[heap_base + sizeof(heap_t) + h->len];
     h->id = id;
-    h->fieldref = fieldref;
+    h->refs = refs;
     h->len = size;
+#ifdef NVM_USE_HEAP_HANDLES
+    if(id == heap_free_ids)
+      heap_free_ids = HEAP_HANDLE(id) & ~HEAP_HANDLE_FREE;
+    HEAP_HANDLE(id) = (u08_t*)h - heap;
+#endif
 #ifdef NVM_INITIALIZE_ALLOCATED
     // fill memory with zero
     u08_t * ptr = (void*)(h+1);
@@ -185,94 +368,915 @@ bool_t heap_alloc_internal(heap_id_t id, bool_t fieldref, u16_t size) {
   return FALSE;
 }
 
-heap_id_t heap_alloc(bool_t fieldref, u16_t size) {
-  heap_id_t id = heap_new_id();
+#ifdef NVM_USE_OBJECT_POOLS
+// the pool for objects of that size, a new one if there's none yet.
+// Returns NVM_POOL_SIZES if all are taken by other sizes
+static u08_t heap_pool_find(u08_t size) {
+  u08_t i, unused = NVM_POOL_SIZES;
+
+  for(i=0;i<NVM_POOL_SIZES;i++) {
+    if(heap_pool[i].size == size)
+      return i;
+    if(!heap_pool[i].size)
+      unused = i;
+  }
+
+  if(unused != NVM_POOL_SIZES)
+    heap_pool[unused].size = size;
+  return unused;
+}
+
+// the page holding the pooled object at offset and its slot in there
+static heap_id_t heap_pool_page(heap_size_t offset, u08_t *slot) {
+  heap_id_t page;
+  heap_size_t first;
+  u08_t i;
+
+  // the slot starts with the class byte
+  offset--;
+
+  for(i=0;i<NVM_POOL_SIZES;i++) {
+    for(page=heap_pool[i].page;page;page=HEAP_PAGE(page)->next) {
+      first = HEAP_HANDLE(page) + sizeof(heap_t) + sizeof(heap_page_t);
+      if((offset >= first) &&
+	 (offset < first + NVM_POOL_SLOTS*heap_pool[i].size)) {
+	*slot = (offset - first) / heap_pool[i].size;
+	return page;
+      }
+    }
+  }
+
+  DEBUGF("heap_pool_page(): no page for offset %d\n", offset);
+  error(ERROR_HEAP_CORRUPTED);
+  *slot = 0;
+  return 0;
+}
+
+// a page is being moved by offset bytes, so are the objects in it
+static void heap_pool_moved(heap_page_t *p, heap_size_t offset) {
+  u08_t slot;
+
+  for(slot=0;slot<NVM_POOL_SLOTS;slot++)
+    if(p->used & (1U<<slot))
+      HEAP_HANDLE(p->ids[slot]) += offset;
+}
+
+// take a free slot from the pages for objects of that size (incl.
+// the class byte in front of them). Returns 0 if the object has to go
+// into the heap itself, this is also done if a new page would require
+// a collection first
+static heap_id_t heap_pool_alloc(u08_t size) {
+  heap_t *f = (heap_t*)&heap[heap_base];
+  heap_page_t *p = NULL;
+  heap_id_t id, page;
+  u08_t i, slot;
+
+  i = heap_pool_find(size);
+  if((i == NVM_POOL_SIZES) || !heap_free_ids)
+    return 0;
+
+  for(page=heap_pool[i].page;page;page=p->next) {
+    p = HEAP_PAGE(page);
+    if(p->used != HEAP_PAGE_FULL)
+      break;
+  }
+
+  if(!page) {
+    // the page and the object need an id each
+    if(!(HEAP_HANDLE(heap_free_ids) & ~HEAP_HANDLE_FREE) ||
+       (f->len < sizeof(heap_t) +
+	HEAP_ALIGNED(sizeof(heap_page_t) + NVM_POOL_SLOTS*size)))
+      return 0;
+
+    page = heap_alloc(HEAP_REFS_POOL,
+		      sizeof(heap_page_t) + NVM_POOL_SLOTS*size);
+
+    // the nursery may have been collected meanwhile, dropping empty pages
+    i = heap_pool_find(size);
+    p = HEAP_PAGE(page);
+    p->next = heap_pool[i].page;
+    p->used = 0;
+    heap_pool[i].page = page;
+  }
+
+  for(slot=0;p->used & (1U<<slot);slot++);
+  p->used |= 1U<<slot;
+
+  id = heap_free_ids;
+  heap_free_ids = HEAP_HANDLE(id) & ~HEAP_HANDLE_FREE;
+  p->ids[slot] = id;
+  HEAP_HANDLE(id) = HEAP_HANDLE_POOL | (HEAP_HANDLE(page) + sizeof(heap_t) +
+					sizeof(heap_page_t) + slot*size + 1);
+#ifdef NVM_INITIALIZE_ALLOCATED
+  // fill memory with zero
+  u08_t *ptr = &heap[HEAP_OFFSET(id)];
+  while(--size)
+    *ptr++=0;
+#endif
+#ifdef NVM_USE_INCREMENTAL_GC
+  // objects created while a cycle runs survive it (and so does their page)
+  if(heap_gc_phase != HEAP_GC_IDLE) {
+    HEAP_MARK(id);
+    HEAP_MARK(page);
+  }
+#endif
+
+  DEBUGF("heap_pool_alloc(size=%d) -> id=0x%04x\n", size, id);
+  return id;
+}
+
+// rebuild the pages from the marks of the objects in them. Pages
+// still in use are marked, the others are left to be removed
+static void heap_pool_sweep(void) {
+  heap_id_t page, prev, next;
+  heap_page_t *p;
+  u08_t i, slot;
+
+  for(i=0;i<NVM_POOL_SIZES;i++) {
+    for(prev=0,page=heap_pool[i].page;page;page=next) {
+      p = HEAP_PAGE(page);
+      for(slot=0;slot<NVM_POOL_SLOTS;slot++)
+	if((p->used & (1U<<slot)) && !HEAP_MARKED(p->ids[slot]))
+	  p->used &= ~(1U<<slot);
+
+      next = p->next;
+      if(HEAP_PAGE(page)->used) {
+	HEAP_MARK(page);
+	prev = page;
+      } else if(prev)
+	HEAP_PAGE(prev)->next = next;
+      else
+	heap_pool[i].page = next;
+    }
+
+    if(!heap_pool[i].page)
+      heap_pool[i].size = 0;
+  }
+}
+#endif
+
+heap_id_t heap_alloc(u08_t refs, heap_size_t size) {
+  heap_id_t id;
+
+  size = HEAP_ALIGNED(size);
+
+#ifdef NVM_USE_INCREMENTAL_GC
+  heap_gc_slice();
+#endif
+
+#ifdef NVM_USE_GENERATIONAL_GC
+  // collect the nursery when it's full or memory runs out. That's
+  // usually enough and much cheaper than a full collection
+  if((heap_old - (heap_base + sizeof(heap_t) + ((heap_t*)&heap[heap_base])->len)
+      + size + sizeof(heap_t) > NVM_GC_NURSERY) ||
+     (((heap_t*)&heap[heap_base])->len < size + sizeof(heap_t)) ||
+     !heap_free_ids)
+#ifdef NVM_USE_INCREMENTAL_GC
+    if(heap_gc_phase == HEAP_GC_IDLE)
+#endif
+      heap_collect_young();
+#endif
+
+  id = heap_new_id();
+
+#ifdef NVM_USE_HEAP_HANDLES
+  // all handles in use, try to get some back
+  if(!id) {
+    heap_garbage_collect();
+    id = heap_new_id();
+    if(!id) error(ERROR_HEAP_OUT_OF_MEMORY);
+  }
+#endif
 
   DEBUGF("heap_alloc(size=%d)", size);
   DEBUGF(" -> id=0x%04x\n", id);
-  if(!heap_alloc_internal(id, fieldref, size)) {
+  if(!heap_alloc_internal(id, refs, size)) {
     heap_garbage_collect();
     // we need to reallocate heap id, gc. threw away the old one..
-    if(!heap_alloc_internal(id, fieldref, size))
+#ifdef NVM_USE_HEAP_HANDLES
+    id = heap_new_id();
+#endif
+    if(!heap_alloc_internal(id, refs, size))
       error(ERROR_HEAP_OUT_OF_MEMORY);
     DEBUGF("heap_alloc(size=%d)", size);
     DEBUGF(" -> id=0x%04x successfull after gc\n", id);
   }
 
+#ifdef NVM_USE_INCREMENTAL_GC
+  // objects created while a cycle runs survive it
+  if(heap_gc_phase != HEAP_GC_IDLE)
+    HEAP_MARK(id);
+#endif
+
   return id;
 }
 
-void heap_realloc(heap_id_t id, u16_t size) {
+// create an instance of a class. Its class id is kept in the chunk
+// header or (for pooled objects) in the byte in front of the fields
+heap_id_t heap_alloc_object(u08_t class) {
+  heap_size_t size = HEAP_FIELDS_SIZE(class);
+  heap_id_t id;
+
+#ifdef NVM_USE_OBJECT_POOLS
+  // small objects go into the pages unless a new one can't be had
+  if(size <= NVM_POOL_MAX_SIZE) {
+#ifdef NVM_USE_INCREMENTAL_GC
+    heap_gc_slice();
+#endif
+    if((id = heap_pool_alloc(1 + size))) {
+      heap[HEAP_OFFSET(id)-1] = class;
+      return id;
+    }
+  }
+#endif
+
+  id = heap_alloc(HEAP_REFS_FIELDS, size);
+  heap_search(id)->len = class;
+  return id;
+}
+
+#ifdef NVM_USE_ARRAY
+// create an array with size bytes of elements. Its type is kept in
+// front of the elements and its length in the chunk header
+heap_id_t heap_alloc_array(u08_t type, heap_size_t length, heap_size_t size) {
+  heap_id_t id;
+  heap_t *h;
+
+  // the header stores the number of elements instead of the size.
+  // Booleans are bits, so there may be more of them than bytes
+  if(length >= HEAP_LEN_LIMIT)
+    error(ERROR_HEAP_ILLEGAL_CHUNK_SIZE);
+
+  id = heap_alloc(HEAP_REFS_ARRAY, HEAP_ARRAY_DATA + size);
+  h = heap_search(id);
+
+  h->len = length;
+  HEAP_ARRAY_TYPE(h) = type;
+  return id;
+}
+#endif
+
+// a chunk directly above the free one (usually the one allocated
+// last) can grow downwards into it without leaving garbage behind
+static bool_t heap_grow_in_place(heap_id_t id, heap_size_t size) {
+  heap_t *f = (heap_t*)&heap[heap_base];
+  heap_t *h = heap_search(id), *h_new;
+  heap_size_t delta = size - h->len;
+
+  if(((u08_t*)h != (u08_t*)(f+1) + f->len) || (size <= h->len) ||
+     (f->len < delta))
+    return FALSE;
+
+  f->len -= delta;
+  h_new = (heap_t*)((u08_t*)h - delta);
+
+  // the chunk moves down, a forward copy is fine for overlapping areas
+  utils_memcpy(h_new, h, sizeof(heap_t) + h->len);
+  h_new->len = size;
+#ifdef NVM_USE_HEAP_HANDLES
+  HEAP_HANDLE(id) -= delta;
+#endif
+#ifdef NVM_USE_INCREMENTAL_GC
+  // still to be checked by the compaction
+  if(heap_gc_scan == (u08_t*)h - heap)
+    heap_gc_scan -= delta;
+#endif
+#ifdef NVM_USE_GENERATIONAL_GC
+  // an old chunk stays old
+  if(heap_old == (u08_t*)h - heap)
+    heap_old -= delta;
+#endif
+#ifdef NVM_INITIALIZE_ALLOCATED
+  // fill new memory with zero
+  u08_t *ptr = (u08_t*)(h_new+1) + size - delta;
+  while(delta--)
+    *ptr++=0;
+#endif
+  return TRUE;
+}
+
+void heap_realloc(heap_id_t id, heap_size_t size) {
   DEBUGF("heap_realloc(id=0x%04x, size=%d)\n", id, size);
 
+  size = HEAP_ALIGNED(size);
+
+  if(heap_grow_in_place(id, size))
+    return;
+
   // check free mem and call garbage collection if required
   heap_t *h = (heap_t*)&heap[heap_base];
-  if(h->len >= size + sizeof(heap_t))
+  if(h->len < size + sizeof(heap_t)) {
     heap_garbage_collect();
 
+    // the chunk may be the lowest one now
+    if(heap_grow_in_place(id, size))
+      return;
+  }
+
   // get info on old chunk
   h = heap_search(id);
 
   // allocate space for bigger one
-  if(!heap_alloc_internal(id, h->fieldref, size))
+  if(!heap_alloc_internal(id, h->refs, size))
     error(ERROR_HEAP_OUT_OF_MEMORY);
 
   heap_t *h_new = heap_search(id);
 
-  utils_memcpy(h_new+1, h+1, h->len);
+  utils_memcpy(h_new+1, h+1, (h->len < size)?h->len:size);
 
-  h->id = 0xff;  // unused id to make garbage collection delete
-                 // this chunk next time
+#ifdef NVM_USE_GENERATIONAL_GC
+  // the copy of an old chunk lands in the nursery, but the old objects
+  // referencing it aren't remembered. It's kept until the next promotion
+  if((u08_t*)h - heap >= heap_old)
+    HEAP_REMEMBER(id);
+#endif
+
+  h->id = HEAP_ID_REPLACED;  // unused id to make garbage collection delete
+                             // this chunk next time
 }
 
-u16_t heap_get_len(heap_id_t id) {
-  heap_t *h = heap_search(id);
+heap_size_t heap_get_len(heap_id_t id) {
+  heap_t *h;
+
+#ifdef NVM_USE_OBJECT_POOLS
+  // a pooled object is as big as its class says
+  if(id && (id <= HEAP_HANDLES) && HEAP_POOLED(id))
+    return HEAP_FIELDS_SIZE(heap[HEAP_OFFSET(id)-1]);
+#endif
+
+  h = heap_search(id);
   if(!h) error(ERROR_HEAP_CHUNK_DOES_NOT_EXIST);
-  return h->len;
+  return HEAP_LEN(h);
 }
 
 void *heap_get_addr(heap_id_t id) {
-  heap_t *h = heap_search(id);
+  heap_t *h;
+
+#ifdef NVM_USE_OBJECT_POOLS
+  if(id && (id <= HEAP_HANDLES) && HEAP_POOLED(id))
+    return &heap[HEAP_OFFSET(id)];
+#endif
+
+  h = heap_search(id);
   if(!h) error(ERROR_HEAP_CHUNK_DOES_NOT_EXIST);
+  if(h->refs == HEAP_REFS_ARRAY)
+    return HEAP_ELEMENTS(h);
   return h+1;
 }
 
+#ifdef NVM_USE_ARRAY
+heap_size_t heap_get_count(heap_id_t id) {
+  heap_t *h = heap_search(id);
+
+  if(!h) error(ERROR_HEAP_CHUNK_DOES_NOT_EXIST);
+  return h->len;
+}
+#endif
+
+u08_t heap_get_class(heap_id_t id) {
+  heap_t *h;
+
+#ifdef NVM_USE_OBJECT_POOLS
+  if(id && (id <= HEAP_HANDLES) && HEAP_POOLED(id))
+    return heap[HEAP_OFFSET(id)-1];
+#endif
+
+  h = heap_search(id);
+  if(!h) error(ERROR_HEAP_CHUNK_DOES_NOT_EXIST);
+  return h->len;
+}
+
 void heap_init(void) {
   DEBUGF("heap_init()\n");
 
+#ifdef NVM_USE_SIZE_OPTIONS
+  heap_size &= ~(NVM_HEAP_ALIGN-1);
+  if((heap_size <= sizeof(heap_t)) || (heap_size > HEAP_SIZE_MAX) ||
+     !(heap = malloc(heap_size)))
+    error(ERROR_HEAP_OUT_OF_MEMORY);
+
+#ifdef NVM_USE_HEAP_HANDLES
+  heap_handles = heap_size / NVM_HEAP_HANDLE_BYTES;
+  if(heap_handles < NVM_HEAP_HANDLES)
+    heap_handles = NVM_HEAP_HANDLES;
+
+  heap_handle = malloc(heap_handles * sizeof(heap_size_t));
+  heap_marks = malloc(HEAP_BITMAP_BYTES);
+  if(!heap_handle || !heap_marks)
+    error(ERROR_HEAP_OUT_OF_MEMORY);
+#ifdef NVM_USE_GENERATIONAL_GC
+  if(!(heap_remembered = calloc(HEAP_BITMAP_BYTES, 1)))
+    error(ERROR_HEAP_OUT_OF_MEMORY);
+#endif
+#endif
+#endif
+
   // just one big free block
   heap_t *h = (heap_t*)&heap[0];
   h->id  = HEAP_ID_FREE;
-  h->len = sizeof(heap) - sizeof(heap_t);
+  h->refs = HEAP_REFS_NONE;
+  h->len = HEAP_SIZE - sizeof(heap_t);
+
+#ifdef NVM_USE_HEAP_HANDLES
+  heap_id_t i;
+
+  for(i=0;i<HEAP_BITMAP_BYTES;i++)
+    heap_marks[i] = 0;
+
+  heap_link_free_ids();
+#endif
+#ifdef NVM_USE_GENERATIONAL_GC
+  heap_old = HEAP_SIZE;
+#endif
+}
+
+// number of slots of a chunk that may hold a reference. These are
+// the fields of an object or the elements of a reference array.
+// The objects in a page are scanned on their own
+static heap_size_t heap_ref_slots(heap_t *h) {
+  if(h->refs == HEAP_REFS_FIELDS)
+    return nvmfile_get_class_fields(h->len);
+
+#ifdef NVM_USE_OBJ_ARRAY
+  if((h->refs == HEAP_REFS_ARRAY) && (HEAP_ARRAY_TYPE(h) == T_OBJECT))
+    return h->len;
+#endif
+
+  return 0;
 }
 
+// the reference in field i of an object, 0 if the field holds a value
+static nvm_ref_t heap_field_ref(u08_t class, nvm_ref_t *fields, heap_size_t i) {
+  // the class map tells which fields are references
+  if(!nvmfile_is_ref_field(class, i))
+    return 0;
+
+  return fields[i];
+}
+
+// the reference in slot i of a chunk, 0 if the slot holds a value
+static nvm_ref_t heap_ref_slot(heap_t *h, heap_size_t i) {
+  if(h->refs == HEAP_REFS_ARRAY)
+    return ((nvm_ref_t*)HEAP_ELEMENTS(h))[i];
+
+  return heap_field_ref(h->len, (nvm_ref_t*)(h+1), i);
+}
+
+#ifdef NVM_USE_HEAP_HANDLES
+// the objects still to be scanned for references during the mark
+// phase are kept in the (unused) free chunk. If it's too small the
+// marked objects are scanned once more afterwards. The incremental
+// collector has a stack of its own as the program keeps allocating
+// from the free chunk while objects are being marked
+static heap_id_t *heap_mark_base, *heap_mark_sp, *heap_mark_limit;
+static bool_t heap_mark_overflow;
+
+// whether the object with that id may reference others
+static bool_t heap_has_refs(heap_id_t id) {
+  if(HEAP_POOLED(id))
+    return TRUE;
+
+  return heap_ref_slots((heap_t*)&heap[HEAP_HANDLE(id)]) != 0;
+}
+
+// mark the object referenced (if any) as being in use
+void heap_mark(nvm_ref_t ref) {
+  heap_id_t id = ref & ~NVM_TYPE_MASK;
+
+  if(((ref & NVM_TYPE_MASK) != NVM_TYPE_HEAP) ||
+     (id == HEAP_ID_FREE) || (id > HEAP_HANDLES) ||
+     (HEAP_HANDLE(id) & HEAP_HANDLE_FREE) || HEAP_MARKED(id))
+    return;
+
+  HEAP_MARK(id);
+
+  // objects and arrays may reference further objects
+  if(heap_has_refs(id)) {
+    if(heap_mark_sp < heap_mark_limit) *heap_mark_sp++ = id;
+    else                                heap_mark_overflow = TRUE;
+  }
+}
+
+// mark everything referenced by the fields of an object
+static void heap_mark_fields(heap_id_t id) {
+  heap_t *h;
+  heap_size_t j, slots;
+
+#ifdef NVM_USE_OBJECT_POOLS
+  if(HEAP_POOLED(id)) {
+    u08_t class = heap[HEAP_OFFSET(id)-1];
+
+    slots = nvmfile_get_class_fields(class);
+    for(j=0;j<slots;j++)
+      heap_mark(heap_field_ref(class, (nvm_ref_t*)&heap[HEAP_OFFSET(id)], j));
+    return;
+  }
+#endif
+
+  h = (heap_t*)&heap[HEAP_HANDLE(id)];
+  slots = heap_ref_slots(h);
+  for(j=0;j<slots;j++)
+    heap_mark(heap_ref_slot(h, j));
+}
+
+// start with an empty mark stack
+static void heap_mark_init(void) {
+#ifdef NVM_USE_INCREMENTAL_GC
+  heap_mark_base = heap_mark_stack;
+  heap_mark_limit = heap_mark_stack + NVM_GC_MARK_STACK;
+#else
+  heap_t *f = (heap_t*)&heap[heap_base];
+
+  heap_mark_base = (heap_id_t*)(f+1);
+  heap_mark_limit = heap_mark_base + f->len/sizeof(heap_id_t);
+#endif
+  heap_mark_sp = heap_mark_base;
+  heap_mark_overflow = FALSE;
+}
+
+#if !defined(NVM_USE_INCREMENTAL_GC) || defined(NVM_USE_GENERATIONAL_GC)
+// scan all objects marked so far until nothing new is found
+static void heap_mark_drain(void) {
+  heap_id_t id;
+
+  for(;;) {
+    while(heap_mark_sp > heap_mark_base)
+      heap_mark_fields(*--heap_mark_sp);
+
+    if(!heap_mark_overflow)
+      break;
+
+    // objects got marked without being scanned, scan all again
+    DEBUGF("heap_mark_drain(): mark stack overflow\n");
+    heap_mark_overflow = FALSE;
+    for(id=1;id<=HEAP_HANDLES;id++) {
+      if(HEAP_MARKED(id) && heap_has_refs(id)) {
+	heap_mark_fields(id);
+	while(heap_mark_sp > heap_mark_base)
+	  heap_mark_fields(*--heap_mark_sp);
+      }
+    }
+  }
+}
+
+// slide all marked objects between the free chunk and end up to
+// end, keeping their order. Since objects are referenced by id only
+// the handle table needs to be updated
+static void heap_compact(heap_size_t end) {
+  heap_size_t current = heap_base, last = 0, top = end;
+  heap_t *h;
+
+  // walk up the heap and chain all objects in use through their
+  // handles (each one points to the previous object). The free
+  // chunk is always at the bottom and never linked
+  while(current < end) {
+    h = (heap_t*)&heap[current];
+
+    if(h->id != HEAP_ID_FREE) {
+      if((h->id <= HEAP_HANDLES) && HEAP_MARKED(h->id)) {
+	HEAP_HANDLE(h->id) = last;
+	last = current;
+      } else
+	DEBUGF("HEAP: removing unused object with id 0x%04x (len %d)\n",
+	       h->id, HEAP_LEN(h) + sizeof(heap_t));
+    }
+    current += HEAP_LEN(h) + sizeof(heap_t);
+  }
+
+  if(current != end) {
+    DEBUGF("heap_compact(): total size error\n");
+    error(ERROR_HEAP_CORRUPTED);
+  }
+
+  // and walk the chain back down moving every object to the top
+  while(last) {
+    heap_id_t id;
+    heap_size_t len, prev;
+
+    h = (heap_t*)&heap[last];
+    id = h->id;
+    len = HEAP_LEN(h) + sizeof(heap_t);
+    prev = HEAP_HANDLE(id);
+
+    top -= len;
+    if(top != last) {
+#ifdef NVM_USE_OBJECT_POOLS
+      if(h->refs == HEAP_REFS_POOL)
+	heap_pool_moved((heap_page_t*)(h+1), top - last);
+#endif
+      heap_memcpy_up(heap+top, heap+last, len);
+    }
+    HEAP_HANDLE(id) = top;
+
+    last = prev;
+  }
+
+  // everything below is free now
+  h = (heap_t*)&heap[heap_base];
+  h->id = HEAP_ID_FREE;
+  h->refs = HEAP_REFS_NONE;
+  h->len = top - heap_base - sizeof(heap_t);
+
+  heap_link_free_ids();
+}
+#endif
+
+#ifdef NVM_USE_GENERATIONAL_GC
+// an object references got stored into. Only old objects need to
+// be remembered, the young ones are scanned anyway. Young objects
+// remembered by heap_realloc() survive the nursery collections
+void heap_remember(heap_id_t id) {
+  if(HEAP_OFFSET(id) >= heap_old)
+    HEAP_REMEMBER(id);
+}
+
+// everything in the heap has survived a collection
+static void heap_promote(void) {
+  heap_id_t i;
+
+  heap_old = heap_base + sizeof(heap_t) + ((heap_t*)&heap[heap_base])->len;
+  for(i=0;i<HEAP_BITMAP_BYTES;i++)
+    heap_remembered[i] = 0;
+}
+
+// collect the young objects only. Old objects are taken as being
+// in use and just the ones references got stored into are scanned.
+// The survivors are moved up to the old ones
+static void heap_collect_young(void) {
+  heap_id_t id;
+  heap_id_t i;
+
+  if(heap_old == heap_base + sizeof(heap_t) + ((heap_t*)&heap[heap_base])->len)
+    return;
+
+  DEBUGF("heap_collect_young() free space before: %d\n", ((heap_t*)&heap[heap_base])->len);
+
+  for(i=0;i<HEAP_BITMAP_BYTES;i++)
+    heap_marks[i] = 0;
+
+  for(id=1;id<=HEAP_HANDLES;id++)
+    if(!(HEAP_HANDLE(id) & HEAP_HANDLE_FREE) && (HEAP_OFFSET(id) >= heap_old))
+      HEAP_MARK(id);
+
+  heap_mark_init();
+  stack_mark_heap_ids();
+
+  for(id=1;id<=HEAP_HANDLES;id++) {
+    if(HEAP_REMEMBERED(id) && !(HEAP_HANDLE(id) & HEAP_HANDLE_FREE)) {
+      HEAP_MARK(id);
+      if(heap_has_refs(id))
+	heap_mark_fields(id);
+    }
+  }
+
+  heap_mark_drain();
+#ifdef NVM_USE_OBJECT_POOLS
+  heap_pool_sweep();
+#endif
+  heap_compact(heap_old);
+
+  // survivors stay in the nursery (most of them die soon after) until
+  // they fill half of it
+  if(heap_old - (heap_base + sizeof(heap_t) + ((heap_t*)&heap[heap_base])->len) >
+     NVM_GC_NURSERY/2)
+    heap_promote();
+
+  DEBUGF("heap_collect_young() free space after: %d\n", ((heap_t*)&heap[heap_base])->len);
+}
+#endif
+
+#ifndef NVM_USE_INCREMENTAL_GC
+static void heap_mark_all(void) {
+  heap_id_t i;
+
+  for(i=0;i<HEAP_BITMAP_BYTES;i++)
+    heap_marks[i] = 0;
+
+  heap_mark_init();
+
+  // everything reachable from the stack (incl. locals and statics)
+  stack_mark_heap_ids();
+  heap_mark_drain();
+}
+
+// mark all objects in use and slide them to the top of the heap
+void heap_garbage_collect(void) {
+  DEBUGF("heap_garbage_collect() free space before: %d\n", ((heap_t*)&heap[heap_base])->len);
+
+  heap_mark_all();
+#ifdef NVM_USE_OBJECT_POOLS
+  heap_pool_sweep();
+#endif
+  heap_compact(HEAP_SIZE);
+#ifdef NVM_USE_GENERATIONAL_GC
+  heap_promote();
+#endif
+
+  DEBUGF("heap_garbage_collect() free space after: %d\n", ((heap_t*)&heap[heap_base])->len);
+}
+#else
+// the incremental collector runs in small steps between allocations.
+// All objects reachable when a cycle starts are kept (new ones are
+// marked right away and the write barrier takes care of references
+// being overwritten), so the program may run on while objects are
+// being marked. Afterwards garbage is squeezed out of the heap by
+// sliding the objects below it up, one run of garbage at a time
+
+// objects neither marked nor allocated during this cycle are garbage
+static bool_t heap_gc_live(heap_t *h) {
+  return (h->id <= HEAP_HANDLES) && HEAP_MARKED(h->id);
+}
+
+// everything between the free chunk and heap_gc_scan is in use. Move
+// it up over the garbage found above it
+static void heap_gc_squeeze(void) {
+  heap_t *f = (heap_t*)&heap[heap_base];
+  heap_size_t bottom = heap_base + sizeof(heap_t) + f->len;
+  heap_size_t gap = 0, current;
+  heap_t *h;
+
+  // the run of garbage
+  while(heap_gc_scan + gap < HEAP_SIZE) {
+    h = (heap_t*)&heap[heap_gc_scan + gap];
+    if(heap_gc_live(h))
+      break;
+
+    DEBUGF("HEAP: removing unused object with id 0x%04x (len %d)\n",
+	   h->id, HEAP_LEN(h) + sizeof(heap_t));
+    gap += HEAP_LEN(h) + sizeof(heap_t);
+  }
+
+  heap_memcpy_up(heap+bottom+gap, heap+bottom, heap_gc_scan-bottom);
+  heap_gc_work += heap_gc_scan-bottom;
+
+  for(current=bottom+gap;current<heap_gc_scan+gap;
+      current+=HEAP_LEN(h)+sizeof(heap_t)) {
+    h = (heap_t*)&heap[current];
+    if(h->id <= HEAP_HANDLES)
+      HEAP_HANDLE(h->id) += gap;
+#ifdef NVM_USE_OBJECT_POOLS
+    if(h->refs == HEAP_REFS_POOL)
+      heap_pool_moved((heap_page_t*)(h+1), gap);
+#endif
+  }
+
+  f->len += gap;
+  heap_gc_scan += gap;
+}
+
+// do about NVM_GC_STEP bytes of work (or everything if requested).
+// Returns TRUE once the current cycle is complete
+static bool_t heap_gc_step(bool_t complete) {
+  heap_t *h;
+  heap_id_t id;
+  heap_id_t i;
+
+  while(complete || (heap_gc_work < NVM_GC_STEP)) {
+    switch(heap_gc_phase) {
+    case HEAP_GC_IDLE:
+      DEBUGF("heap_gc_step(): starting cycle, free space: %d\n",
+	     ((heap_t*)&heap[heap_base])->len);
+
+      for(i=0;i<HEAP_BITMAP_BYTES;i++)
+	heap_marks[i] = 0;
+
+      heap_mark_init();
+
+      // the stack (incl. locals and statics) is scanned at once
+      stack_mark_heap_ids();
+      heap_gc_work += heap_base;
+
+      heap_gc_marking = TRUE;
+      heap_gc_phase = HEAP_GC_MARK;
+      break;
+
+    case HEAP_GC_MARK:
+      if(heap_mark_sp > heap_mark_base) {
+	// scoped objects may have been given back meanwhile
+	id = *--heap_mark_sp;
+	if(!(HEAP_HANDLE(id) & HEAP_HANDLE_FREE)) {
+	  heap_mark_fields(id);
+	  heap_gc_work += heap_get_len(id);
+	}
+      } else if(heap_mark_overflow) {
+	DEBUGF("heap_gc_step(): mark stack overflow\n");
+	heap_mark_overflow = FALSE;
+	heap_gc_rescan = 1;
+	heap_gc_phase = HEAP_GC_RESCAN;
+      } else {
+	heap_gc_marking = FALSE;
+#ifdef NVM_USE_OBJECT_POOLS
+	heap_pool_sweep();
+#endif
+	heap_gc_scan = heap_base + sizeof(heap_t) +
+	  ((heap_t*)&heap[heap_base])->len;
+	heap_gc_phase = HEAP_GC_COMPACT;
+      }
+      break;
+
+    case HEAP_GC_RESCAN:
+      if(heap_gc_rescan > HEAP_HANDLES) {
+	heap_gc_phase = HEAP_GC_MARK;
+	break;
+      }
+
+      if(HEAP_MARKED(heap_gc_rescan) &&
+	 !(HEAP_HANDLE(heap_gc_rescan) & HEAP_HANDLE_FREE) &&
+	 heap_has_refs(heap_gc_rescan)) {
+	heap_mark_fields(heap_gc_rescan);
+	heap_gc_work += heap_get_len(heap_gc_rescan);
+      }
+      heap_gc_rescan++;
+      break;
+
+    case HEAP_GC_COMPACT:
+      if(heap_gc_scan >= HEAP_SIZE) {
+	if(heap_gc_scan != HEAP_SIZE) {
+	  DEBUGF("heap_gc_step(): total size error\n");
+	  error(ERROR_HEAP_CORRUPTED);
+	}
+
+	heap_link_free_ids();
+#ifdef NVM_USE_GENERATIONAL_GC
+	heap_promote();
+#endif
+	heap_gc_cycles++;
+	heap_gc_phase = HEAP_GC_IDLE;
+
+	DEBUGF("heap_gc_step(): cycle done, free space: %d\n",
+	       ((heap_t*)&heap[heap_base])->len);
+	return TRUE;
+      }
+
+      h = (heap_t*)&heap[heap_gc_scan];
+      if(heap_gc_live(h)) {
+	heap_gc_scan += HEAP_LEN(h) + sizeof(heap_t);
+	heap_gc_work += sizeof(heap_t);
+      } else
+	heap_gc_squeeze();
+      break;
+    }
+  }
+
+  return FALSE;
+}
+
+static void heap_gc_pause_done(void) {
+  if(heap_gc_work > heap_gc_longest_pause)
+    heap_gc_longest_pause = heap_gc_work;
+  heap_gc_work = 0;
+}
+
+// called on every allocation: start a cycle when memory gets low
+// and keep a running one going
+static void heap_gc_slice(void) {
+  if((heap_gc_phase == HEAP_GC_IDLE) &&
+     (((heap_t*)&heap[heap_base])->len >= NVM_GC_TRIGGER) && heap_free_ids)
+    return;
+
+  heap_gc_step(FALSE);
+  heap_gc_pause_done();
+}
+
+// finish the running cycle (if any) and do a complete one
+void heap_garbage_collect(void) {
+  DEBUGF("heap_garbage_collect() free space before: %d\n", ((heap_t*)&heap[heap_base])->len);
+
+  if(heap_gc_phase != HEAP_GC_IDLE)
+    heap_gc_step(TRUE);
+  heap_gc_step(TRUE);
+  heap_gc_pause_done();
+
+  DEBUGF("heap_garbage_collect() free space after: %d\n", ((heap_t*)&heap[heap_base])->len);
+}
+#endif
+#else
 // in some cases, references to heap objects may be inside
-// other heap objects. This currently happens only when
-// a class is instanciated and this class contains fields.
-// the heap element created by the constructor is marked with
-// the fieldref bit and it is searched for references during
-// garbage collections
+// other heap objects. This happens when a class is instanciated
+// and this class contains fields and with arrays of objects.
+// Such heap elements are marked with their refs type and
+// searched for references during garbage collections
 bool_t heap_fieldref(heap_id_t id) {
   nvm_ref_t id16 = id | NVM_TYPE_HEAP;
-  u16_t current = heap_base;
+  heap_size_t current = heap_base;
 
   // walk through the entire heap
-  while(current < sizeof(heap)) {
+  while(current < HEAP_SIZE) {
     heap_t *h = (heap_t*)&heap[current];
 
-    // check for entries with the fieldref flag
-    if(h->fieldref) {
-      u08_t j;
+    // check for entries that may hold references
+    if(h->refs) {
+      heap_size_t j, slots = heap_ref_slots(h);
 
       // check all entries in the heap element for
       // the reference we are searching for
-      for(j=0;j<h->len/sizeof(nvm_ref_t);j++) {
-	if(((nvm_ref_t*)(h+1))[j] == id16)
+      for(j=0;j<slots;j++) {
+	if(heap_ref_slot(h, j) == id16)
 	  return TRUE;
       }
     }
 
-    current += h->len + sizeof(heap_t);
+    current += HEAP_LEN(h) + sizeof(heap_t);
   }
   
   return FALSE;
@@ -281,14 +1285,14 @@ bool_t heap_fieldref(heap_id_t id) {
 // walk through the heap, check for every object
 // if it's still being used and remove it if not
 void heap_garbage_collect(void) {
-  u16_t current = heap_base;
+  heap_size_t current = heap_base;
   heap_t *h;
   DEBUGF("heap_garbage_collect() free space before: %d\n", ((heap_t*)&heap[heap_base])->len);
   // set current to stack-top
   // walk through the entire heap
-  while(current < sizeof(heap)) {
+  while(current < HEAP_SIZE) {
     h = (heap_t*)&heap[current];
-    u16_t len = h->len + sizeof(heap_t);
+    heap_size_t len = HEAP_LEN(h) + sizeof(heap_t);
 
     // found an entry
     if(h->id != HEAP_ID_FREE) {
@@ -309,18 +1313,115 @@ void heap_garbage_collect(void) {
     current += len;
   }
 
-  if(current != sizeof(heap)) {
+  if(current != HEAP_SIZE) {
     DEBUGF("heap_garbage_collect(): total size error\n");
     error(ERROR_HEAP_CORRUPTED);
   }
+
+#ifdef NVM_USE_SCOPED_ALLOC
+  heap_scope_forget();
+#endif
+
   DEBUGF("heap_garbage_collect() free space after: %d\n", ((heap_t*)&heap[heap_base])->len);
 }
+#endif
+
+#ifdef NVM_USE_SCOPED_ALLOC
+// objects removed by the garbage collector aren't given back again,
+// their ids may be in use by new ones already
+static void heap_scope_forget(void) {
+  u08_t i;
+
+  for(i=0;i<heap_scoped_cnt;i++)
+#ifdef NVM_USE_HEAP_HANDLES
+    if(heap_scoped[i].id && !HEAP_MARKED(heap_scoped[i].id))
+#else
+    if(heap_scoped[i].id && !heap_search(heap_scoped[i].id))
+#endif
+      heap_scoped[i].id = 0;
+}
+
+// give back an object nothing refers to anymore. If it's directly
+// above the free chunk (it's usually the one allocated last) its
+// memory is free right away, otherwise it's left to the collector
+static void heap_release(heap_id_t id) {
+  heap_t *f = (heap_t*)&heap[heap_base];
+  heap_t *h;
+#ifdef NVM_USE_OBJECT_POOLS
+  heap_id_t page;
+  u08_t slot;
+#endif
+
+  DEBUGF("heap_release(id=0x%04x)\n", id);
+
+#ifdef NVM_USE_INCREMENTAL_GC
+  // garbage found by the running cycle may have been removed already,
+  // its id is given back once the cycle is done
+  if((heap_gc_phase == HEAP_GC_COMPACT) && !HEAP_MARKED(id))
+    return;
+#endif
+
+#ifdef NVM_USE_INCREMENTAL_GC
+  // whatever it references may have been reachable when the running
+  // cycle started and must be found anyway
+  if(heap_gc_marking && heap_has_refs(id))
+    heap_mark_fields(id);
+#endif
+
+#ifdef NVM_USE_OBJECT_POOLS
+  if(HEAP_POOLED(id)) {
+    // its slot can be used again right away
+    page = heap_pool_page(HEAP_OFFSET(id), &slot);
+    HEAP_PAGE(page)->used &= ~(1U<<slot);
+  } else
+#endif
+  if((u08_t*)(h = heap_search(id)) == (u08_t*)(f+1) + f->len) {
+    f->len += HEAP_LEN(h) + sizeof(heap_t);
+#ifdef NVM_USE_INCREMENTAL_GC
+    // the chunk may not have been checked by the compaction yet
+    if(heap_gc_scan < heap_base + sizeof(heap_t) + f->len)
+      heap_gc_scan = heap_base + sizeof(heap_t) + f->len;
+#endif
+#ifdef NVM_USE_GENERATIONAL_GC
+    // the free chunk may now reach into the old objects
+    if(heap_old < heap_base + sizeof(heap_t) + f->len)
+      heap_old = heap_base + sizeof(heap_t) + f->len;
+#endif
+  } else
+    h->id = HEAP_ID_REPLACED;
+
+#ifdef NVM_USE_HEAP_HANDLES
+  HEAP_HANDLE(id) = HEAP_HANDLE_FREE | heap_free_ids;
+  heap_free_ids = id;
+#endif
+}
+
+// an object that must not outlive the method owning it has been created
+void heap_scope_add(heap_id_t id, heap_size_t owner) {
+  if(heap_scoped_cnt == NVM_SCOPED_OBJECTS)
+    return;
+
+  heap_scoped[heap_scoped_cnt].id = id;
+  heap_scoped[heap_scoped_cnt++].owner = owner;
+}
+
+// the method owning objects (and all it called) has returned
+void heap_scope_release(heap_size_t owner) {
+  heap_id_t id;
+
+  while(heap_scoped_cnt && (heap_scoped[heap_scoped_cnt-1].owner >= owner)) {
+    id = heap_scoped[--heap_scoped_cnt].id;
+    if(id)
+      heap_release(id);
+  }
+}
+#endif
 
 // "steal" some bytes from the bottom of the heap (where
 // the free-chunk is)
-void heap_steal(u16_t bytes) {
+void heap_steal(heap_size_t bytes) {
   heap_t *h = (heap_t*)&heap[heap_base];
-  u16_t len;
+  heap_size_t len;
 
   DEBUGF("HEAP: request to steal %d bytes\n", bytes);
 
@@ -342,13 +1443,14 @@ void heap_steal(u16_t bytes) {
   heap_base += bytes;
   h = (heap_t*)&heap[heap_base];
   h->id = HEAP_ID_FREE;
+  h->refs = HEAP_REFS_NONE;
   h->len = len - bytes;
 }
 
 // someone wants us to give some bytes back :-)
-void heap_unsteal(u16_t bytes) {
+void heap_unsteal(heap_size_t bytes) {
   heap_t *h = (heap_t*)&heap[heap_base];
-  u16_t len;
+  heap_size_t len;
 
   if(h->id != HEAP_ID_FREE) {
     DEBUGF("heap_unsteal(%d): start element not free element\n", bytes);
@@ -367,6 +1469,7 @@ void heap_unsteal(u16_t bytes) {
   heap_base -= bytes;
   h = (heap_t*)&heap[heap_base];
   h->id = HEAP_ID_FREE;
+  h->refs = HEAP_REFS_NONE;
   h->len = len + bytes;
 }
 
@@ -20,23 +20,209 @@
 #ifndef HEAP_H
 #define HEAP_H
 
+#include "nvmtypes.h"
+
+#ifdef NVM_USE_SIZE_OPTIONS
+#ifndef NVM_USE_32BIT_WORD
+#error NVM_USE_SIZE_OPTIONS requires NVM_USE_32BIT_WORD
+#endif
+
+// the heap is allocated at startup, HEAPSIZE is just the default
+// for its size given on the command line (-H). Heaps may take
+// megabytes then, so chunk offsets and lengths get 32 bits and ids
+// are no longer limited by the heap size
+typedef u32_t heap_id_t;
+typedef u32_t heap_size_t;
+
+extern heap_size_t heap_size;
+#define HEAP_SIZE  heap_size
+
+// the top bits of offsets and lengths are taken for flags
+#define HEAP_SIZE_MAX  0x40000000L
+#else
 #if HEAPSIZE <= 1024
 typedef u08_t heap_id_t;
 #else
 typedef u16_t heap_id_t;
 #endif 
 
+// offsets into the heap and lengths of chunks
+typedef u16_t heap_size_t;
+
+#define HEAP_SIZE  HEAPSIZE
+#endif
+
+#ifdef NVM_USE_HEAP_HANDLES
+// number of heap ids and thus of objects that may exist at a time.
+// Every entry costs 2 bytes of ram, but heap_get_addr() doesn't
+// have to search the heap anymore
+#ifndef NVM_HEAP_HANDLES
+#define NVM_HEAP_HANDLES  32
+#endif
+
+#ifdef NVM_USE_SIZE_OPTIONS
+// a heap given on the command line gets one id for every
+// NVM_HEAP_HANDLE_BYTES bytes, but at least NVM_HEAP_HANDLES
+#ifndef NVM_HEAP_HANDLE_BYTES
+#define NVM_HEAP_HANDLE_BYTES  32
+#endif
+
+extern heap_id_t heap_handles;
+#define HEAP_HANDLES  heap_handles
+#else
+#if NVM_HEAP_HANDLES >= 0xff
+#error NVM_HEAP_HANDLES must be less than 255
+#endif
+
+#if HEAPSIZE > 0x8000
+#error NVM_USE_HEAP_HANDLES requires HEAPSIZE of 32k or less
+#endif
+
+#define HEAP_HANDLES  NVM_HEAP_HANDLES
+#endif
+#endif
+
+#ifdef NVM_USE_INCREMENTAL_GC
+#ifndef NVM_USE_HEAP_HANDLES
+#error NVM_USE_INCREMENTAL_GC requires NVM_USE_HEAP_HANDLES
+#endif
+
+// a collection cycle is started once less than NVM_GC_TRIGGER bytes
+// are free. Every allocation then does a slice of about NVM_GC_STEP
+// bytes worth of object scanning or moving
+#ifndef NVM_GC_TRIGGER
+#define NVM_GC_TRIGGER  (HEAP_SIZE/4)
+#endif
+
+#ifndef NVM_GC_STEP
+#define NVM_GC_STEP     64
+#endif
+
+// objects found but not scanned yet. If there are more of them all
+// marked objects are scanned again
+#ifndef NVM_GC_MARK_STACK
+#define NVM_GC_MARK_STACK  8
+#endif
+
+extern bool_t heap_gc_marking;
+extern u16_t  heap_gc_cycles;
+extern heap_size_t heap_gc_longest_pause;  // in bytes scanned or moved
+
+// the value a reference field is about to lose while objects are
+// being marked is kept. Everything reachable when the cycle started
+// survives it that way
+#define HEAP_BARRIER_MARK(old)  if(heap_gc_marking) heap_mark(old);
+#else
+#define HEAP_BARRIER_MARK(old)
+#endif
+
+#ifdef NVM_USE_GENERATIONAL_GC
+#ifndef NVM_USE_HEAP_HANDLES
+#error NVM_USE_GENERATIONAL_GC requires NVM_USE_HEAP_HANDLES
+#endif
+
+// objects allocated since the last collection are collected on
+// their own when memory runs out or once they take more than
+// NVM_GC_NURSERY bytes. Survivors are promoted once they fill half
+// of it. A small nursery means short pauses but more copying
+#ifndef NVM_GC_NURSERY
+#define NVM_GC_NURSERY  HEAP_SIZE
+#endif
+
+void heap_remember(heap_id_t id);
+
+// old objects references are stored into are scanned when the
+// young ones are collected
+#define HEAP_BARRIER_REMEMBER(id, val)				\
+  if(((val) & NVM_TYPE_MASK) == NVM_TYPE_HEAP) heap_remember(id);
+#else
+#define HEAP_BARRIER_REMEMBER(id, val)
+#endif
+
+// to be used whenever field old of object id is set to val
+#define HEAP_WRITE_BARRIER(id, old, val)			\
+  { HEAP_BARRIER_MARK(old) HEAP_BARRIER_REMEMBER(id, val) }
+
+#ifdef NVM_USE_SCOPED_ALLOC
+// objects NanoVMTool found not to escape the method creating them
+// are given back as soon as it returns. Up to NVM_SCOPED_OBJECTS of
+// them are kept track of, further ones are left to the collector
+#ifndef NVM_SCOPED_OBJECTS
+#define NVM_SCOPED_OBJECTS  8
+#endif
+
+#if NVM_SCOPED_OBJECTS > 0xff
+#error NVM_SCOPED_OBJECTS must be less than 256
+#endif
+#endif
+
+#ifdef NVM_USE_OBJECT_POOLS
+#ifndef NVM_USE_HEAP_HANDLES
+#error NVM_USE_OBJECT_POOLS requires NVM_USE_HEAP_HANDLES
+#endif
+
+// objects of up to NVM_POOL_MAX_SIZE bytes are taken from pages of
+// NVM_POOL_SLOTS objects of the same size. Instead of a chunk header
+// they just have their class in front of them. There are pages for
+// up to NVM_POOL_SIZES different sizes, bigger objects and arrays
+// stay in the heap itself
+#ifndef NVM_POOL_SIZES
+#define NVM_POOL_SIZES     4
+#endif
+
+#ifndef NVM_POOL_SLOTS
+#define NVM_POOL_SLOTS     8
+#endif
+
+#ifndef NVM_POOL_MAX_SIZE
+#define NVM_POOL_MAX_SIZE  (4*sizeof(nvm_word_t))
+#endif
+
+#if NVM_POOL_SLOTS > 16
+#error NVM_POOL_SLOTS must not exceed 16
+#endif
+#endif
+
+// chunks start at multiples of NVM_HEAP_ALIGN bytes and so do the
+// elements of arrays. The AVR doesn't care about alignment
+#ifndef NVM_HEAP_ALIGN
+#define NVM_HEAP_ALIGN  1
+#endif
+
+#if (NVM_HEAP_ALIGN & (NVM_HEAP_ALIGN-1)) || (HEAPSIZE % NVM_HEAP_ALIGN)
+#error NVM_HEAP_ALIGN must be a power of 2 dividing HEAPSIZE
+#endif
+
+// chunks that hold references the garbage collector has to follow
+#define HEAP_REFS_NONE    0  // plain data (strings)
+#define HEAP_REFS_FIELDS  1  // object, fields as given by the class refmap
+#define HEAP_REFS_ARRAY   2  // array, references if its type says so
+#define HEAP_REFS_POOL    3  // page of pooled objects (these are found by id)
+
 void      heap_init(void);
 u08_t     *heap_get_base(void);
 void      heap_show(void);
-heap_id_t heap_alloc(bool_t fieldref, u16_t size);
-void      heap_realloc(heap_id_t id, u16_t size);
-u16_t     heap_get_len(heap_id_t id);
+heap_id_t heap_alloc(u08_t refs, heap_size_t size);
+heap_id_t heap_alloc_object(u08_t class);
+#ifdef NVM_USE_ARRAY
+heap_id_t heap_alloc_array(u08_t type, heap_size_t length, heap_size_t size);
+heap_size_t heap_get_count(heap_id_t id);
+#endif
+void      heap_realloc(heap_id_t id, heap_size_t size);
+heap_size_t heap_get_len(heap_id_t id);
 void      *heap_get_addr(heap_id_t id);
+u08_t     heap_get_class(heap_id_t id);
 //hey, this is java!!!  void      heap_free(heap_id_t id);
 void      heap_garbage_collect(void);
-void      heap_steal(u16_t bytes);
-void      heap_unsteal(u16_t bytes);
+#ifdef NVM_USE_HEAP_HANDLES
+void      heap_mark(nvm_ref_t ref);
+#endif
+#ifdef NVM_USE_SCOPED_ALLOC
+void      heap_scope_add(heap_id_t id, heap_size_t owner);
+void      heap_scope_release(heap_size_t owner);
+#endif
+void      heap_steal(heap_size_t bytes);
+void      heap_unsteal(heap_size_t bytes);
 
 #ifdef DEBUG_JVM
 void      heap_check(void);
@@ -362,7 +362,8 @@ void native_formatter_invoke(u08_t mref) {
     add = (fmtdscr.width-len);
     
   // allocate heap and realign strings (address may be changed by gc...)
-  heap_id_t id = heap_alloc(FALSE, len + add + fmtdscr.pre_len + fmtdscr.post_len + 1);
+  heap_id_t id = heap_alloc(HEAP_REFS_NONE, len + add + fmtdscr.pre_len +
+			    fmtdscr.post_len + 1);
   int memoffset = (char*)stack_peek_addr(0)-(char*)fmt;
   fmt+=memoffset;
   fmtdscr.post+=memoffset;
@@ -37,27 +37,28 @@
 #include "nvmstring.h"
 
 void native_itoa(char *str, nvm_int_t val) {
-  nvm_int_t m;
+  nvm_uint_t uval = val, m;
 #ifdef NVM_USE_16BIT_WORD
-  nvm_int_t div = 10000;  // max num to be output with 15 bit integer 
+  nvm_uint_t div = 10000;  // max num to be output with 15 bit integer 
 #else  
-  nvm_int_t div = 1000000000L;  // max num to be output 
+  nvm_uint_t div = 1000000000L;  // max num to be output 
 #endif
   bool_t printed = FALSE;
   
+  // unsigned, so the most negative int has a positive value as well
   if(val < 0) {
     *str++ = '-';
-    val = -val;
+    uval = -uval;
   }
   
   while(div > 0) {
-    m = val / div;
+    m = uval / div;
     if(m) printed = TRUE;
     
     if((printed)||(div == 1)) 
       *str++ = '0' + m;
     
-    val = val % div;
+    uval = uval % div;
     div /= 10;
   }
   
@@ -153,26 +154,36 @@ void native_java_io_inputstream_invoke(u08_t mref) {
     error(ERROR_NATIVE_UNKNOWN_METHOD);
 }    
 
+// a StringBuffer chunk holds the length of its string followed by the
+// string itself. The chunk size is its capacity
+#define SB_LEN(sb)  (*(heap_size_t*)(sb))
+#define SB_STR(sb)  ((char*)(sb) + sizeof(heap_size_t))
+
 // invoke a native method within class java/lang/StringBuffer
 void native_java_lang_stringbuffer_invoke(u08_t mref) {
   if(mref == NATIVE_METHOD_INIT) {
     // make this an empty string
-    *(char*)stack_pop_addr() = 0;
+    void *sb = stack_pop_addr();
+    SB_LEN(sb) = 0;
+    *SB_STR(sb) = 0;
   } else if(mref == NATIVE_METHOD_INIT_STR) {
-    char *src, *dst;
-    u16_t len;
+    char *src;
+    void *sb;
+    heap_size_t len;
 
     src = stack_peek_addr(0);
     // check source of string
     len = native_strlen(src);
 
     // resize existing object
-    heap_realloc(stack_peek(1) & ~NVM_TYPE_MASK, len + 1);
+    heap_realloc(stack_peek(1) & ~NVM_TYPE_MASK,
+		 sizeof(heap_size_t) + len + 1);
 
     // and copy string to new object
     src = stack_peek_addr(0);
-    dst = heap_get_addr(stack_peek(1) & ~NVM_TYPE_MASK);
-    native_strcpy(dst, src);
+    sb = heap_get_addr(stack_peek(1) & ~NVM_TYPE_MASK);
+    SB_LEN(sb) = len;
+    native_strcpy(SB_STR(sb), src);
 
     // get rid of source references still on the stack
     stack_pop(); stack_pop(); 
@@ -181,7 +192,8 @@ void native_java_lang_stringbuffer_invoke(u08_t mref) {
 	    (mref == NATIVE_METHOD_APPEND_INT)||
 	    (mref == NATIVE_METHOD_APPEND_CHR)||
             (mref == NATIVE_METHOD_APPEND_FLOAT)) {
-    char *src0, *src1, *dst;
+    char *src1;
+    void *sb;
 #ifdef NVM_USE_FLOAT
     char tmp[15];
 #else
@@ -191,7 +203,7 @@ void native_java_lang_stringbuffer_invoke(u08_t mref) {
     char tmp[5];
 # endif
 #endif
-    u16_t len;
+    heap_size_t len;
     
     if(mref == NATIVE_METHOD_APPEND_STR) {
       // appending a string is simple
@@ -217,31 +229,42 @@ void native_java_lang_stringbuffer_invoke(u08_t mref) {
       len = utils_strlen((char*)src1);
     }
 
-    // this is always a string
-    src0 = stack_peek_addr(1);
-    len += native_strlen(src0);
-    
-    // create a new object 
-    heap_id_t id = heap_alloc(FALSE, len + 1);
+    heap_id_t id = stack_peek(1) & ~NVM_TYPE_MASK;
+    heap_size_t used = SB_LEN(heap_get_addr(id));
+    heap_size_t need = sizeof(heap_size_t) + used + len + 1;
 
-    // alloc may have had an impact on heap, so get address again
-    src0 = stack_peek_addr(1);
-    if(mref == NATIVE_METHOD_APPEND_STR) 
-      src1 = stack_peek_addr(0);
+    // grow it geometrically if the new string doesn't fit
+    if(need > heap_get_len(id)) {
+      heap_size_t size = 2 * heap_get_len(id);
+      if(size < need)
+	size = need;
 
-    // handle nvmfile memory and ram
-    dst = heap_get_addr(id);
-    native_strcpy(dst, src0);
-    native_strcat(dst, src1);
+      heap_realloc(id, size);
 
-    // get rid of source references still on the stack
-    stack_pop(); stack_pop();  // 
-    // place new reference on the stack
-    stack_push(NVM_TYPE_HEAP | id);
+      // realloc may have had an impact on heap, so get address again
+      if(mref == NATIVE_METHOD_APPEND_STR) 
+	src1 = stack_peek_addr(0);
+    }
+
+    // and append in place behind the string
+    sb = heap_get_addr(id);
+    native_strcpy(SB_STR(sb) + used, src1);
+    SB_LEN(sb) = used + len;
+
+    // get rid of the source reference, the buffer itself is returned
+    stack_pop();
 
   } else if(mref == NATIVE_METHOD_TOSTRING) {
-    // toString does nothing, since the object already is
-    // a valid string
+    // the buffer may still be changed, so return a copy of the
+    // string without the spare capacity
+    heap_size_t len = SB_LEN(stack_peek_addr(0));
+    heap_id_t id = heap_alloc(HEAP_REFS_NONE, len + 1);
+
+    // alloc may have had an impact on heap, so get address again
+    utils_memcpy(heap_get_addr(id), SB_STR(stack_peek_addr(0)), len + 1);
+
+    stack_pop();
+    stack_push(NVM_TYPE_HEAP | id);
   } else {
     DEBUGF("unknown method in java/lang/StringBuffer\n");
     error(ERROR_NATIVE_UNKNOWN_METHOD);
@@ -72,8 +72,10 @@ void native_java_lang_object_invoke(u08_t mref) {
   
 void native_new(u16_t mref) {
   if(NATIVE_ID2CLASS(mref) == NATIVE_CLASS_STRINGBUFFER) {
-    // create empty stringbuf object and push reference onto stack
-    stack_push(NVM_TYPE_HEAP | heap_alloc(FALSE, 1));
+    // create empty stringbuf object (length and terminator of the
+    // string) and push reference onto stack
+    stack_push(NVM_TYPE_HEAP |
+	       heap_alloc(HEAP_REFS_NONE, sizeof(heap_size_t) + 1));
   } else 
     error(ERROR_NATIVE_UNKNOWN_CLASS);
 }
@@ -0,0 +1,112 @@
+//
+//  NanoVM, a tiny java VM for the Atmel AVR family
+//  Copyright (C) 2005 by Till Harbaum <Till@Harbaum.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+//
+//  nvmaot.h
+//
+//  methods compiled to c by NanoVMTool (-a) and linked into the vm
+//
+
+#ifndef NVMAOT_H
+#define NVMAOT_H
+
+#include "types.h"
+#include "config.h"
+#include "error.h"
+#include "vm.h"
+#include "stack.h"
+#include "heap.h"
+#include "nvmfile.h"
+
+#ifdef NVM_USE_ARRAY
+#include "array.h"
+#endif
+
+#ifdef NVM_USE_AOT
+
+// a compiled method gets its locals and runs on the regular stack
+// above them. It returns TRUE if it left a return value on the stack
+typedef u08_t (*nvm_aot_func_t)(nvm_stack_t *locals);
+
+// one entry per compiled method. The compiled methods are only used
+// if the ids and the sizes and checksums of the bytecode of all of
+// them match the nvm file loaded
+typedef struct {
+  u08_t index;
+  u16_t id;
+  u16_t size;
+  u16_t checksum;
+  nvm_aot_func_t func;
+} nvm_aot_method_t;
+
+extern const nvm_aot_method_t nvm_aot_methods[];
+extern const u08_t nvm_aot_method_count;
+
+// invoke a method from within compiled code, the args are on the stack
+void nvm_aot_invoke(u16_t mref, bool_t virtual_call);
+
+// compiled code keeps the stack pointer in its local variable sp
+// and writes it back before calling anything that uses the stack
+#define NVM_AOT_SAVE()       stack_set_sp(sp)
+#define NVM_AOT_LOAD()       (sp = stack_get_sp())
+#define NVM_AOT_PUSH(val)    { nvm_stack_t aot_val = (val); *(++sp) = aot_val; }
+#define NVM_AOT_POP()        (*sp--)
+#define NVM_AOT_DROP(n)      (sp -= (n))
+#define NVM_AOT_PEEK(i)      (sp[-(i)])
+#define NVM_AOT_POP_INT()    nvm_stack2int(NVM_AOT_POP())
+#ifdef NVM_USE_FLOAT
+#define NVM_AOT_POP_FLOAT()  nvm_stack2float(NVM_AOT_POP())
+#endif
+
+// field index of the object referenced by ref
+#define NVM_AOT_FIELD(ref, index)					\
+  (((nvm_word_t*)heap_get_addr((ref) & ~NVM_TYPE_MASK))		\
+   [index])
+
+// the collector has to know about the reference being overwritten
+#define NVM_AOT_PUTFIELD(ref, index, val) {				\
+    heap_id_t aot_obj = (ref) & ~NVM_TYPE_MASK;				\
+    nvm_word_t *aot_field = &NVM_AOT_FIELD(aot_obj, index);		\
+    HEAP_WRITE_BARRIER(aot_obj, *aot_field, val);			\
+    *aot_field = (val); }
+
+// instructions which may run other code or the garbage collector
+#define NVM_AOT_INVOKE(mref, virtual_call) {				\
+    NVM_AOT_SAVE(); nvm_aot_invoke(mref, virtual_call); NVM_AOT_LOAD(); }
+
+#define NVM_AOT_NEW(mref) {						\
+    NVM_AOT_SAVE(); vm_new(mref); NVM_AOT_LOAD(); }
+
+#define NVM_AOT_NEWARRAY(type) {					\
+    nvm_stack_t aot_len = NVM_AOT_POP();				\
+    NVM_AOT_SAVE();							\
+    aot_len = array_new(aot_len, type) | NVM_TYPE_HEAP;			\
+    NVM_AOT_LOAD();							\
+    NVM_AOT_PUSH(aot_len); }
+
+#define NVM_AOT_MULTIANEWARRAY(type, dims) {				\
+    NVM_AOT_SAVE(); array_new_multi(type, dims); NVM_AOT_LOAD(); }
+
+// a return value is left on the stack
+#define NVM_AOT_RETURN(has_ret) {					\
+    NVM_AOT_SAVE(); return has_ret; }
+
+#endif // NVM_USE_AOT
+
+#endif // NVMAOT_H
@@ -0,0 +1,354 @@
+//
+//  NanoVM, a tiny java VM for the Atmel AVR family
+//  Copyright (C) 2005 by Till Harbaum <Till@Harbaum.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+// 
+
+//
+//  nvmcode.c
+//
+//  translate the bytecode of all methods into an aligned pre-decoded
+//  format in ram. Operands are fetched and resolved, branch offsets
+//  are converted into absolute instruction pointers and switch tables
+//  into native arrays. This saves the interpreter from going through
+//  nvmfile_read08() for every single byte.
+//
+
+#include "types.h"
+#include "debug.h"
+#include "config.h"
+#include "error.h"
+
+#include "nvmcode.h"
+#include "nvmfile.h"
+#include "opcodes.h"
+
+#ifdef NVM_USE_PREDECODE
+
+#include <stdlib.h>
+
+// marker for bytes not (yet) known to start an instruction
+#define NVMCODE_NONE  0xffff
+
+static nvmcode_insn_t **nvmcode_methods = NULL;
+static u08_t nvmcode_method_count = 0;
+
+// read big endian operands
+static s16_t nvmcode_read16(u08_t *addr) {
+  return (nvmfile_read08(addr) << 8) | nvmfile_read08(addr+1);
+}
+
+static nvm_int_t nvmcode_read32(u08_t *addr) {
+  return ((u32_t)nvmcode_read16(addr) << 16) | (u16_t)nvmcode_read16(addr+2);
+}
+
+// length of the instruction at code+pos (0 if it exceeds the limit)
+static u16_t nvmcode_insn_length(u08_t *code, u16_t pos, u16_t limit) {
+  u32_t len = 1;
+
+  switch(nvmfile_read08(code+pos)) {
+    case OP_BIPUSH: case OP_LDC:
+    case OP_ILOAD:  case OP_FLOAD:
+    case OP_ISTORE: case OP_FSTORE:
+    case OP_NEWARRAY:
+      len = 2;
+      break;
+
+    case OP_SIPUSH: case OP_IINC: case OP_GOTO:
+    case OP_IFEQ: case OP_IFNE: case OP_IFLT:
+    case OP_IFGE: case OP_IFGT: case OP_IFLE:
+    case OP_IF_ICMPEQ: case OP_IF_ICMPNE: case OP_IF_ICMPLT:
+    case OP_IF_ICMPGE: case OP_IF_ICMPGT: case OP_IF_ICMPLE:
+    case OP_GETSTATIC: case OP_PUTSTATIC:
+    case OP_GETFIELD:  case OP_PUTFIELD:
+    case OP_INVOKEVIRTUAL: case OP_INVOKESPECIAL: case OP_INVOKESTATIC:
+    case OP_NEW: case OP_ANEWARRAY: case OP_NEW_SCOPED:
+    case OP_MULTIANEWARRAY:   // followed by a nop
+      len = 3;
+      break;
+
+#ifdef NVM_USE_SUPERINSN
+    case OP_ILOAD_ICONST_IADD_ISTORE: case OP_ILOAD_GETFIELD:
+      len = 4;
+      break;
+
+    case OP_ILOAD_ILOAD_IF_ICMPEQ: case OP_ILOAD_ILOAD_IF_ICMPNE:
+    case OP_ILOAD_ILOAD_IF_ICMPLT: case OP_ILOAD_ILOAD_IF_ICMPGE:
+    case OP_ILOAD_ILOAD_IF_ICMPGT: case OP_ILOAD_ILOAD_IF_ICMPLE:
+      len = 5;
+      break;
+
+    case OP_IINC_GOTO:
+      len = 6;
+      break;
+#endif
+
+    // padding was eliminated by generator, the switch data
+    // directly follows the opcode
+    case OP_TABLESWITCH:
+      if(pos + 13 > limit) return 0;
+      len = 13 + 4 * (u32_t)(nvmcode_read32(code+pos+9) -
+			     nvmcode_read32(code+pos+5) + 1);
+      break;
+
+    case OP_LOOKUPSWITCH:
+      if(pos + 9 > limit) return 0;
+      len = 9 + 8 * (u32_t)nvmcode_read32(code+pos+5);
+      break;
+  }
+
+  return (pos + len > limit)?0:len;
+}
+
+// does execution never continue behind this instruction?
+static bool_t nvmcode_is_terminal(u08_t op) {
+  return (op == OP_GOTO) || (op == OP_TABLESWITCH) ||
+    (op == OP_LOOKUPSWITCH) || (op == OP_IRETURN) ||
+#ifdef NVM_USE_SUPERINSN
+    (op == OP_IINC_GOTO) ||
+#endif
+    (op == OP_FRETURN) || (op == OP_RETURN);
+}
+
+// position of the 16 bit branch offset within the instruction
+// (0 if it's no branch)
+static u08_t nvmcode_branch_offset(u08_t op) {
+  if(((op >= OP_IFEQ) && (op <= OP_IF_ICMPLE)) || (op == OP_GOTO))
+    return 1;
+
+#ifdef NVM_USE_SUPERINSN
+  if(((op >= OP_ILOAD_ILOAD_IF_ICMPEQ) && (op <= OP_ILOAD_ILOAD_IF_ICMPLE)) ||
+     (op == OP_IINC_GOTO))
+    return 3;
+#endif
+
+  return 0;
+}
+
+// number of bytes the method code at code may at most occupy
+static u16_t nvmcode_get_limit(u08_t *code, u08_t methods) {
+  u08_t *end = (u08_t*)nvmfile_get_base() + NVMFILE_SIZE;
+  u08_t i;
+
+  // the code of the next method ends this one
+  for(i=0;i<methods;i++) {
+    nvm_method_hdr_t *hdr = nvmfile_get_method_hdr(i);
+    u08_t *start = (u08_t*)hdr + nvmfile_read16(&hdr->code_index);
+
+    if((start > code) && (start < end))
+      end = start;
+  }
+
+  return end - code;
+}
+
+// translate a single method
+static nvmcode_insn_t *nvmcode_translate(u08_t *code, u16_t limit) {
+  u16_t *map, *todo, todo_cnt = 0;
+  u16_t pos, len, cnt = 0, i;
+  u32_t size;
+  nvmcode_insn_t *insns, *illegal;
+  u08_t *tables;
+
+  // map from byte offset to instruction index
+  map = malloc(2 * limit * sizeof(u16_t));
+  if(!map) error(ERROR_HEAP_OUT_OF_MEMORY);
+  todo = map + limit;
+
+  for(pos=0;pos<limit;pos++)
+    map[pos] = NVMCODE_NONE;
+
+  // find all reachable instructions, starting at the method entry
+  // and following all branches
+  size = 0;
+  todo[todo_cnt++] = 0;
+  while(todo_cnt) {
+    pos = todo[--todo_cnt];
+
+    while((pos < limit) && (map[pos] == NVMCODE_NONE)) {
+      u08_t op = nvmfile_read08(code+pos);
+
+      if(!(len = nvmcode_insn_length(code, pos, limit)))
+	break;
+
+      map[pos] = 0;
+
+      // remember all branch targets
+      if(nvmcode_branch_offset(op)) {
+	s32_t dst = pos + nvmcode_read16(code+pos+nvmcode_branch_offset(op));
+	if((dst >= 0) && (dst < limit) && (todo_cnt < limit))
+	  todo[todo_cnt++] = dst;
+      }
+
+      else if((op == OP_TABLESWITCH) || (op == OP_LOOKUPSWITCH)) {
+	u16_t entries = (op == OP_TABLESWITCH)?((len - 13) / 4):((len - 9) / 8);
+
+	for(i=0;i<=entries;i++) {
+	  // default offset first, then all table entries
+	  u16_t offset = (!i)?1:(op == OP_TABLESWITCH)?(13+4*(i-1)):(9+8*(i-1)+4);
+	  s32_t dst = pos + nvmcode_read32(code+pos+offset);
+	  if((dst >= 0) && (dst < limit) && (todo_cnt < limit))
+	    todo[todo_cnt++] = dst;
+	}
+
+	size += (op == OP_TABLESWITCH)?
+	  (sizeof(nvmcode_tableswitch_t) + entries * sizeof(nvmcode_insn_t*)):
+	  (sizeof(nvmcode_lookupswitch_t) + entries * sizeof(nvmcode_lookup_t));
+      }
+
+      if(nvmcode_is_terminal(op))
+	break;
+
+      pos += len;
+    }
+  }
+
+  // assign instruction indices in code order
+  for(pos=0;pos<limit;pos++)
+    if(map[pos] != NVMCODE_NONE)
+      map[pos] = cnt++;
+
+  DEBUGF("method at %d: %d instructions\n",
+	 code - (u08_t*)nvmfile_get_base(), cnt);
+
+  // instructions are followed by an illegal one as target for all
+  // unresolvable branches and the switch tables
+  size += (cnt + 1) * sizeof(nvmcode_insn_t);
+  insns = malloc(size);
+  if(!insns) error(ERROR_HEAP_OUT_OF_MEMORY);
+  illegal = insns + cnt;
+  illegal->op = NVMCODE_OP_ILLEGAL;
+  tables = (u08_t*)(illegal + 1);
+
+#define NVMCODE_TARGET(offset)						\
+  ((((s32_t)pos + (offset) >= 0) && ((s32_t)pos + (offset) < limit) &&	\
+    (map[pos + (offset)] != NVMCODE_NONE))?				\
+   (insns + map[pos + (offset)]):illegal)
+
+  for(pos=0;pos<limit;pos++) {
+    nvmcode_insn_t *insn;
+    u08_t op;
+
+    if(map[pos] == NVMCODE_NONE)
+      continue;
+
+    insn = insns + map[pos];
+    insn->op = op = nvmfile_read08(code+pos);
+#ifdef DEBUG
+    insn->offset = pos;
+#endif
+    insn->target = illegal;
+
+    // the first two operand bytes of superinstructions are
+    // stored like the ones of three byte instructions
+    len = nvmcode_insn_length(code, pos, limit);
+    if(len == 2)
+      insn->arg = (s08_t)nvmfile_read08(code+pos+1) << 8;
+    else if((len == 3) || (op >= OP_ILOAD_ILOAD_IF_ICMPEQ))
+      insn->arg = nvmcode_read16(code+pos+1);
+    else
+      insn->arg = 0;
+
+    if(op == OP_LDC) {
+      // resolve constant
+      u08_t index = nvmfile_read08(code+pos+1);
+#ifdef NVM_USE_32BIT_WORD
+      insn->arg = nvmfile_get_constant(index);
+#else
+      insn->arg = NVM_TYPE_CONST | (index-nvmfile_constant_count);
+#endif
+    }
+
+    else if(nvmcode_branch_offset(op))
+      insn->target = NVMCODE_TARGET(
+	nvmcode_read16(code+pos+nvmcode_branch_offset(op)));
+
+    else if(op == OP_TABLESWITCH) {
+      nvmcode_tableswitch_t *t = (nvmcode_tableswitch_t*)tables;
+
+      t->def  = NVMCODE_TARGET(nvmcode_read32(code+pos+1));
+      t->low  = nvmcode_read32(code+pos+5);
+      t->high = nvmcode_read32(code+pos+9);
+      for(i=0;i<=t->high-t->low;i++)
+	t->target[i] = NVMCODE_TARGET(nvmcode_read32(code+pos+13+4*i));
+
+      insn->target = t;
+      tables = (u08_t*)(t->target + i);
+    }
+
+    else if(op == OP_LOOKUPSWITCH) {
+      nvmcode_lookupswitch_t *t = (nvmcode_lookupswitch_t*)tables;
+
+      t->def  = NVMCODE_TARGET(nvmcode_read32(code+pos+1));
+      t->size = nvmcode_read32(code+pos+5);
+      for(i=0;i<t->size;i++) {
+	t->pair[i].key    = nvmcode_read32(code+pos+9+8*i);
+	t->pair[i].target = NVMCODE_TARGET(nvmcode_read32(code+pos+13+8*i));
+      }
+
+      insn->target = t;
+      tables = (u08_t*)(t->pair + i);
+    }
+  }
+
+#undef NVMCODE_TARGET
+
+  free(map);
+  return insns;
+}
+
+// binary search for the target of a lookupswitch, the generator
+// makes sure the keys are sorted
+nvmcode_insn_t *nvmcode_lookup(nvmcode_lookupswitch_t *t, nvm_int_t key) {
+  nvm_int_t lo = 0, hi = t->size;
+
+  while(lo < hi) {
+    nvm_int_t mid = lo + (hi - lo) / 2;
+
+    if(t->pair[mid].key == key)
+      return t->pair[mid].target;
+
+    if(t->pair[mid].key < key) lo = mid + 1;
+    else                       hi = mid;
+  }
+
+  return t->def;
+}
+
+void nvmcode_init(void) {
+  u08_t i;
+
+  // free previously translated code
+  for(i=0;i<nvmcode_method_count;i++)
+    free(nvmcode_methods[i]);
+  free(nvmcode_methods);
+
+  nvmcode_method_count =
+    nvmfile_read08(&((nvm_header_t*)nvmfile_get_base())->methods);
+  nvmcode_methods = malloc(nvmcode_method_count * sizeof(nvmcode_insn_t*));
+  if(!nvmcode_methods) error(ERROR_HEAP_OUT_OF_MEMORY);
+
+  // let the method table point to the translated code
+  for(i=0;i<nvmcode_method_count;i++) {
+    nvm_method_t *method = nvmfile_get_method(i);
+
+    nvmcode_methods[i] = nvmcode_translate(method->code,
+	   nvmcode_get_limit(method->code, nvmcode_method_count));
+    method->code = nvmcode_methods[i];
+  }
+}
+
+#endif // NVM_USE_PREDECODE
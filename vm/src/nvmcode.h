@@ -0,0 +1,71 @@
+//
+//  NanoVM, a tiny java VM for the Atmel AVR family
+//  Copyright (C) 2005 by Till Harbaum <Till@Harbaum.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+// 
+
+//
+//  nvmcode.h
+//
+//  pre-decoded ram copy of the bytecode of all methods
+//
+
+#ifndef NVMCODE_H
+#define NVMCODE_H
+
+#include "types.h"
+#include "config.h"
+#include "nvmtypes.h"
+
+#ifdef NVM_USE_PREDECODE
+
+// opcode of the instruction every unresolvable branch leads to. It's
+// reserved by the jvm spec (breakpoint) and never part of class files
+#define NVMCODE_OP_ILLEGAL  0xca
+
+// a single pre-decoded instruction
+typedef struct nvmcode_insn {
+  u08_t op;
+#ifdef DEBUG
+  u16_t offset;          // byte offset in the original method code
+#endif
+  nvm_int_t arg;         // resolved (sign expanded) operand
+  void *target;          // branch target or switch table
+} nvmcode_insn_t;
+
+typedef struct {
+  nvm_int_t low, high;
+  nvmcode_insn_t *def;
+  nvmcode_insn_t *target[];
+} nvmcode_tableswitch_t;
+
+typedef struct {
+  nvm_int_t key;
+  nvmcode_insn_t *target;
+} nvmcode_lookup_t;
+
+typedef struct {
+  nvm_int_t size;
+  nvmcode_insn_t *def;
+  nvmcode_lookup_t pair[];
+} nvmcode_lookupswitch_t;
+
+void nvmcode_init(void);
+nvmcode_insn_t *nvmcode_lookup(nvmcode_lookupswitch_t *t, nvm_int_t key);
+
+#endif // NVM_USE_PREDECODE
+
+#endif // NVMCODE_H
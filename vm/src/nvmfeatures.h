@@ -29,8 +29,14 @@
 # endif
 #endif
 
+#ifdef NVM_USE_FULL_WORDS
+# ifndef NVM_USE_32BIT_WORD
+#  error "NVM_USE_FULL_WORDS is only allowed with NVM_USE_32BIT_WORD!"
+# endif
+#endif
 
-#define NVMFILE_VERSION    2
+
+#define NVMFILE_VERSION    4
 #define NVMFILE_MAGIC      0xBE000000L
 
 
@@ -41,6 +47,10 @@
 #define NVM_FEAUTURE_ARRAY        (1L<<4)
 #define NVM_FEAUTURE_INHERITANCE  (1L<<5)
 #define NVM_FEAUTURE_EXTSTACK     (1L<<6)
+#define NVM_FEAUTURE_SUPERINSN    (1L<<7)
+#define NVM_FEAUTURE_SCOPED       (1L<<8)
+#define NVM_FEAUTURE_FLAT         (1L<<9)
+#define NVM_FEAUTURE_FULLWORDS    (1L<<10)
 
 #ifndef NVM_USE_LOOKUPSWITCH
 # undef NVM_FEAUTURE_LOOKUPSWITCH
@@ -77,6 +87,26 @@
 # define NVM_FEAUTURE_EXTSTACK 0
 #endif
 
+#ifndef NVM_USE_SUPERINSN
+# undef NVM_FEAUTURE_SUPERINSN
+# define NVM_FEAUTURE_SUPERINSN 0
+#endif
+
+#ifndef NVM_USE_SCOPED_ALLOC
+# undef NVM_FEAUTURE_SCOPED
+# define NVM_FEAUTURE_SCOPED 0
+#endif
+
+#ifndef NVM_USE_FLAT_ARRAYS
+# undef NVM_FEAUTURE_FLAT
+# define NVM_FEAUTURE_FLAT 0
+#endif
+
+#ifndef NVM_USE_FULL_WORDS
+# undef NVM_FEAUTURE_FULLWORDS
+# define NVM_FEAUTURE_FULLWORDS 0
+#endif
+
 
 #define NVM_MAGIC_FEAUTURE (NVMFILE_MAGIC\
                            |NVM_FEAUTURE_LOOKUPSWITCH\
@@ -84,7 +114,11 @@
                            |NVM_FEAUTURE_32BIT\
                            |NVM_FEAUTURE_FLOAT\
                            |NVM_FEAUTURE_ARRAY\
-                           |NVM_FEAUTURE_INHERITANCE)
+                           |NVM_FEAUTURE_INHERITANCE\
+                           |NVM_FEAUTURE_SUPERINSN\
+                           |NVM_FEAUTURE_SCOPED\
+                           |NVM_FEAUTURE_FLAT\
+                           |NVM_FEAUTURE_FULLWORDS)
 
 
 #endif // _NVMFEAUTURES_H_
@@ -33,6 +33,8 @@
 #include "vm.h"
 #include "eeprom.h"
 #include "nvmfeatures.h"
+#include "nvmcode.h"
+#include "nvmaot.h"
 
 #ifdef NVM_USE_FLASH_PROGRAM
 # include <avr/io.h>
@@ -45,9 +47,19 @@
 #include <string.h>
 
 
+#ifdef NVM_USE_SIZE_OPTIONS
+// the default program is kept in a buffer of CODESIZE bytes, a file
+// gets one of the size given on the command line (-C)
+static u08_t nvmfile_default[CODESIZE] =
+#include "nvmdefault.h"
+
+static u08_t *nvmfile = nvmfile_default;
+u32_t nvmfile_size = CODESIZE;
+#endif
+
 void nvmfile_load(char *filename, bool_t quiet) {
   FILE *file;
-  u16_t size;
+  u32_t size;
   u08_t *buffer;
 
   file = fopen(filename, "rb");
@@ -61,10 +73,23 @@ void nvmfile_load(char *filename, bool_t quiet) {
   size = ftell(file);
   fseek(file, 0l, SEEK_SET);
 
+#ifdef NVM_USE_SIZE_OPTIONS
+  if(size > nvmfile_size) {
+    printf("File %s exceeds code size (%lu > %lu bytes)\n", filename,
+	   (unsigned long)size, (unsigned long)nvmfile_size);
+    exit(-1);
+  }
+
+  if(!(nvmfile = malloc(nvmfile_size))) {
+    perror("malloc()");
+    exit(-1);
+  }
+#endif
+
   buffer = malloc(size);
 
   if(!quiet)
-    printf("Loading %s, size %d\n", filename, size);
+    printf("Loading %s, size %lu\n", filename, (unsigned long)size);
 
   if(fread(buffer, 1l, size, file) != size) {
     perror("fread()");
@@ -82,7 +107,9 @@ void nvmfile_load(char *filename, bool_t quiet) {
 
 // buffer for file itself is in eeprom
 
-#ifdef NVM_USE_FLASH_PROGRAM
+#if defined(NVM_USE_SIZE_OPTIONS)
+// buffer defined above next to nvmfile_load()
+#elif defined(NVM_USE_FLASH_PROGRAM)
 static u08_t nvmfile[CODESIZE] PROGMEM =
 #include "nvmdefault.h"
 #else
@@ -92,6 +119,20 @@ static u08_t EEPROM nvmfile[CODESIZE] =
 
 u08_t nvmfile_constant_count;
 
+// ram copies of the method and class descriptions
+nvm_method_t nvmfile_methods[NVM_METHOD_TABLE_SIZE];
+nvm_class_hdr_t nvmfile_classes[NVM_CLASS_TABLE_SIZE];
+u08_t nvmfile_static_fields;
+static u08_t nvmfile_method_count;
+
+static u08_t *nvmfile_refmaps;
+static u08_t nvmfile_refmap_bytes;
+
+#ifdef NVM_USE_INHERITANCE
+static u08_t *nvmfile_vtables;
+static u08_t nvmfile_vtable_slots;
+#endif
+
 void *nvmfile_get_base(void) {
   return nvmfile;
 }
@@ -176,11 +217,24 @@ bool_t nvmfile_init(void) {
   DEBUGF("NVM_MAGIC_FEAUTURE[file] = %x\n", features);
   DEBUGF("NVM_MAGIC_FEAUTURE[vm] = %x\n", NVM_MAGIC_FEAUTURE);
 
+#ifdef NVM_USE_SIZE_OPTIONS
+  // -C only applies to programs loaded from a file
+  if(nvmfile == nvmfile_default)
+    nvmfile_size = CODESIZE;
+#endif
+
   if ((features&NVM_MAGIC_FEAUTURE)!=(features|NVMFILE_MAGIC)) {
     error(ERROR_NVMFILE_MAGIC);
     return FALSE;
   }
 
+  // constants are stored the way the stack holds them, so files
+  // written for 31 bit ints and floats can't be used either
+  if((features&NVM_FEAUTURE_FULLWORDS) != NVM_FEAUTURE_FULLWORDS) {
+    error(ERROR_NVMFILE_MAGIC);
+    return FALSE;
+  }
+
   if(nvmfile_read08(&((nvm_header_t*)nvmfile)->version) != NVMFILE_VERSION) {
     error(ERROR_NVMFILE_VERSION);
     return FALSE;
@@ -190,6 +244,96 @@ bool_t nvmfile_init(void) {
   t      -= nvmfile_read16(&((nvm_header_t*)nvmfile)->constant_offset);
   nvmfile_constant_count = t/4;
 
+  // the class headers are located between file header and constants
+  t  = nvmfile_read16(&((nvm_header_t*)nvmfile)->constant_offset);
+  t -= sizeof(nvm_header_t);
+  t /= sizeof(nvm_class_hdr_t);
+  DEBUGF("%d classes\n", t);
+
+  if(t > NVM_CLASS_TABLE_SIZE) {
+    error(ERROR_NVMFILE_TABLE_SIZE);
+    return FALSE;
+  }
+
+  nvmfile_read(nvmfile_classes, ((nvm_header_t*)nvmfile)->class_hdr,
+	       t * sizeof(nvm_class_hdr_t));
+
+  nvmfile_static_fields =
+    nvmfile_read08(&((nvm_header_t*)nvmfile)->static_fields);
+
+#ifdef NVM_USE_INHERITANCE
+  nvmfile_vtables = nvmfile +
+    nvmfile_read16(&((nvm_header_t*)nvmfile)->vtable_offset);
+  nvmfile_vtable_slots =
+    nvmfile_read08(&((nvm_header_t*)nvmfile)->vtable_slots);
+  DEBUGF("%d vtable slots\n", nvmfile_vtable_slots);
+#endif
+
+  nvmfile_refmaps = nvmfile +
+    nvmfile_read16(&((nvm_header_t*)nvmfile)->refmap_offset);
+  nvmfile_refmap_bytes =
+    nvmfile_read08(&((nvm_header_t*)nvmfile)->refmap_bytes);
+  DEBUGF("%d reference map bytes\n", nvmfile_refmap_bytes);
+
+  // copy the required parts of all method headers into ram
+  nvmfile_method_count = nvmfile_read08(&((nvm_header_t*)nvmfile)->methods);
+  DEBUGF("%d methods\n", nvmfile_method_count);
+
+  if(nvmfile_method_count > NVM_METHOD_TABLE_SIZE) {
+    error(ERROR_NVMFILE_TABLE_SIZE);
+    return FALSE;
+  }
+
+  for(t=0;t<nvmfile_method_count;t++) {
+    nvm_method_hdr_t mhdr, *mhdr_ptr = nvmfile_get_method_hdr(t);
+    nvm_method_t *method = nvmfile_get_method(t);
+
+    nvmfile_read(&mhdr, mhdr_ptr, sizeof(nvm_method_hdr_t));
+    method->code       = (u08_t*)mhdr_ptr + mhdr.code_index;
+    method->id         = mhdr.id;
+    method->args       = mhdr.args;
+    method->max_locals = mhdr.max_locals;
+    method->max_stack  = mhdr.max_stack;
+#ifdef NVM_USE_AOT
+    method->aot        = NULL;
+#endif
+  }
+
+#ifdef NVM_USE_AOT
+  // attach the methods compiled to c. Compiled code only calls
+  // compiled code, so they are either all used or none of them. The
+  // checksums over the bytecode make sure they have been compiled
+  // from this file
+  for(t=0;t<nvm_aot_method_count;t++) {
+    const nvm_aot_method_t *aot = nvm_aot_methods+t;
+    u08_t *code;
+    u16_t i, sum = 0;
+
+    if(aot->index >= nvmfile_method_count)
+      break;
+
+    code = nvmfile_get_method(aot->index)->code;
+    for(i=0;i<aot->size;i++)
+      sum += nvmfile_read08(code+i);
+
+    if((nvmfile_get_method(aot->index)->id != aot->id) ||
+       (sum != aot->checksum))
+      break;
+  }
+
+  if(t == nvm_aot_method_count) {
+    DEBUGF("%d compiled methods\n", t);
+    for(t=0;t<nvm_aot_method_count;t++)
+      nvmfile_get_method(nvm_aot_methods[t].index)->aot =
+	nvm_aot_methods[t].func;
+  }
+#endif
+
+#ifdef NVM_USE_PREDECODE
+  // translate all methods into the pre-decoded ram format
+  nvmcode_init();
+#endif
+
   return TRUE;
 }
 
@@ -198,9 +342,9 @@ void nvmfile_store(u16_t index, u08_t *buffer, u16_t size) {
   // this check is not required in real life, since the code
   // limit is verified by the upload tool and by the compiler for
   // the default code
-  if(size > CODESIZE) {
+  if(size > NVMFILE_SIZE) {
     DEBUGF("Code size exceeds buffer size (%d > %d)\n",
-	   size, CODESIZE);
+	   size, NVMFILE_SIZE);
     for(;;);
   }
 #endif
@@ -235,7 +379,7 @@ u32_t nvmfile_get_constant(u08_t index) {
 void nvmfile_call_main(void) {
   u08_t i;
 
-  for(i=0;i<nvmfile_read08(&((nvm_header_t*)nvmfile)->methods);i++) {
+  for(i=0;i<nvmfile_method_count;i++) {
     // is this a clinit method?
     if(nvmfile_read08(&nvmfile_get_method_hdr(i)->flags) & FLAG_CLINIT) {
       DEBUGF("calling clinit %d\n", i);
@@ -256,50 +400,29 @@ void *nvmfile_get_addr(u16_t ref) {
   return((u08_t*)refs + nvmfile_read16(refs+ref));
 }
 
-u08_t nvmfile_get_class_fields(u08_t index) {
-  return nvmfile_read08(&((nvm_header_t*)nvmfile)->class_hdr[index].fields);
-}
-
-u08_t nvmfile_get_static_fields(void) {
-  return nvmfile_read08(&((nvm_header_t*)nvmfile)->static_fields);
-}
-
 #ifdef NVM_USE_INHERITANCE
-u08_t nvmfile_get_method_by_fixed_class_and_id(u08_t class, u08_t id) {
-  u08_t i;
-  nvm_method_hdr_t mhdr, *mhdr_ptr;
-
-  DEBUGF("Searching for class "DBG8", method "DBG8"\n", class, id);
-
-  for(i=0;i<nvmfile_read08(&((nvm_header_t*)nvmfile)->methods);i++) {
-    DEBUGF("Method %d ", i);
-    // load new method header into ram
-    mhdr_ptr = nvmfile_get_method_hdr(i);
-    nvmfile_read(&mhdr, mhdr_ptr, sizeof(nvm_method_hdr_t));
-    DEBUGF("id = #"DBG16"\n", mhdr.id);
+// the method ids of all methods that can be called virtually are
+// used as slots in the per class tables generated by NanoVMTool.
+// Each entry is the index of the method implementing it in this
+// class or the nearest super class
+u08_t nvmfile_get_method_by_class_and_id(u08_t class, u08_t id) {
+  u08_t mref = nvmfile_read08(nvmfile_vtables +
+			      class * nvmfile_vtable_slots + id);
 
-    if(((mhdr.id >> 8) == class) && ((mhdr.id & 0xff) == id)) {
-      DEBUGF("Match!\n");
-      return i;
-    }
-  }
+  DEBUGF("vtable of class "DBG8", slot "DBG8" -> method %d\n",
+	 class, id, mref);
 
-  DEBUGF("No matching method in this class\n");
-  return 0xff;
+  return mref;
 }
+#endif
 
-u08_t nvmfile_get_method_by_class_and_id(u08_t class, u08_t id) {
-  u08_t mref;
-
-  for(;;) {
-    if((mref = nvmfile_get_method_by_fixed_class_and_id(class, id)) != 0xff)
-      return mref;
-
-    DEBUGF("Getting super class of %d ", class);
-    class = nvmfile_read08(&((nvm_header_t*)nvmfile)->class_hdr[class].super);
-    DEBUGF("-> %d\n", class);
-  }
+// the reference map of a class has one bit per non-static field
+// slot (including the ones inherited) that is set if the field
+// holds a reference. Slots beyond the map never do
+bool_t nvmfile_is_ref_field(u08_t class, u08_t field) {
+  if((field>>3) >= nvmfile_refmap_bytes)
+    return FALSE;
 
-  return 0;
+  return (nvmfile_read08(nvmfile_refmaps + class * nvmfile_refmap_bytes +
+			 (field>>3)) & (1<<(field&7))) != 0;
 }
-#endif
@@ -50,21 +50,52 @@ typedef struct {
   u16_t string_offset;
   u16_t method_offset;
   u08_t static_fields;
+  u16_t vtable_offset;    // virtual method tables of all classes
+  u08_t vtable_slots;     // number of entries per virtual method table
+  u16_t refmap_offset;    // field reference maps of all classes
+  u08_t refmap_bytes;     // number of bytes per reference map
   nvm_class_hdr_t class_hdr[];
 } __attribute__((packed)) nvm_header_t;
 
 // marker that indicates, that a method is a classes init method
 #define FLAG_CLINIT 1
 
+// ram copy of the parts of the method header required at runtime
+typedef struct {
+  void *code;         // start of the methods code
+  u16_t id;           // class and method id
+  u08_t args;
+  u08_t max_locals;
+  u08_t max_stack;
+#ifdef NVM_USE_AOT
+  u08_t (*aot)(nvm_stack_t *locals);  // compiled version (if any)
+#endif
+} nvm_method_t;
+
+// maximum number of methods and classes an nvm file may contain,
+// every method costs 7 and every class 2 bytes of ram on the avr
+#ifndef NVM_METHOD_TABLE_SIZE
+#define NVM_METHOD_TABLE_SIZE  16
+#endif
+
+#ifndef NVM_CLASS_TABLE_SIZE
+#define NVM_CLASS_TABLE_SIZE   8
+#endif
+
 extern u08_t nvmfile_constant_count;
+extern nvm_method_t nvmfile_methods[];
+extern nvm_class_hdr_t nvmfile_classes[];
+extern u08_t nvmfile_static_fields;
+
+#define nvmfile_get_method(index)        (nvmfile_methods+(index))
+#define nvmfile_get_class_fields(index)  (nvmfile_classes[index].fields)
+#define nvmfile_get_static_fields()      (nvmfile_static_fields)
 
 void   nvmfile_store(u16_t index, u08_t *buffer, u16_t size);
 
 bool_t nvmfile_init(void);
 void   nvmfile_call_main(void);
 void   *nvmfile_get_addr(u16_t ref);
-u08_t  nvmfile_get_class_fields(u08_t index);
-u08_t  nvmfile_get_static_fields(void);
 u32_t  nvmfile_get_constant(u08_t index);
 
 void   nvmfile_read(void *dst, void *src, u16_t len);
@@ -74,6 +105,7 @@ u32_t  nvmfile_read32(void *addr);
 void   nvmfile_write08(void *addr, u08_t data);
 void   *nvmfile_get_base(void);
 u08_t  nvmfile_get_method_by_class_and_id(u08_t class, u08_t id);
+bool_t nvmfile_is_ref_field(u08_t class, u08_t field);
 
 nvm_method_hdr_t *nvmfile_get_method_hdr(u16_t index);
 
@@ -89,6 +121,14 @@ void nvmfile_write_finalize(void);
 void nvmfile_load(char *filename, bool_t quiet);
 #endif
 
+#ifdef NVM_USE_SIZE_OPTIONS
+// size of the code buffer, may be given on the command line (-C)
+extern u32_t nvmfile_size;
+#define NVMFILE_SIZE  nvmfile_size
+#else
+#define NVMFILE_SIZE  CODESIZE
+#endif
+
 #define NVMFILE_SET(a)     (void*)(((ptr_t)a) | NVMFILE_FLAG)
 #define NVMFILE_ISSET(a)   (((ptr_t)a) & NVMFILE_FLAG)
 #define NVMFILE_ADDR(a)    (void*)(((ptr_t)a) & ~NVMFILE_FLAG)
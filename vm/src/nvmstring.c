@@ -72,8 +72,8 @@ void native_strcpy(char *dst, char* src) {
 }
 
 /* determine string length */
-u16_t native_strlen(char *str) {
-  u16_t len=0;
+ptr_t native_strlen(char *str) {
+  ptr_t len=0;
 
   // check if string resides in nvm file memory (e.g. eeprom)
   if(NVMFILE_ISSET(str))
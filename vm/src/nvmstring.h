@@ -26,7 +26,7 @@
 
 void native_strcpy(char *dst, char* src);
 void native_strncpy(char *dst, char* src, int n);
-u16_t native_strlen(char *str);
+ptr_t native_strlen(char *str);
 void native_strcat(char *dst, char *src);
 void native_strncat(char *dst, char *src, int n);
 char native_getchar(char* src);
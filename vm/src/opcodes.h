@@ -65,6 +65,8 @@
 #define OP_FALOAD        0x30  // only if array and floating point compiled in
 #define OP_AALOAD        0x32  // only if array compiled in
 #define OP_BALOAD        0x33  // only if array compiled in
+#define OP_CALOAD        0x34  // only if array compiled in
+#define OP_SALOAD        0x35  // only if array compiled in
 
 #define OP_ISTORE        0x36
 #define OP_FSTORE        0x38 // only if floating point compiled in
@@ -86,6 +88,8 @@
 #define OP_FASTORE       0x51  // only if array and floating point compiled in
 #define OP_AASTORE       0x53  // only if array compiled in
 #define OP_BASTORE       0x54  // only if array compiled in
+#define OP_CASTORE       0x55  // only if array compiled in
+#define OP_SASTORE       0x56  // only if array compiled in
 
 #define OP_POP           0x57
 #define OP_POP2          0x58
@@ -158,5 +162,27 @@
 #define OP_NEWARRAY      0xbc  // only if array compiled in
 #define OP_ANEWARRAY     0xbd  // only if array compiled in
 #define OP_ARRAYLENGTH   0xbe  // only if array compiled in
+#define OP_MULTIANEWARRAY 0xc5 // only if arrays of objects compiled in
+
+// new of an object that doesn't escape the method, generated by
+// NanoVMTool. Only if scoped allocation compiled in
+#define OP_NEW_SCOPED    0xcb
+
+// aaload followed by an access to the row it loaded, generated by
+// NanoVMTool. Only if flat arrays compiled in
+#define OP_ARRAYLOAD_2D  0xcc  // array, row, column -> element
+#define OP_ARRAYSTORE_2D 0xcd  // array, row, column, value
+
+// superinstructions generated by NanoVMTool for frequent sequences,
+// only if superinstructions compiled in
+#define OP_ILOAD_ILOAD_IF_ICMPEQ     0xd0  // iload_x, iload_y, if_icmpeq
+#define OP_ILOAD_ILOAD_IF_ICMPNE     0xd1  // iload_x, iload_y, if_icmpne
+#define OP_ILOAD_ILOAD_IF_ICMPLT     0xd2  // iload_x, iload_y, if_icmplt
+#define OP_ILOAD_ILOAD_IF_ICMPGE     0xd3  // iload_x, iload_y, if_icmpge
+#define OP_ILOAD_ILOAD_IF_ICMPGT     0xd4  // iload_x, iload_y, if_icmpgt
+#define OP_ILOAD_ILOAD_IF_ICMPLE     0xd5  // iload_x, iload_y, if_icmple
+#define OP_ILOAD_ICONST_IADD_ISTORE  0xd6  // iload_x, iconst_c, iadd, istore_y
+#define OP_ILOAD_GETFIELD            0xd7  // iload_x, getfield
+#define OP_IINC_GOTO                 0xd8  // iinc, goto
 
 #endif // OPCODES_H
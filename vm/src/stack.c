@@ -134,6 +134,11 @@ nvm_stack_t * stack_get_sp(void) {
   return sp;
 }
 
+// used by vm_run() to write back the stack pointer it keeps in a register
+void stack_set_sp(nvm_stack_t *new_sp) {
+  sp = new_sp;
+}
+
 // static variables are allocated at vm startup on the stack. the following
 // two routines provide access to these variables
 nvm_stack_t stack_get_static(u16_t index) {
@@ -166,9 +171,21 @@ u16_t stack_get_depth(void) {
 }
 #endif
 
+#ifdef NVM_USE_HEAP_HANDLES
+// pass everything on the stack to the garbage collector, it picks
+// the heap references
+void stack_mark_heap_ids(void) {
+  nvm_stack_t *p;
+
+  // since the locals and statics are physically part of the stack
+  // we only need to search the stack
+  for(p=stack;p<=sp;p++)
+    heap_mark(*p);
+}
+#else
 bool_t stack_heap_id_in_use(heap_id_t id) {
   // we are searching for heap objects only
-  u16_t i;
+  heap_size_t i;
   nvm_ref_t id16 = id | NVM_TYPE_HEAP;
 
   // since the locals are physically part of the stack we only need
@@ -180,3 +197,4 @@ bool_t stack_heap_id_in_use(heap_id_t id) {
 
   return FALSE;
 }
+#endif
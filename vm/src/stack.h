@@ -49,6 +49,7 @@ nvm_float_t stack_peek_float(u08_t index);
 
 
 nvm_stack_t *stack_get_sp(void);
+void stack_set_sp(nvm_stack_t *new_sp);
 void stack_add_sp(s08_t offset);
 
 nvm_stack_t stack_get_static(u16_t index);
@@ -61,6 +62,10 @@ bool_t stack_is_empty(void);
 u16_t stack_get_depth(void);
 #endif
 
+#ifdef NVM_USE_HEAP_HANDLES
+void stack_mark_heap_ids(void);
+#else
 bool_t stack_heap_id_in_use(heap_id_t id);
+#endif
 
 #endif // STACK_H
@@ -0,0 +1,814 @@
+//
+//  NanoVM, a tiny java VM for the Atmel AVR family
+//  Copyright (C) 2005 by Till Harbaum <Till@Harbaum.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+//
+//  jit.c
+//
+//  template jit for x86-64 hosts. Every method is translated into
+//  native code when it's called for the first time. The code is
+//  generated from the pre-decoded instructions built by nvmcode.c,
+//  one template per opcode. Simple instructions are expanded inline,
+//  everything else calls back into the runtime. The java stack stays
+//  in memory (it's the same stack vm_run() uses), so the garbage
+//  collector and the natives see it exactly as they do when the
+//  code is being interpreted.
+//
+//  register usage of the generated code:
+//    rbx  java stack pointer (points to the topmost element)
+//    r12  locals of the current method
+//
+//  a translated method is called like a c function with the locals
+//  and the stack pointer as arguments and returns the stack pointer
+//  of the caller (with the return value pushed, if any)
+//
+
+#include "types.h"
+#include "debug.h"
+#include "config.h"
+#include "error.h"
+
+#include "vm.h"
+#include "opcodes.h"
+#include "native_impl.h"
+#include "native.h"
+#include "heap.h"
+#include "nvmfile.h"
+#include "stack.h"
+#include "nvmcode.h"
+#include "unix/jit.h"
+
+#ifdef NVM_USE_ARRAY
+#include "array.h"
+#endif
+
+#ifdef NVM_USE_JIT
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#ifndef __x86_64__
+#error NVM_USE_JIT is only available on x86-64 hosts
+#endif
+
+// size of the executable buffer all methods are translated into
+#define JIT_CODE_SIZE  (64 * NVMFILE_SIZE)
+// upper bound of the code size of a single template
+#define JIT_INSN_MAX   48
+
+typedef nvm_stack_t *(*jit_func_t)(nvm_stack_t *locals, nvm_stack_t *sp);
+
+typedef struct {
+  u08_t *entry;             // start of the native code
+  nvmcode_insn_t *insns;    // pre-decoded code it has been built from
+  u08_t **addr;             // native code address of every instruction
+} jit_method_t;
+
+// branch to be resolved once all instructions have been translated
+typedef struct {
+  u08_t *pos;               // 32 bit displacement to be patched
+  u16_t target;             // index of the target instruction
+} jit_fixup_t;
+
+bool_t jit_enabled = FALSE;
+
+static u08_t *jit_buffer = NULL, *jit_ptr;
+static jit_method_t jit_methods[NVM_METHOD_TABLE_SIZE];
+
+// condition codes of the jcc instruction for eq, ne, lt, ge, gt, le
+static const u08_t jit_cond[] = { 0x84, 0x85, 0x8c, 0x8d, 0x8f, 0x8e };
+
+// ---------------------------------------------------------------------
+// code emitters
+
+#define JIT_EMIT(...) {						\
+    static const u08_t jit_tmpl[] = { __VA_ARGS__ };		\
+    jit_emit_bytes(jit_tmpl, sizeof(jit_tmpl));			\
+  }
+
+// frequently used instruction sequences
+#define JIT_POP_EAX()   JIT_EMIT(0x8b, 0x03, 0x48, 0x83, 0xeb, 0x04)
+#define JIT_PUSH_EAX()  JIT_EMIT(0x48, 0x83, 0xc3, 0x04, 0x89, 0x03)
+#ifdef NVM_USE_FULL_WORDS
+// ints use all 32 bits, there's nothing to mask or expand
+#define JIT_MASK_EAX()
+#define JIT_SHL1_EAX()
+#define JIT_SHL1_ECX()
+#define JIT_SEXT_EAX()
+#else
+#define JIT_MASK_EAX()  JIT_EMIT(0x25, 0xff, 0xff, 0xff, 0x7f)
+// expand 31 bit immediates (shifted left by one bit)
+#define JIT_SHL1_EAX()  JIT_EMIT(0xd1, 0xe0)
+#define JIT_SHL1_ECX()  JIT_EMIT(0xd1, 0xe1)
+#define JIT_SEXT_EAX()  JIT_EMIT(0xd1, 0xe0, 0xd1, 0xf8)
+#endif
+
+#define JIT_REG_EAX  0
+#define JIT_REG_ECX  1
+
+static void jit_emit_bytes(const u08_t *bytes, u08_t len) {
+  while(len--)
+    *jit_ptr++ = *bytes++;
+}
+
+static void jit_emit(u08_t byte) {
+  *jit_ptr++ = byte;
+}
+
+static void jit_emit32(u32_t val) {
+  u08_t i;
+  for(i=0;i<4;i++, val >>= 8)
+    jit_emit(val & 0xff);
+}
+
+static void jit_emit64(u64_t val) {
+  jit_emit32(val);
+  jit_emit32(val >> 32);
+}
+
+// mov reg,[r12+4*index] / mov [r12+4*index],reg
+static void jit_local(u08_t opcode, u08_t reg, u08_t index) {
+  jit_emit(0x41); jit_emit(opcode);
+  jit_emit(0x84 | (reg << 3)); jit_emit(0x24);
+  jit_emit32(index * sizeof(nvm_stack_t));
+}
+
+#define jit_load_local(reg, index)   jit_local(0x8b, reg, index)
+#define jit_store_local(reg, index)  jit_local(0x89, reg, index)
+
+static void jit_push_imm(nvm_stack_t val) {
+  JIT_EMIT(0x48, 0x83, 0xc3, 0x04);        // add rbx,4
+  jit_emit(0xc7); jit_emit(0x03);          // mov dword [rbx],val
+  jit_emit32(val);
+}
+
+// call fn(sp, arg), the returned value is the new stack pointer
+static void jit_call_helper(ptr_t fn, ptr_t arg) {
+  JIT_EMIT(0x48, 0x89, 0xdf);              // mov rdi,rbx
+  jit_emit(0x48); jit_emit(0xbe);          // mov rsi,arg
+  jit_emit64(arg);
+  jit_emit(0x48); jit_emit(0xb8);          // mov rax,fn
+  jit_emit64(fn);
+  JIT_EMIT(0xff, 0xd0,                     // call rax
+	   0x48, 0x89, 0xc3);              // mov rbx,rax
+}
+
+// jump (cond == 0) or conditional jump to instruction target
+static void jit_branch(u08_t cond, u16_t target,
+		       jit_fixup_t *fixup, u16_t *fixups) {
+  if(cond) { jit_emit(0x0f); jit_emit(cond); }
+  else       jit_emit(0xe9);
+
+  fixup[*fixups].pos = jit_ptr;
+  fixup[*fixups].target = target;
+  (*fixups)++;
+  jit_emit32(0);
+}
+
+// leave method with the stack pointer in rax
+static void jit_epilogue(void) {
+  JIT_EMIT(0x5d,                           // pop rbp
+	   0x41, 0x5c,                     // pop r12
+	   0x5b,                           // pop rbx
+	   0xc3);                          // ret
+}
+
+// ---------------------------------------------------------------------
+// runtime called by the generated code
+
+// instructions not worth a template of their own. They are
+// executed on the stack of the runtime just like vm_run() does
+static nvm_stack_t *jit_generic(nvm_stack_t *sp, nvmcode_insn_t *insn) {
+  nvm_int_t tmp1, tmp2;
+#ifdef NVM_USE_FLOAT
+  nvm_float_t f0, f1;
+#endif
+
+  stack_set_sp(sp);
+
+  switch(insn->op) {
+    case OP_IDIV:
+    case OP_IREM:
+      tmp1 = stack_pop_int(); tmp2 = stack_pop_int();
+      if(!tmp1) error(ERROR_VM_DIVISION_BY_ZERO);
+      stack_push(nvm_int2stack((insn->op == OP_IDIV)?
+			       nvm_int_div(tmp2, tmp1):nvm_int_rem(tmp2, tmp1)));
+      break;
+
+    case OP_GETSTATIC:
+      stack_push(stack_get_static(insn->arg));
+      break;
+
+    case OP_PUTSTATIC:
+      stack_set_static(insn->arg, stack_pop());
+      break;
+
+#ifdef NVM_USE_SUPERINSN
+    // the local has already been pushed
+    case OP_ILOAD_GETFIELD:
+      stack_push(((nvm_word_t*)heap_get_addr(stack_pop() & ~NVM_TYPE_MASK))
+		 [(u08_t)insn->arg]);
+      break;
+#endif
+
+    case OP_GETFIELD:
+      stack_push(((nvm_word_t*)heap_get_addr(stack_pop() & ~NVM_TYPE_MASK))
+		 [(s16_t)insn->arg]);
+      break;
+
+    case OP_PUTFIELD: {
+      heap_id_t obj;
+      nvm_word_t *field;
+      tmp1 = stack_pop();
+      obj = stack_pop() & ~NVM_TYPE_MASK;
+      field = (nvm_word_t*)heap_get_addr(obj) + (s16_t)insn->arg;
+      HEAP_WRITE_BARRIER(obj, *field, tmp1);
+      *field = tmp1;
+      break;
+    }
+
+    case OP_NEW:
+#ifdef NVM_USE_SCOPED_ALLOC
+    // objects are left to the garbage collector here
+    case OP_NEW_SCOPED:
+#endif
+      vm_new(insn->arg);
+      break;
+
+#ifdef NVM_USE_ARRAY
+    case OP_NEWARRAY:
+      stack_push(array_new(stack_pop(), (u08_t)(insn->arg >> 8)) | NVM_TYPE_HEAP);
+      break;
+
+    case OP_ARRAYLENGTH:
+      stack_push(array_length(stack_pop() & ~NVM_TYPE_MASK));
+      break;
+
+    case OP_BASTORE:
+      tmp2 = stack_pop_int(); tmp1 = stack_pop_int();
+      array_bastore(stack_pop() & ~NVM_TYPE_MASK, tmp1, tmp2);
+      break;
+
+    case OP_IASTORE:
+      tmp2 = stack_pop_int(); tmp1 = stack_pop_int();
+      array_iastore(stack_pop() & ~NVM_TYPE_MASK, tmp1, tmp2);
+      break;
+
+    case OP_BALOAD:
+      tmp1 = stack_pop_int();
+      stack_push(array_baload(stack_pop() & ~NVM_TYPE_MASK, tmp1));
+      break;
+
+    case OP_IALOAD:
+      tmp1 = stack_pop_int();
+      stack_push(array_iaload(stack_pop() & ~NVM_TYPE_MASK, tmp1));
+      break;
+
+    case OP_CASTORE:
+    case OP_SASTORE:
+      tmp2 = stack_pop_int(); tmp1 = stack_pop_int();
+      array_sastore(stack_pop() & ~NVM_TYPE_MASK, tmp1, tmp2);
+      break;
+
+    case OP_CALOAD:
+      tmp1 = stack_pop_int();
+      stack_push(array_caload(stack_pop() & ~NVM_TYPE_MASK, tmp1));
+      break;
+
+    case OP_SALOAD:
+      tmp1 = stack_pop_int();
+      stack_push(array_saload(stack_pop() & ~NVM_TYPE_MASK, tmp1));
+      break;
+#endif
+
+#ifdef NVM_USE_OBJ_ARRAY
+    case OP_ANEWARRAY:
+      stack_push(array_new(stack_pop(), T_OBJECT) | NVM_TYPE_HEAP);
+      break;
+
+    case OP_AASTORE:
+      tmp2 = stack_pop_int(); tmp1 = stack_pop_int();
+      array_aastore(stack_pop() & ~NVM_TYPE_MASK, tmp1, tmp2);
+      break;
+
+    case OP_AALOAD:
+      tmp1 = stack_pop_int();
+      stack_push(array_iaload(stack_pop() & ~NVM_TYPE_MASK, tmp1));
+      break;
+
+    case OP_MULTIANEWARRAY:
+      array_new_multi((u08_t)(insn->arg >> 8), (u08_t)insn->arg);
+      break;
+#endif
+
+#ifdef NVM_USE_FLAT_ARRAYS
+    case OP_ARRAYLOAD_2D:
+      tmp2 = stack_pop_int(); tmp1 = stack_pop_int();
+      stack_push(array_load2(stack_pop() & ~NVM_TYPE_MASK, tmp1, tmp2));
+      break;
+
+    case OP_ARRAYSTORE_2D:
+      array_store2(stack_peek(3) & ~NVM_TYPE_MASK, stack_peek_int(2),
+		   stack_peek_int(1), stack_peek(0));
+      stack_add_sp(-4);
+      break;
+#endif
+
+#ifdef NVM_USE_FLOAT
+# ifdef NVM_USE_ARRAY
+    case OP_FALOAD:
+      tmp1 = stack_pop_int();
+      stack_push(nvm_float2stack(array_faload(stack_pop() & ~NVM_TYPE_MASK, tmp1)));
+      break;
+
+    case OP_FASTORE:
+      f0 = stack_pop_float(); tmp1 = stack_pop_int();
+      array_fastore(stack_pop() & ~NVM_TYPE_MASK, tmp1, f0);
+      break;
+# endif
+
+    case OP_FCONST_0: case OP_FCONST_1: case OP_FCONST_2:
+      stack_push(nvm_float2stack(insn->op - OP_FCONST_0));
+      break;
+
+    case OP_FNEG:
+      stack_push(nvm_float2stack(-stack_pop_float()));
+      break;
+
+    case OP_FADD: case OP_FSUB: case OP_FMUL: case OP_FDIV:
+      f0 = stack_pop_float(); f1 = stack_pop_float();
+      switch(insn->op) {
+        case OP_FADD: f1 += f0; break;
+        case OP_FSUB: f1 -= f0; break;
+        case OP_FMUL: f1 *= f0; break;
+        default:
+	  if(!f0) error(ERROR_VM_DIVISION_BY_ZERO);
+	  f1 /= f0;
+	  break;
+      }
+      stack_push(nvm_float2stack(f1));
+      break;
+
+    case OP_I2F:
+      stack_push(nvm_float2stack(stack_pop_int()));
+      break;
+
+    case OP_F2I:
+      tmp1 = stack_pop_float();
+      stack_push(nvm_int2stack(tmp1));
+      break;
+
+    case OP_FCMPL: case OP_FCMPG:
+      f1 = stack_pop_float(); f0 = stack_pop_float();
+      stack_push(nvm_int2stack((f0 < f1)?-1:(f0 > f1)?1:0));
+      break;
+#endif
+
+#ifdef NVM_USE_EXTSTACKOPS
+    case OP_DUP_X1: case OP_DUP_X2:
+    case OP_DUP2_X1: case OP_DUP2_X2: case OP_SWAP: {
+      nvm_stack_t w1 = stack_pop();
+      nvm_stack_t w2 = stack_pop();
+      nvm_stack_t w3 = 0, w4 = 0;
+
+      if(insn->op == OP_SWAP) {
+	stack_push(w1);
+	stack_push(w2);
+	break;
+      }
+
+      if(insn->op != OP_DUP_X1) w3 = stack_pop();
+      if(insn->op == OP_DUP2_X2) w4 = stack_pop();
+
+      // the same (not quite jvm conforming) order vm_run() uses
+      stack_push(w1);
+      stack_push(w2);
+      if(insn->op != OP_DUP_X1) stack_push(w3);
+      if(insn->op == OP_DUP2_X2) stack_push(w4);
+      stack_push(w1);
+      if((insn->op == OP_DUP2_X1) || (insn->op == OP_DUP2_X2)) stack_push(w2);
+      break;
+    }
+#endif
+
+    default:
+      error(ERROR_VM_UNSUPPORTED_OPCODE);
+  }
+
+  return stack_get_sp();
+}
+
+static nvm_stack_t *jit_call(u08_t index, nvm_stack_t *locals);
+
+// method invocation, native methods are called directly
+static nvm_stack_t *jit_invoke(nvm_stack_t *sp, u16_t mref, u08_t op) {
+  nvm_method_t *method;
+  u16_t steal;
+
+  stack_set_sp(sp);
+
+  if(NATIVE_ID2CLASS(mref) >= NATIVE_CLASS_BASE) {
+    native_invoke(mref);
+    return stack_get_sp();
+  }
+
+  method = nvmfile_get_method(mref);
+
+#ifdef NVM_USE_INHERITANCE
+  // the class of the object on the stack may be derived from
+  // the one the method was resolved for
+  if(op == OP_INVOKEVIRTUAL) {
+    u08_t class = heap_get_class(sp[1-method->args] & ~NVM_TYPE_MASK);
+
+    if(class != NATIVE_ID2CLASS(method->id)) {
+      mref = nvmfile_get_method_by_class_and_id(
+	class, NATIVE_ID2METHOD(method->id));
+      method = nvmfile_get_method(mref);
+    }
+  }
+#endif
+
+  // same stack space vm_run() uses except for the return info
+  // which is kept on the native stack
+  steal = sizeof(nvm_stack_t) *
+    (method->max_locals + method->max_stack + method->args);
+  heap_steal(steal);
+
+  // the arguments on the stack become the first locals
+  sp = jit_call(mref, sp + 1 - method->args);
+
+  heap_unsteal(steal);
+  return sp;
+}
+
+#if defined(NVM_USE_TABLESWITCH) || defined(NVM_USE_LOOKUPSWITCH)
+// switch instructions return the address to continue at
+static u08_t *jit_switch(nvm_stack_t val, nvmcode_insn_t *insn,
+			 jit_method_t *m) {
+  nvm_int_t key = nvm_stack2int(val);
+  nvmcode_insn_t *dst;
+
+#ifdef NVM_USE_TABLESWITCH
+  if(insn->op == OP_TABLESWITCH) {
+    nvmcode_tableswitch_t *t = insn->target;
+    dst = ((key < t->low)||(key > t->high))?t->def:t->target[key - t->low];
+    return m->addr[dst - m->insns];
+  }
+#endif
+
+  dst = nvmcode_lookup(insn->target, key);
+
+  return m->addr[dst - m->insns];
+}
+#endif
+
+// ---------------------------------------------------------------------
+// translation
+
+static void jit_compile(u08_t index) {
+  jit_method_t *m = jit_methods + index;
+  nvm_method_t *method = nvmfile_get_method(index);
+  nvmcode_insn_t *insn;
+  jit_fixup_t *fixup;
+  u16_t cnt, i, fixups = 0;
+  u08_t op, arg_h, arg_l;
+
+  if(!jit_buffer) {
+    jit_buffer = mmap(NULL, JIT_CODE_SIZE, PROT_READ|PROT_WRITE|PROT_EXEC,
+		      MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(jit_buffer == MAP_FAILED) error(ERROR_HEAP_OUT_OF_MEMORY);
+    jit_ptr = jit_buffer;
+  }
+
+  // the pre-decoded code ends with an illegal instruction all
+  // unresolvable branches lead to. It's translated as well
+  m->insns = method->code;
+  for(cnt=0;m->insns[cnt].op != NVMCODE_OP_ILLEGAL;cnt++);
+
+  m->addr = malloc((cnt+1) * sizeof(u08_t*));
+  fixup = malloc((cnt+1) * sizeof(jit_fixup_t));
+  if(!m->addr || !fixup) error(ERROR_HEAP_OUT_OF_MEMORY);
+
+  DEBUGF("jit: method %d, %d instructions\n", index, cnt);
+
+  m->entry = jit_ptr;
+  JIT_EMIT(0x53,                           // push rbx
+	   0x41, 0x54,                     // push r12
+	   0x55,                           // push rbp (stack alignment)
+	   0x49, 0x89, 0xfc,               // mov r12,rdi
+	   0x48, 0x89, 0xf3);              // mov rbx,rsi
+
+  for(i=0;i<=cnt;i++) {
+    insn = m->insns + i;
+    op = insn->op;
+    arg_h = insn->arg >> 8;
+    arg_l = insn->arg;
+
+    if(jit_ptr + JIT_INSN_MAX > jit_buffer + JIT_CODE_SIZE)
+      error(ERROR_HEAP_OUT_OF_MEMORY);
+
+    m->addr[i] = jit_ptr;
+
+    switch(op) {
+      case OP_NOP:
+	break;
+
+      case OP_ICONST_M1: case OP_ICONST_0: case OP_ICONST_1:
+      case OP_ICONST_2: case OP_ICONST_3: case OP_ICONST_4:
+      case OP_ICONST_5:
+	jit_push_imm((nvm_int_t)op - OP_ICONST_0);
+	break;
+
+      case OP_BIPUSH:
+	jit_push_imm((s08_t)arg_h);
+	break;
+
+      case OP_SIPUSH:
+	jit_push_imm(nvm_int2stack((s16_t)insn->arg));
+	break;
+
+      case OP_LDC:
+	jit_push_imm(insn->arg);
+	break;
+
+      case OP_ILOAD: case OP_FLOAD:
+	jit_load_local(JIT_REG_EAX, arg_h);
+	JIT_PUSH_EAX();
+	break;
+
+      case OP_ILOAD_0: case OP_ILOAD_1: case OP_ILOAD_2: case OP_ILOAD_3:
+	jit_load_local(JIT_REG_EAX, op - OP_ILOAD_0);
+	JIT_PUSH_EAX();
+	break;
+
+      case OP_ISTORE: case OP_FSTORE:
+	JIT_POP_EAX();
+	jit_store_local(JIT_REG_EAX, arg_h);
+	break;
+
+      case OP_ISTORE_0: case OP_ISTORE_1: case OP_ISTORE_2: case OP_ISTORE_3:
+	JIT_POP_EAX();
+	jit_store_local(JIT_REG_EAX, op - OP_ISTORE_0);
+	break;
+
+#ifdef NVM_USE_FLOAT
+      case OP_FLOAD_0: case OP_FLOAD_1: case OP_FLOAD_2: case OP_FLOAD_3:
+	jit_load_local(JIT_REG_EAX, op - OP_FLOAD_0);
+	JIT_PUSH_EAX();
+	break;
+
+      case OP_FSTORE_0: case OP_FSTORE_1: case OP_FSTORE_2: case OP_FSTORE_3:
+	JIT_POP_EAX();
+	jit_store_local(JIT_REG_EAX, op - OP_FSTORE_0);
+	break;
+#endif
+
+      case OP_IINC:
+#ifdef NVM_USE_SUPERINSN
+      case OP_IINC_GOTO:
+#endif
+	jit_load_local(JIT_REG_EAX, arg_h);
+	jit_emit(0x05); jit_emit32((s08_t)arg_l);   // add eax,const
+	JIT_MASK_EAX();
+	jit_store_local(JIT_REG_EAX, arg_h);
+#ifdef NVM_USE_SUPERINSN
+	if(op == OP_IINC_GOTO)
+	  jit_branch(0, (nvmcode_insn_t*)insn->target - m->insns,
+		     fixup, &fixups);
+#endif
+	break;
+
+      // the lower 31 bits of the result only depend on the lower
+      // 31 bits of the operands
+      case OP_IADD: case OP_ISUB: case OP_IMUL:
+      case OP_IAND: case OP_IOR: case OP_IXOR:
+      case OP_ISHL: case OP_ISHR: case OP_IUSHR:
+	JIT_EMIT(0x8b, 0x0b,               // mov ecx,[rbx]
+		 0x48, 0x83, 0xeb, 0x04,   // sub rbx,4
+		 0x8b, 0x03);              // mov eax,[rbx]
+	switch(op) {
+	  case OP_IADD: JIT_EMIT(0x01, 0xc8); break;        // add eax,ecx
+	  case OP_ISUB: JIT_EMIT(0x29, 0xc8); break;        // sub eax,ecx
+	  case OP_IMUL: JIT_EMIT(0x0f, 0xaf, 0xc1); break;  // imul eax,ecx
+	  case OP_IAND: JIT_EMIT(0x21, 0xc8); break;        // and eax,ecx
+	  case OP_IOR:  JIT_EMIT(0x09, 0xc8); break;        // or eax,ecx
+	  case OP_IXOR: JIT_EMIT(0x31, 0xc8); break;        // xor eax,ecx
+	  case OP_ISHL: JIT_EMIT(0xd3, 0xe0); break;        // shl eax,cl
+	  case OP_ISHR:
+	    JIT_SEXT_EAX();
+	    JIT_EMIT(0xd3, 0xf8);                            // sar eax,cl
+	    break;
+	  case OP_IUSHR:
+	    JIT_SEXT_EAX();
+	    JIT_EMIT(0xd3, 0xe8);                            // shr eax,cl
+	    break;
+	}
+	JIT_MASK_EAX();
+	JIT_EMIT(0x89, 0x03);              // mov [rbx],eax
+	break;
+
+      case OP_INEG:
+	JIT_EMIT(0x8b, 0x03,               // mov eax,[rbx]
+		 0xf7, 0xd8);              // neg eax
+	JIT_MASK_EAX();
+	JIT_EMIT(0x89, 0x03);              // mov [rbx],eax
+	break;
+
+      // comparisons are done on the 31 bit values shifted left by one
+      // (unless ints use full words)
+      case OP_IFEQ: case OP_IFNE: case OP_IFLT:
+      case OP_IFGE: case OP_IFGT: case OP_IFLE:
+	JIT_POP_EAX();
+	JIT_SHL1_EAX();
+	JIT_EMIT(0x83, 0xf8, 0x00);        // cmp eax,0
+	jit_branch(jit_cond[op - OP_IFEQ],
+		   (nvmcode_insn_t*)insn->target - m->insns, fixup, &fixups);
+	break;
+
+      case OP_IF_ICMPEQ: case OP_IF_ICMPNE: case OP_IF_ICMPLT:
+      case OP_IF_ICMPGE: case OP_IF_ICMPGT: case OP_IF_ICMPLE:
+	JIT_EMIT(0x8b, 0x43, 0xfc,         // mov eax,[rbx-4]
+		 0x8b, 0x0b,               // mov ecx,[rbx]
+		 0x48, 0x83, 0xeb, 0x08);  // sub rbx,8
+	JIT_SHL1_EAX();
+	JIT_SHL1_ECX();
+	JIT_EMIT(0x39, 0xc8);              // cmp eax,ecx
+	jit_branch(jit_cond[op - OP_IF_ICMPEQ],
+		   (nvmcode_insn_t*)insn->target - m->insns, fixup, &fixups);
+	break;
+
+#ifdef NVM_USE_SUPERINSN
+      case OP_ILOAD_ILOAD_IF_ICMPEQ: case OP_ILOAD_ILOAD_IF_ICMPNE:
+      case OP_ILOAD_ILOAD_IF_ICMPLT: case OP_ILOAD_ILOAD_IF_ICMPGE:
+      case OP_ILOAD_ILOAD_IF_ICMPGT: case OP_ILOAD_ILOAD_IF_ICMPLE:
+	jit_load_local(JIT_REG_EAX, arg_h);
+	jit_load_local(JIT_REG_ECX, arg_l);
+	JIT_SHL1_EAX();
+	JIT_SHL1_ECX();
+	JIT_EMIT(0x39, 0xc8);              // cmp eax,ecx
+	jit_branch(jit_cond[op - OP_ILOAD_ILOAD_IF_ICMPEQ],
+		   (nvmcode_insn_t*)insn->target - m->insns, fixup, &fixups);
+	break;
+
+      case OP_ILOAD_ICONST_IADD_ISTORE:
+	jit_load_local(JIT_REG_EAX, arg_h >> 4);
+	jit_emit(0x05); jit_emit32((s08_t)arg_l);   // add eax,const
+	JIT_MASK_EAX();
+	jit_store_local(JIT_REG_EAX, arg_h & 0x0f);
+	break;
+
+      case OP_ILOAD_GETFIELD:
+	jit_load_local(JIT_REG_EAX, arg_h);
+	JIT_PUSH_EAX();
+	jit_call_helper((ptr_t)jit_generic, (ptr_t)insn);
+	break;
+#endif
+
+      case OP_GOTO:
+	jit_branch(0, (nvmcode_insn_t*)insn->target - m->insns,
+		   fixup, &fixups);
+	break;
+
+#if defined(NVM_USE_TABLESWITCH) || defined(NVM_USE_LOOKUPSWITCH)
+#ifdef NVM_USE_TABLESWITCH
+      case OP_TABLESWITCH:
+#endif
+#ifdef NVM_USE_LOOKUPSWITCH
+      case OP_LOOKUPSWITCH:
+#endif
+	JIT_EMIT(0x8b, 0x3b,               // mov edi,[rbx]
+		 0x48, 0x83, 0xeb, 0x04);  // sub rbx,4
+	jit_emit(0x48); jit_emit(0xbe);    // mov rsi,insn
+	jit_emit64((ptr_t)insn);
+	jit_emit(0x48); jit_emit(0xba);    // mov rdx,m
+	jit_emit64((ptr_t)m);
+	jit_emit(0x48); jit_emit(0xb8);    // mov rax,jit_switch
+	jit_emit64((ptr_t)jit_switch);
+	JIT_EMIT(0xff, 0xd0,               // call rax
+		 0xff, 0xe0);              // jmp rax
+	break;
+#endif
+
+      case OP_POP:
+	JIT_EMIT(0x48, 0x83, 0xeb, 0x04);  // sub rbx,4
+	break;
+
+      case OP_POP2:
+	JIT_EMIT(0x48, 0x83, 0xeb, 0x08);  // sub rbx,8
+	break;
+
+      case OP_DUP:
+	JIT_EMIT(0x8b, 0x03);              // mov eax,[rbx]
+	JIT_PUSH_EAX();
+	break;
+
+      case OP_DUP2:
+	JIT_EMIT(0x48, 0x8b, 0x43, 0xfc,   // mov rax,[rbx-4]
+		 0x48, 0x83, 0xc3, 0x08,   // add rbx,8
+		 0x48, 0x89, 0x43, 0xfc);  // mov [rbx-4],rax
+	break;
+
+      // like vm_run() the stack is assumed to only contain the
+      // locals when returning
+      case OP_IRETURN:
+#ifdef NVM_USE_FLOAT
+      case OP_FRETURN:
+#endif
+	JIT_EMIT(0x8b, 0x0b);              // mov ecx,[rbx]
+	JIT_EMIT(0x48, 0x8d, 0x83);        // lea rax,[rbx-4*max_locals]
+	jit_emit32(-(s32_t)sizeof(nvm_stack_t) * method->max_locals);
+	JIT_EMIT(0x89, 0x08);              // mov [rax],ecx
+	jit_epilogue();
+	break;
+
+      case OP_RETURN:
+	JIT_EMIT(0x48, 0x8d, 0x83);        // lea rax,[rbx-4*max_locals]
+	jit_emit32(-(s32_t)sizeof(nvm_stack_t) * method->max_locals);
+	jit_epilogue();
+	break;
+
+      case OP_INVOKEVIRTUAL: case OP_INVOKESPECIAL: case OP_INVOKESTATIC:
+	JIT_EMIT(0x48, 0x89, 0xdf);        // mov rdi,rbx
+	jit_emit(0xbe);                    // mov esi,mref
+	jit_emit32((u16_t)insn->arg);
+	jit_emit(0xba);                    // mov edx,op
+	jit_emit32(op);
+	jit_emit(0x48); jit_emit(0xb8);    // mov rax,jit_invoke
+	jit_emit64((ptr_t)jit_invoke);
+	JIT_EMIT(0xff, 0xd0,               // call rax
+		 0x48, 0x89, 0xc3);        // mov rbx,rax
+	break;
+
+      default:
+	jit_call_helper((ptr_t)jit_generic, (ptr_t)insn);
+	break;
+    }
+  }
+
+  // resolve branch targets
+  for(i=0;i<fixups;i++) {
+    s32_t rel = m->addr[fixup[i].target] - (fixup[i].pos + 4);
+    u08_t *pos = jit_ptr;
+
+    jit_ptr = fixup[i].pos;
+    jit_emit32(rel);
+    jit_ptr = pos;
+  }
+
+  free(fixup);
+
+  DEBUGF("jit: method %d translated into %d bytes\n",
+	 index, (int)(jit_ptr - m->entry));
+}
+
+// run translated method with the given locals and return the
+// resulting stack pointer
+static nvm_stack_t *jit_call(u08_t index, nvm_stack_t *locals) {
+  nvm_method_t *method = nvmfile_get_method(index);
+  union { u08_t *code; jit_func_t func; } entry;
+
+  if(!jit_methods[index].entry)
+    jit_compile(index);
+
+  entry.code = jit_methods[index].entry;
+  return entry.func(locals, locals + method->max_locals - 1);
+}
+
+void jit_run(u16_t mref) {
+  nvm_method_t *method = nvmfile_get_method(mref);
+  u16_t steal = sizeof(nvm_stack_t) *
+    (method->max_locals + method->max_stack + method->args);
+
+#ifdef NVM_USE_STACK_CHECK
+  stack_save_sp();
+#endif
+
+  DEBUGF("Running method %d (jit)\n", mref);
+
+  // same setup vm_run() does
+  heap_steal(steal);
+  stack_set_sp(jit_call(mref, stack_get_sp() + 1));
+
+#ifdef NVM_USE_STACK_CHECK
+  stack_verify_sp();
+#endif
+
+  heap_unsteal(steal);
+}
+
+#endif // NVM_USE_JIT
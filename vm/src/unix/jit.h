@@ -0,0 +1,49 @@
+//
+//  NanoVM, a tiny java VM for the Atmel AVR family
+//  Copyright (C) 2005 by Till Harbaum <Till@Harbaum.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+//
+//  jit.h
+//
+//  x86-64 template jit of the unix runtime
+//
+
+#ifndef JIT_H
+#define JIT_H
+
+#include "types.h"
+#include "config.h"
+
+#ifdef NVM_USE_JIT
+
+#ifndef NVM_USE_PREDECODE
+#error NVM_USE_JIT requires NVM_USE_PREDECODE
+#endif
+
+#ifndef NVM_USE_32BIT_WORD
+#error NVM_USE_JIT requires NVM_USE_32BIT_WORD
+#endif
+
+// run methods as native code instead of interpreting them (-j)
+extern bool_t jit_enabled;
+
+void jit_run(u16_t mref);
+
+#endif // NVM_USE_JIT
+
+#endif // JIT_H
@@ -17,7 +17,7 @@
 //  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 // 
 
-static inline void utils_memcpy(void *dst, void *src, u16_t len) {
+static inline void utils_memcpy(void *dst, void *src, ptr_t len) {
   u08_t *dst8 = (u08_t*)dst;
   u08_t *src8 = (u08_t*)src;
 
@@ -26,8 +26,8 @@ static inline void utils_memcpy(void *dst, void *src, u16_t len) {
 }
 
 /* string len ram */
-static inline u16_t utils_strlen(char *str) {
-  u16_t len=0;
+static inline ptr_t utils_strlen(char *str) {
+  ptr_t len=0;
 
   while(*str++) len++;
   return len;
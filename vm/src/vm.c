@@ -36,11 +36,17 @@
 #include "nvmfile.h"
 #include "stack.h"
 #include "nvmfeatures.h"
+#include "nvmcode.h"
+#include "nvmaot.h"
 
 #ifdef NVM_USE_ARRAY
 #include "array.h"
 #endif
 
+#ifdef NVM_USE_JIT
+#include "unix/jit.h"
+#endif
+
 #ifdef NVM_USE_32BIT_WORD
 # define DBG_INT "0x" DBG32
 #else
@@ -48,6 +54,53 @@
 #endif
 
 
+#ifdef NVM_USE_INLINE_CACHE
+// cache of the methods invokevirtual resolved for a receiver class,
+// indexed by call site. A call site seeing different receiver classes
+// uses different entries (as long as they don't collide)
+typedef struct {
+  u16_t pos;          // call site: offset within calling method
+  u08_t caller;       // call site: calling method
+  u08_t class;        // receiver class
+  u08_t method;       // method to be invoked
+} vm_icache_t;
+
+static vm_icache_t vm_icache[NVM_INLINE_CACHE_SIZE];
+u32_t vm_icache_hits, vm_icache_misses;
+
+static void vm_icache_init(void) {
+  u16_t i;
+
+  // there are no classes with this id
+  for(i=0;i<NVM_INLINE_CACHE_SIZE;i++)
+    vm_icache[i].class = 0xff;
+
+  vm_icache_hits = vm_icache_misses = 0;
+}
+
+static u08_t vm_icache_resolve(u08_t caller, u16_t pos, u08_t class, u08_t id) {
+  vm_icache_t *entry = vm_icache +
+    ((pos ^ (caller << 4) ^ class) & (NVM_INLINE_CACHE_SIZE-1));
+
+  if((entry->class == class) && (entry->pos == pos) &&
+     (entry->caller == caller)) {
+    DEBUGF("inline cache hit\n");
+    vm_icache_hits++;
+    return entry->method;
+  }
+
+  DEBUGF("inline cache miss\n");
+  vm_icache_misses++;
+
+  entry->pos = pos;
+  entry->caller = caller;
+  entry->class = class;
+  entry->method = nvmfile_get_method_by_class_and_id(class, id);
+
+  return entry->method;
+}
+#endif
+
 void vm_init(void) {
   DEBUGF("vm_init() with %d static fields\n", nvmfile_get_static_fields());
 
@@ -58,6 +111,10 @@ void vm_init(void) {
   stack_init(nvmfile_get_static_fields());
  
   stack_push(0); // args parameter to main (should be a string array)
+
+#ifdef NVM_USE_INLINE_CACHE
+  vm_icache_init();
+#endif
 }
 
 void *vm_get_addr(nvm_ref_t ref) {
@@ -73,6 +130,7 @@ void *vm_get_addr(nvm_ref_t ref) {
   return NVMFILE_SET(nvmfile_get_addr(ref & ~NVM_TYPE_MASK));
 }
 
+#ifndef NVM_USE_FULL_WORDS
 // expand 15 bit immediate to 16 bits (or 31 to 32)
 nvm_int_t nvm_stack2int(nvm_stack_t val) {
   if(val & (NVM_IMMEDIATE_MASK>>1))
@@ -113,6 +171,7 @@ nvm_float_t nvm_stack2float(nvm_stack_t val)
   return v.f[0];
 }
 #endif
+#endif
 
 
 nvm_stack_t *locals;
@@ -120,6 +179,12 @@ nvm_stack_t *locals;
 // pc/methodref/localsoffset
 #define VM_METHOD_CALL_REQUIREMENTS 3
 
+#ifdef NVM_USE_SCOPED_ALLOC
+// the running method as owner of scoped objects. Methods called
+// later have their locals further up the stack
+#define VM_SCOPE_OWNER()  ((heap_size_t)(locals - (nvm_stack_t*)heap_get_base()))
+#endif
+
 // create an instance of a class. check if it's local (within 
 // the nvm file) or native (implemented by the runtime environment)
 void vm_new(u16_t mref) {
@@ -130,21 +195,78 @@ void vm_new(u16_t mref) {
     DEBUGF("non static fields: %d\n",
        nvmfile_get_class_fields(NATIVE_ID2CLASS(mref)));
 
-    // create object with
-    heap_id_t h = heap_alloc(TRUE, sizeof(nvm_word_t) *
-     (VM_CLASS_CONST_ALLOC+nvmfile_get_class_fields(NATIVE_ID2CLASS(mref))));
+    // the heap keeps the class of the object, this is required for
+    // inheritance
+    stack_push(NVM_TYPE_HEAP | heap_alloc_object(NATIVE_ID2CLASS(mref)));
+    return;
+  }
+
+  native_new(mref);
+}
+
+#ifdef NVM_USE_AOT
+// run the compiled version of a method. Like with the interpreter
+// the args on top of the stack become the first locals of the method
+// and are replaced by its return value (if any)
+static void vm_aot_call(nvm_method_t *method) {
+  nvm_stack_t *aot_locals, ret = 0;
+  u08_t has_ret;
+
+  DEBUGF("compiled call of method with %d local(s) and %d "
+	 "stack elements - %d args\n",
+	 method->max_locals, method->max_stack, method->args);
+
+  stack_add_sp(-method->args);
+  aot_locals = stack_get_sp() + 1;
+
+  heap_steal(sizeof(nvm_stack_t) *
+	     (method->max_locals + method->max_stack + method->args));
+  stack_add_sp(method->max_locals);
+
+  has_ret = method->aot(aot_locals);
+  if(has_ret)
+    ret = stack_pop();
 
-    stack_push(NVM_TYPE_HEAP | h);
+  // remove locals from stack and give memory back to heap
+  stack_add_sp(-method->max_locals);
+  heap_unsteal(sizeof(nvm_stack_t) *
+	       (method->max_locals + method->max_stack + method->args));
 
-    // store reference in object, so we can later determine which kind
-    // of object this is. this is required for inheritance
-    ((nvm_ref_t*)heap_get_addr(h))[0] = mref;
+  if(has_ret)
+    stack_push(ret);
+}
+
+// invoke from within compiled code. Everything reachable from a
+// compiled method has been compiled as well
+void nvm_aot_invoke(u16_t mref, bool_t virtual_call) {
+  nvm_method_t *method;
 
+  if(NATIVE_ID2CLASS(mref) >= NATIVE_CLASS_BASE) {
+    native_invoke(mref);
     return;
   }
 
-  native_new(mref);
+  method = nvmfile_get_method(mref);
+
+#ifdef NVM_USE_INHERITANCE
+  // the object may be of a subclass overriding the method
+  if(virtual_call) {
+    u08_t class = heap_get_class(stack_peek(method->args-1) & ~NVM_TYPE_MASK);
+
+    if(class != NATIVE_ID2CLASS(method->id))
+      method = nvmfile_get_method(nvmfile_get_method_by_class_and_id(
+	class, NATIVE_ID2METHOD(method->id)));
+  }
+#else
+  (void)virtual_call;
+#endif
+
+  if(!method->aot)
+    error(ERROR_VM_UNSUPPORTED_OPCODE);
+
+  vm_aot_call(method);
 }
+#endif
 
 // we prefetch arguments from the program storage
 // and this is the type it is stored into
@@ -157,119 +279,346 @@ typedef union {
   nvm_int_t tmp;
 } vm_arg_t;
 
+// The interpreter dispatches each opcode directly to its handler
+// instead of walking a chain of compares. With gcc on a hosted
+// system this is done using computed gotos through a 256 entry
+// label table (every handler jumps straight to the next one).
+// Everywhere else (e.g. on the AVR) a dense switch statement is
+// used which the compiler translates into a jump table as well.
+
+#ifdef NVM_USE_PREDECODE
+// the interpreter runs on the pre-decoded ram copy of the code
+// built by nvmcode_init(), pc points to the current instruction
+typedef nvmcode_insn_t vm_pc_t;
+
+// fetch next instruction and its already resolved args
+#define VM_FETCH() {                                         \
+    instr = pc->op;                                          \
+    DEBUGF("%d/(sp:%d) - "DBG8" (%d): ", pc->offset,         \
+	   VM_STACK_DEPTH(), instr, instr);                  \
+    arg0.tmp = pc->arg;                                      \
+  }
+
+# define VM_PC_STEP(inc)    1
+# define VM_PC_BRANCH()     ((vm_pc_t*)pc->target)
+# define VM_PC_BRANCH_AT(n) ((vm_pc_t*)pc->target)
+#else
+// the interpreter runs directly on the bytecode in the nvm file
+typedef u08_t vm_pc_t;
+
+// fetch next instruction and prefetch its args (in big endian order)
+#define VM_FETCH() {                                         \
+    instr = nvmfile_read08(pc);                              \
+    DEBUGF("%d/(sp:%d) - "DBG8" (%d): ",                     \
+	   pc - VM_PC_BASE(),                                \
+	   VM_STACK_DEPTH(), instr, instr);                  \
+    arg0.z.bh = nvmfile_read08(pc+1);                        \
+    arg0.z.bl = nvmfile_read08(pc+2);                        \
+  }
+
+# define VM_PC_STEP(inc)    (inc)
+# define VM_PC_BRANCH()     (pc + arg0.w)
+// branch of an instruction with the offset at byte n of it
+# define VM_PC_BRANCH_AT(n) (pc + (s16_t)((nvmfile_read08(pc+(n)) << 8) | \
+					  nvmfile_read08(pc+(n)+1)))
+#endif
+
+// start of the code of the current method
+#define VM_PC_BASE()    ((vm_pc_t*)method->code)
+
+#ifdef NVM_USE_COMPUTED_GOTO
+# define VM_DISPATCH()  goto *vm_dispatch_table[instr];
+# define VM_CASE(op)    vm_##op:
+# define VM_DEFAULT     vm_unsupported:
+// continue at dst and jump to the next handler
+# define VM_GOTO(dst)   { pc = (dst); VM_FETCH(); VM_DISPATCH(); }
+// computed gotos and label ranges are gcc extensions
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wpedantic"
+#else
+# define VM_DISPATCH()  switch(instr)
+# define VM_CASE(op)    case op:
+# define VM_DEFAULT     default:
+// continue at dst and go back to the switch statement
+# define VM_GOTO(dst)   { pc = (dst); continue; }
+#endif
+
+// advance pc by an instruction of inc bytes
+#define VM_NEXT(inc)    VM_GOTO(pc + VM_PC_STEP(inc))
+// take the branch of the current instruction
+#define VM_BRANCH()     VM_GOTO(VM_PC_BRANCH())
+
+#ifdef NVM_USE_CACHED_STACK
+// vm_run() keeps the stack pointer and the topmost stack element in
+// local variables (vm_sp points to the element below vm_tos). They
+// are written back to the stack before anything outside vm_run()
+// looks at the stack (method invocation and return, natives and
+// allocations which may run the garbage collector) and reloaded
+// afterwards
+# define VM_STACK_LOAD()  { vm_sp = stack_get_sp(); vm_tos = *vm_sp--; }
+# define VM_STACK_SAVE()  { vm_sp[1] = vm_tos; stack_set_sp(vm_sp+1); }
+# define VM_PUSH(val)     { nvm_stack_t vm_val = (val); *(++vm_sp) = vm_tos; vm_tos = vm_val; }
+# define VM_POP()         (vm_tmp = vm_tos, vm_tos = *vm_sp--, vm_tmp)
+# define VM_DROP(n)       { vm_tos = vm_sp[1-(n)]; vm_sp -= (n); }
+# define VM_PEEK(i)       ((i)?vm_sp[1-(i)]:vm_tos)
+# define VM_STACK_DEPTH() (stack_get_depth() + (vm_sp + 1 - stack_get_sp()))
+// with an empty stack vm_tos is a copy of the element below the
+// stack base. A guard element keeps this from being one of the locals
+// of the method vm_run() was called for
+# define VM_STACK_GUARD   1
+#else
+# define VM_STACK_LOAD()
+# define VM_STACK_SAVE()
+# define VM_PUSH(val)     stack_push(val)
+# define VM_POP()         stack_pop()
+# define VM_DROP(n)       stack_add_sp(-(n))
+# define VM_PEEK(i)       stack_peek(i)
+# define VM_STACK_DEPTH() stack_get_depth()
+# define VM_STACK_GUARD   0
+#endif
+
+#define VM_POP_INT()      nvm_stack2int(VM_POP())
+#define VM_PEEK_INT(i)    nvm_stack2int(VM_PEEK(i))
+#ifdef NVM_USE_FLOAT
+#define VM_POP_FLOAT()    nvm_stack2float(VM_POP())
+#define VM_PEEK_FLOAT(i)  nvm_stack2float(VM_PEEK(i))
+#endif
+
+#if defined(NVM_USE_LOOKUPSWITCH) && !defined(NVM_USE_PREDECODE)
+// read a big endian 32 bit switch key with a single block read
+static s32_t vm_read_key(u08_t *addr) {
+  u08_t b[4];
+  nvmfile_read(b, addr, sizeof(b));
+  return ((u32_t)b[0]<<24) | ((u32_t)b[1]<<16) | ((u16_t)b[2]<<8) | b[3];
+}
+#endif
+
 void   vm_run(u16_t mref) {
-  u08_t instr, pc_inc, *pc;
+  u08_t instr;
+  vm_pc_t *pc;
   nvm_int_t tmp1=0;
   nvm_int_t tmp2;
   vm_arg_t arg0;
-  nvm_method_hdr_t mhdr, *mhdr_ptr;
+  nvm_method_t *method;
 
 #ifdef NVM_USE_FLOAT
   nvm_float_t f0;
   nvm_float_t f1;
 #endif
 
+#ifdef NVM_USE_CACHED_STACK
+  register nvm_stack_t *vm_sp;
+  nvm_stack_t vm_tos, vm_tmp;
+#endif
+
+#ifdef NVM_USE_COMPUTED_GOTO
+#define VM_LABEL(op) [op] = &&vm_##op
+  static const void * const vm_dispatch_table[256] = {
+    [0 ... 255] = &&vm_unsupported,
+    VM_LABEL(OP_NOP),
+    VM_LABEL(OP_ICONST_M1), VM_LABEL(OP_ICONST_0), VM_LABEL(OP_ICONST_1),
+    VM_LABEL(OP_ICONST_2),  VM_LABEL(OP_ICONST_3), VM_LABEL(OP_ICONST_4),
+    VM_LABEL(OP_ICONST_5),
+    VM_LABEL(OP_BIPUSH), VM_LABEL(OP_SIPUSH), VM_LABEL(OP_LDC),
+    VM_LABEL(OP_ILOAD),
+    VM_LABEL(OP_ILOAD_0), VM_LABEL(OP_ILOAD_1),
+    VM_LABEL(OP_ILOAD_2), VM_LABEL(OP_ILOAD_3),
+    VM_LABEL(OP_ISTORE),
+    VM_LABEL(OP_ISTORE_0), VM_LABEL(OP_ISTORE_1),
+    VM_LABEL(OP_ISTORE_2), VM_LABEL(OP_ISTORE_3),
+    VM_LABEL(OP_POP), VM_LABEL(OP_POP2), VM_LABEL(OP_DUP), VM_LABEL(OP_DUP2),
+#ifdef NVM_USE_EXTSTACKOPS
+    VM_LABEL(OP_DUP_X1), VM_LABEL(OP_DUP_X2),
+    VM_LABEL(OP_DUP2_X1), VM_LABEL(OP_DUP2_X2), VM_LABEL(OP_SWAP),
+#endif
+    VM_LABEL(OP_IADD), VM_LABEL(OP_ISUB), VM_LABEL(OP_IMUL),
+    VM_LABEL(OP_IDIV), VM_LABEL(OP_IREM), VM_LABEL(OP_INEG),
+    VM_LABEL(OP_ISHL), VM_LABEL(OP_ISHR), VM_LABEL(OP_IUSHR),
+    VM_LABEL(OP_IAND), VM_LABEL(OP_IOR),  VM_LABEL(OP_IXOR),
+    VM_LABEL(OP_IINC),
+    VM_LABEL(OP_IFEQ), VM_LABEL(OP_IFNE), VM_LABEL(OP_IFLT),
+    VM_LABEL(OP_IFGE), VM_LABEL(OP_IFGT), VM_LABEL(OP_IFLE),
+    VM_LABEL(OP_IF_ICMPEQ), VM_LABEL(OP_IF_ICMPNE), VM_LABEL(OP_IF_ICMPLT),
+    VM_LABEL(OP_IF_ICMPGE), VM_LABEL(OP_IF_ICMPGT), VM_LABEL(OP_IF_ICMPLE),
+    VM_LABEL(OP_GOTO),
+#ifdef NVM_USE_TABLESWITCH
+    VM_LABEL(OP_TABLESWITCH),
+#endif
+#ifdef NVM_USE_LOOKUPSWITCH
+    VM_LABEL(OP_LOOKUPSWITCH),
+#endif
+    VM_LABEL(OP_IRETURN), VM_LABEL(OP_RETURN),
+    VM_LABEL(OP_GETSTATIC), VM_LABEL(OP_PUTSTATIC),
+    VM_LABEL(OP_GETFIELD),  VM_LABEL(OP_PUTFIELD),
+    VM_LABEL(OP_INVOKEVIRTUAL), VM_LABEL(OP_INVOKESPECIAL),
+    VM_LABEL(OP_INVOKESTATIC),
+    VM_LABEL(OP_NEW),
+#ifdef NVM_USE_SCOPED_ALLOC
+    VM_LABEL(OP_NEW_SCOPED),
+#endif
+#ifdef NVM_USE_ARRAY
+    VM_LABEL(OP_NEWARRAY), VM_LABEL(OP_ARRAYLENGTH),
+    VM_LABEL(OP_BASTORE), VM_LABEL(OP_IASTORE),
+    VM_LABEL(OP_BALOAD),  VM_LABEL(OP_IALOAD),
+    VM_LABEL(OP_CASTORE), VM_LABEL(OP_SASTORE),
+    VM_LABEL(OP_CALOAD),  VM_LABEL(OP_SALOAD),
+#endif
+#ifdef NVM_USE_OBJ_ARRAY
+    VM_LABEL(OP_ANEWARRAY), VM_LABEL(OP_AASTORE), VM_LABEL(OP_AALOAD),
+    VM_LABEL(OP_MULTIANEWARRAY),
+#endif
+#ifdef NVM_USE_FLAT_ARRAYS
+    VM_LABEL(OP_ARRAYLOAD_2D), VM_LABEL(OP_ARRAYSTORE_2D),
+#endif
+#ifdef NVM_USE_FLOAT
+# ifdef NVM_USE_ARRAY
+    VM_LABEL(OP_FALOAD), VM_LABEL(OP_FASTORE),
+# endif
+    VM_LABEL(OP_FCONST_0), VM_LABEL(OP_FCONST_1), VM_LABEL(OP_FCONST_2),
+    VM_LABEL(OP_FADD), VM_LABEL(OP_FSUB), VM_LABEL(OP_FMUL),
+    VM_LABEL(OP_FDIV), VM_LABEL(OP_FNEG),
+    VM_LABEL(OP_I2F), VM_LABEL(OP_F2I),
+    VM_LABEL(OP_FLOAD),
+    VM_LABEL(OP_FLOAD_0), VM_LABEL(OP_FLOAD_1),
+    VM_LABEL(OP_FLOAD_2), VM_LABEL(OP_FLOAD_3),
+    VM_LABEL(OP_FSTORE),
+    VM_LABEL(OP_FSTORE_0), VM_LABEL(OP_FSTORE_1),
+    VM_LABEL(OP_FSTORE_2), VM_LABEL(OP_FSTORE_3),
+    VM_LABEL(OP_FCMPL), VM_LABEL(OP_FCMPG),
+    VM_LABEL(OP_FRETURN),
+#endif
+#ifdef NVM_USE_SUPERINSN
+    VM_LABEL(OP_ILOAD_ILOAD_IF_ICMPEQ), VM_LABEL(OP_ILOAD_ILOAD_IF_ICMPNE),
+    VM_LABEL(OP_ILOAD_ILOAD_IF_ICMPLT), VM_LABEL(OP_ILOAD_ILOAD_IF_ICMPGE),
+    VM_LABEL(OP_ILOAD_ILOAD_IF_ICMPGT), VM_LABEL(OP_ILOAD_ILOAD_IF_ICMPLE),
+    VM_LABEL(OP_ILOAD_ICONST_IADD_ISTORE), VM_LABEL(OP_ILOAD_GETFIELD),
+    VM_LABEL(OP_IINC_GOTO),
+#endif
+  };
+#undef VM_LABEL
+#endif
+
+#ifdef NVM_USE_JIT
+  // run native code instead
+  if(jit_enabled) {
+    jit_run(mref);
+    return;
+  }
+#endif
+
 #ifdef NVM_USE_STACK_CHECK
   stack_save_sp();
 #endif
 
   DEBUGF("Running method %d\n", mref);
 
-  // load method header into ram
-  mhdr_ptr = nvmfile_get_method_hdr(mref);
-  nvmfile_read(&mhdr, mhdr_ptr, sizeof(nvm_method_hdr_t));
+  // get method description and code
+  method = nvmfile_get_method(mref);
+  pc = VM_PC_BASE();
 
-  // determine method description address and code
-  pc = (u08_t*)mhdr_ptr + mhdr.code_index;
+#ifdef NVM_USE_AOT
+  // run the compiled version instead. The interpreter doesn't expect
+  // the args of the method called here on the stack
+  if(method->aot) {
+    stack_add_sp(method->args);
+    vm_aot_call(method);
+    return;
+  }
+#endif
 
   // make space for locals on the stack
   DEBUGF("Allocating space for %d local(s) and %d "
-	     "stack elements - %d args\n", 
-	     mhdr.max_locals, mhdr.max_stack, mhdr.args);
-  
-  // increase stack space. locals will be put on the stack as 
-  // well. method arguments are part of the locals and are 
+	     "stack elements - %d args\n",
+	     method->max_locals, method->max_stack, method->args);
+
+  // increase stack space. locals will be put on the stack as
+  // well. method arguments are part of the locals and are
   // already on the stack
-  heap_steal(sizeof(nvm_stack_t) * (mhdr.max_locals + mhdr.max_stack + mhdr.args));
+  heap_steal(sizeof(nvm_stack_t) * (VM_STACK_GUARD +
+    method->max_locals + method->max_stack + method->args));
 
   // determine address of current locals (stack pointer + 1)
   locals = stack_get_sp() + 1;
-  stack_add_sp(mhdr.max_locals);
+  stack_add_sp(method->max_locals);
+#ifdef NVM_USE_CACHED_STACK
+  stack_push(0);
+#endif
   stack_save_base();
-  
-  do {
-    instr = nvmfile_read08(pc);
-    pc_inc = 1;
-    
-    DEBUGF("%d/(sp:%d) - "DBG8" (%d): ", 
-	       (pc-(u08_t*)mhdr_ptr) - mhdr.code_index, 
-	       stack_get_depth(), instr, instr);
-    
-    // prefetch next args (in big endian order)
-    arg0.z.bh = nvmfile_read08(pc+1);
-    arg0.z.bl = nvmfile_read08(pc+2);
-
-    if(instr == OP_NOP) {
+  VM_STACK_LOAD();
+
+  for(;;) {
+    VM_FETCH();
+
+    // reset watchdog here if present
+
+    VM_DISPATCH() {
+
+    VM_CASE(OP_NOP)
       DEBUGF("nop\n");
-    }
-    
-    else if(instr == OP_BIPUSH) {
-      stack_push(arg0.z.bh); pc_inc = 2;
-      DEBUGF("bipush #%d\n", stack_peek(0));
-    } 
-
-    else if(instr == OP_SIPUSH) {
-      stack_push(~NVM_IMMEDIATE_MASK & (arg0.w)); pc_inc = 3;
-      DEBUGF("sipush #"DBG16"\n", stack_peek_int(0));
-    } 
-    
-    else if((instr >= OP_ICONST_M1) && (instr <= OP_ICONST_5)) {
-      stack_push(instr - OP_ICONST_0);
-      DEBUGF("iconst_%d\n", stack_peek(0));
-    }   
-    
+      VM_NEXT(1);
+
+    VM_CASE(OP_BIPUSH)
+      VM_PUSH(arg0.z.bh);
+      DEBUGF("bipush #%d\n", VM_PEEK(0));
+      VM_NEXT(2);
+
+    VM_CASE(OP_SIPUSH)
+      VM_PUSH(nvm_int2stack(arg0.w));
+      DEBUGF("sipush #"DBG16"\n", VM_PEEK_INT(0));
+      VM_NEXT(3);
+
+    VM_CASE(OP_ICONST_M1) VM_CASE(OP_ICONST_0)
+    VM_CASE(OP_ICONST_1) VM_CASE(OP_ICONST_2) VM_CASE(OP_ICONST_3)
+    VM_CASE(OP_ICONST_4) VM_CASE(OP_ICONST_5)
+      VM_PUSH(instr - OP_ICONST_0);
+      DEBUGF("iconst_%d\n", VM_PEEK(0));
+      VM_NEXT(1);
+
     // move integer from stack into locals
-    else if(instr == OP_ISTORE) {
-      locals[arg0.z.bh] = stack_pop(); pc_inc = 2;
+    VM_CASE(OP_ISTORE)
+      locals[arg0.z.bh] = VM_POP();
       DEBUGF("istore %d (%d)\n", arg0.z.bh, nvm_stack2int(locals[arg0.z.bh]));
-    } 
-    
+      VM_NEXT(2);
+
     // move integer from stack into locals
-    else if((instr >= OP_ISTORE_0) && (instr <= OP_ISTORE_3)) {
-      locals[instr - OP_ISTORE_0] = stack_pop();
-      DEBUGF("istore_%d (%d)\n", instr - OP_ISTORE_0, 
+    VM_CASE(OP_ISTORE_0) VM_CASE(OP_ISTORE_1)
+    VM_CASE(OP_ISTORE_2) VM_CASE(OP_ISTORE_3)
+      locals[instr - OP_ISTORE_0] = VM_POP();
+      DEBUGF("istore_%d (%d)\n", instr - OP_ISTORE_0,
 		 nvm_stack2int(locals[instr - OP_ISTORE_0]));
-    } 
+      VM_NEXT(1);
 
     // load int from local variable (push local var)
-    else if(instr == OP_ILOAD) {
-      stack_push(locals[arg0.z.bh]); pc_inc = 2;
+    VM_CASE(OP_ILOAD)
+      VM_PUSH(locals[arg0.z.bh]);
       DEBUGF("iload %d (%d, "DBG_INT")\n", locals[arg0.z.bh],
-		 stack_peek_int(0), stack_peek_int(0));
-    } 
+		 VM_PEEK_INT(0), VM_PEEK_INT(0));
+      VM_NEXT(2);
 
     // push local onto stack
-    else if((instr >= OP_ILOAD_0) && (instr <= OP_ILOAD_3)) {
-      stack_push(locals[instr - OP_ILOAD_0]);
+    VM_CASE(OP_ILOAD_0) VM_CASE(OP_ILOAD_1)
+    VM_CASE(OP_ILOAD_2) VM_CASE(OP_ILOAD_3)
+      VM_PUSH(locals[instr - OP_ILOAD_0]);
       DEBUGF("iload_%d (%d, "DBG_INT")\n", instr-OP_ILOAD_0,
-		 stack_peek_int(0), stack_peek_int(0));
-    } 
+		 VM_PEEK_INT(0), VM_PEEK_INT(0));
+      VM_NEXT(1);
 
-    // immediate comparison / comparison with zero
-    else if((instr >= OP_IFEQ) && (instr <= OP_IF_ICMPLE)) {
+    // comparision with zero
+    VM_CASE(OP_IFEQ) VM_CASE(OP_IFNE) VM_CASE(OP_IFLT)
+    VM_CASE(OP_IFGE) VM_CASE(OP_IFGT) VM_CASE(OP_IFLE)
       DEBUGF("if");
+      tmp2 = 0;
+      instr -= OP_IFEQ - OP_IF_ICMPEQ;
+      goto vm_if_compare;
 
-      if((instr >= OP_IFEQ) && (instr <= OP_IFLE)) {
-	// comparision with zero
-	tmp2 = 0;
-	instr -= OP_IFEQ - OP_IF_ICMPEQ;
-      } else {
-	// comparison with second argument
-	DEBUGF("_cmp");
-	tmp2 = stack_pop_int();
-      }
+    // comparison with second argument
+    VM_CASE(OP_IF_ICMPEQ) VM_CASE(OP_IF_ICMPNE) VM_CASE(OP_IF_ICMPLT)
+    VM_CASE(OP_IF_ICMPGE) VM_CASE(OP_IF_ICMPGT) VM_CASE(OP_IF_ICMPLE)
+      DEBUGF("if_cmp");
+      tmp2 = VM_POP_INT();
 
-      tmp1 = stack_pop_int();
+    vm_if_compare:
+      tmp1 = VM_POP_INT();
 
       switch(instr) {
         case OP_IF_ICMPEQ: DEBUGF("eq (%d %d)", tmp1, tmp2);
@@ -285,262 +634,341 @@ void   vm_run(u16_t mref) {
         case OP_IF_ICMPLE: DEBUGF("le (%d %d)", tmp1, tmp2);
           tmp1 = (tmp1 <= tmp2); break;
       }
-      
-      // change pc if jump has been taken
-      if(tmp1) { DEBUGF(" -> taken\n"); pc += arg0.w; pc_inc = 0; }
-      else     { DEBUGF(" -> not taken\n"); pc_inc = 3; }
-    } 
-
-    else if(instr == OP_GOTO) {
-      pc_inc = 3;
-      DEBUGF("goto %d\n", arg0.w); 
-      pc += (arg0.w-3);
-    } 
-
-    // two operand arithmetic
-    else if((instr >= OP_IADD) && (instr <= OP_IINC)) {
-      // single operand arithmetic
-      if(instr == OP_INEG) {
-	tmp1 = -stack_pop_int();
-	stack_push(nvm_int2stack(tmp1));
-        DEBUGF("ineg(%d)\n", -stack_peek_int(0));
-
-      } else if(instr == OP_IINC) {
-	DEBUGF("iinc %d,%d\n", arg0.z.bh, arg0.z.bl); 
-	locals[arg0.z.bh] = (nvm_stack2int(locals[arg0.z.bh]) + arg0.z.bl) 
-	  & ~NVM_IMMEDIATE_MASK; 
-	pc_inc = 3;
 
-#ifdef NVM_USE_FLOAT
-      } else if(((instr & 0x03) == 0x02) && (instr <= OP_FNEG)) {
-        if (instr == OP_FNEG) {
-          f0 = -stack_pop_float();
-          stack_push(nvm_float2stack(f0));
-          DEBUGF("fneg (%f)\n", stack_peek_float(0));
-        }
-        else {
-          f0 = stack_pop_float();  // fetch operands from stack
-          f1 = stack_pop_float();
-          switch(instr) {
-            case OP_FADD:  DEBUGF("fadd(%f,%f)", f1, f0);
-              f1  += f0; break;
-            case OP_FSUB:  DEBUGF("fsub(%f,%f)", f1, f0);
-              f1  -= f0; break;
-            case OP_FMUL:  DEBUGF("fmul(%f,%f)", f1, f0);
-              f1  *= f0; break;
-            case OP_FDIV:  DEBUGF("fdiv(%f,%f)", f1, f0);
-              if(!f0) error(ERROR_VM_DIVISION_BY_ZERO);
-              f1  /= f0; break;
-            case OP_IREM:  DEBUGF("frem(%f,%f)", f1, f0);
-              error(ERROR_VM_UNSUPPORTED_OPCODE);
-              //f1  = f1%f0; break;
-          }
-          stack_push(nvm_float2stack(f1));
-          DEBUGF(" = %f\n", stack_peek_float(0));
-        }
-#endif
+      // change pc if jump has been taken
+      if(tmp1) { DEBUGF(" -> taken\n"); VM_BRANCH(); }
+      DEBUGF(" -> not taken\n");
+      VM_NEXT(3);
+
+    VM_CASE(OP_GOTO)
+      DEBUGF("goto %d\n", arg0.w);
+      VM_BRANCH();
+
+    // single operand arithmetic
+    VM_CASE(OP_INEG)
+      tmp1 = -VM_POP_INT();
+      VM_PUSH(nvm_int2stack(tmp1));
+      DEBUGF("ineg(%d)\n", -VM_PEEK_INT(0));
+      VM_NEXT(1);
+
+    VM_CASE(OP_IINC)
+      DEBUGF("iinc %d,%d\n", arg0.z.bh, arg0.z.bl);
+      locals[arg0.z.bh] =
+	nvm_int2stack(nvm_stack2int(locals[arg0.z.bh]) + arg0.z.bl);
+      VM_NEXT(3);
+
+#ifdef NVM_USE_SUPERINSN
+    // superinstructions, NanoVMTool replaces frequent sequences of
+    // instructions by these. They occupy the same space as the
+    // instructions they replace
+
+    // iload_x, iload_y, if_icmp<cond> with x and y in the first
+    // two and the branch offset in the following bytes
+    VM_CASE(OP_ILOAD_ILOAD_IF_ICMPEQ) VM_CASE(OP_ILOAD_ILOAD_IF_ICMPNE)
+    VM_CASE(OP_ILOAD_ILOAD_IF_ICMPLT) VM_CASE(OP_ILOAD_ILOAD_IF_ICMPGE)
+    VM_CASE(OP_ILOAD_ILOAD_IF_ICMPGT) VM_CASE(OP_ILOAD_ILOAD_IF_ICMPLE)
+      tmp1 = nvm_stack2int(locals[arg0.z.bh]);
+      tmp2 = nvm_stack2int(locals[arg0.z.bl]);
+      DEBUGF("iload_%d/iload_%d/if_cmp (%d %d)", 
+	     arg0.z.bh, arg0.z.bl, tmp1, tmp2);
 
-      } else {
-	tmp1 = stack_pop_int();  // fetch operands from stack
-	tmp2 = stack_pop_int();
-	
-	switch(instr) {
-          case OP_IADD:  DEBUGF("iadd(%d,%d)", tmp2, tmp1);
-	    tmp2  += tmp1; break;
-	  case OP_ISUB:  DEBUGF("isub(%d,%d)", tmp2, tmp1);
-	    tmp2  -= tmp1; break;
-	  case OP_IMUL:  DEBUGF("imul(%d,%d)", tmp2, tmp1);
-	    tmp2  *= tmp1; break;
-	  case OP_IDIV:  DEBUGF("idiv(%d,%d)", tmp2, tmp1);
-	    if(!tmp1) error(ERROR_VM_DIVISION_BY_ZERO);
-	    tmp2  /= tmp1; break;
-	  case OP_IREM:  DEBUGF("irem(%d,%d)", tmp2, tmp1);
-	    tmp2  %= tmp1; break;
-	  case OP_ISHL:  DEBUGF("ishl(%d,%d)", tmp2, tmp1);
-	    tmp2 <<= tmp1; break;
-	  case OP_ISHR:  DEBUGF("ishr(%d,%d)", tmp2, tmp1);
-	    tmp2 >>= tmp1; break;
-	  case OP_IAND:  DEBUGF("iand(%d,%d)", tmp2, tmp1);
-	    tmp2  &= tmp1; break;
-	  case OP_IOR:   DEBUGF("ior(%d,%d)",  tmp2, tmp1);
-	    tmp2  |= tmp1; break;
-	  case OP_IXOR:  DEBUGF("ixor(%d,%d)", tmp2, tmp1);
-	    tmp2  ^= tmp1; break;
-	  case OP_IUSHR: DEBUGF("iushr(%d,%d)", tmp2, tmp1);
-	    tmp2 = ((nvm_uint_t)tmp2 >> tmp1); break;
-	}
-	
-	// and finally push result
-        stack_push(nvm_int2stack(tmp2));
-        DEBUGF(" = %d\n", stack_peek_int(0));
+      switch(instr) {
+        case OP_ILOAD_ILOAD_IF_ICMPEQ: tmp1 = (tmp1 == tmp2); break;
+        case OP_ILOAD_ILOAD_IF_ICMPNE: tmp1 = (tmp1 != tmp2); break;
+        case OP_ILOAD_ILOAD_IF_ICMPLT: tmp1 = (tmp1 <  tmp2); break;
+        case OP_ILOAD_ILOAD_IF_ICMPGE: tmp1 = (tmp1 >= tmp2); break;
+        case OP_ILOAD_ILOAD_IF_ICMPGT: tmp1 = (tmp1 >  tmp2); break;
+        case OP_ILOAD_ILOAD_IF_ICMPLE: tmp1 = (tmp1 <= tmp2); break;
       }
-    }
 
-    else if((instr == OP_IRETURN)
-#ifdef NVM_USE_FLOAT
-          ||(instr == OP_FRETURN)
+      if(tmp1) { DEBUGF(" -> taken\n"); VM_GOTO(VM_PC_BRANCH_AT(3)); }
+      DEBUGF(" -> not taken\n");
+      VM_NEXT(5);
+
+    // iload_x, iconst_c, iadd, istore_y with x and y in the upper and
+    // lower nibble of the first byte and c in the second one
+    VM_CASE(OP_ILOAD_ICONST_IADD_ISTORE)
+      DEBUGF("iload_%d/iconst_%d/iadd/istore_%d\n", 
+	     (u08_t)arg0.z.bh >> 4, arg0.z.bl, arg0.z.bh & 0x0f);
+      locals[arg0.z.bh & 0x0f] = nvm_int2stack(
+	nvm_stack2int(locals[(u08_t)arg0.z.bh >> 4]) + arg0.z.bl);
+      VM_NEXT(4);
+
+    // iload_x, getfield with x and the field index in the first
+    // two bytes
+    VM_CASE(OP_ILOAD_GETFIELD)
+      DEBUGF("iload_%d/getfield #%d\n", arg0.z.bh, (u08_t)arg0.z.bl);
+      VM_PUSH(((nvm_word_t*)heap_get_addr(locals[arg0.z.bh] & 
+					     ~NVM_TYPE_MASK))
+		 [(u08_t)arg0.z.bl]);
+      VM_NEXT(4);
+
+    // iinc, goto with the iinc args in the first two bytes and
+    // the branch offset in the following ones
+    VM_CASE(OP_IINC_GOTO)
+      DEBUGF("iinc %d,%d/goto\n", arg0.z.bh, arg0.z.bl);
+      locals[arg0.z.bh] =
+	nvm_int2stack(nvm_stack2int(locals[arg0.z.bh]) + arg0.z.bl);
+      VM_GOTO(VM_PC_BRANCH_AT(3));
 #endif
-          ||(instr == OP_RETURN)) {
-      if((instr == OP_IRETURN)
+
+    // two operand arithmetic. fetch operands from stack, calculate
+    // and finally push result
+    VM_CASE(OP_IADD)
+      tmp1 = VM_POP_INT(); tmp2 = VM_POP_INT();
+      DEBUGF("iadd(%d,%d)", tmp2, tmp1);
+      tmp2 += tmp1;
+      goto vm_int_result;
+
+    VM_CASE(OP_ISUB)
+      tmp1 = VM_POP_INT(); tmp2 = VM_POP_INT();
+      DEBUGF("isub(%d,%d)", tmp2, tmp1);
+      tmp2 -= tmp1;
+      goto vm_int_result;
+
+    VM_CASE(OP_IMUL)
+      tmp1 = VM_POP_INT(); tmp2 = VM_POP_INT();
+      DEBUGF("imul(%d,%d)", tmp2, tmp1);
+      tmp2 *= tmp1;
+      goto vm_int_result;
+
+    VM_CASE(OP_IDIV)
+      tmp1 = VM_POP_INT(); tmp2 = VM_POP_INT();
+      DEBUGF("idiv(%d,%d)", tmp2, tmp1);
+      if(!tmp1) error(ERROR_VM_DIVISION_BY_ZERO);
+      tmp2 = nvm_int_div(tmp2, tmp1);
+      goto vm_int_result;
+
+    VM_CASE(OP_IREM)
+      tmp1 = VM_POP_INT(); tmp2 = VM_POP_INT();
+      DEBUGF("irem(%d,%d)", tmp2, tmp1);
+      tmp2 = nvm_int_rem(tmp2, tmp1);
+      goto vm_int_result;
+
+    VM_CASE(OP_ISHL)
+      tmp1 = VM_POP_INT(); tmp2 = VM_POP_INT();
+      DEBUGF("ishl(%d,%d)", tmp2, tmp1);
+      tmp2 <<= tmp1;
+      goto vm_int_result;
+
+    VM_CASE(OP_ISHR)
+      tmp1 = VM_POP_INT(); tmp2 = VM_POP_INT();
+      DEBUGF("ishr(%d,%d)", tmp2, tmp1);
+      tmp2 >>= tmp1;
+      goto vm_int_result;
+
+    VM_CASE(OP_IUSHR)
+      tmp1 = VM_POP_INT(); tmp2 = VM_POP_INT();
+      DEBUGF("iushr(%d,%d)", tmp2, tmp1);
+      tmp2 = ((nvm_uint_t)tmp2 >> tmp1);
+      goto vm_int_result;
+
+    VM_CASE(OP_IAND)
+      tmp1 = VM_POP_INT(); tmp2 = VM_POP_INT();
+      DEBUGF("iand(%d,%d)", tmp2, tmp1);
+      tmp2 &= tmp1;
+      goto vm_int_result;
+
+    VM_CASE(OP_IOR)
+      tmp1 = VM_POP_INT(); tmp2 = VM_POP_INT();
+      DEBUGF("ior(%d,%d)",  tmp2, tmp1);
+      tmp2 |= tmp1;
+      goto vm_int_result;
+
+    VM_CASE(OP_IXOR)
+      tmp1 = VM_POP_INT(); tmp2 = VM_POP_INT();
+      DEBUGF("ixor(%d,%d)", tmp2, tmp1);
+      tmp2 ^= tmp1;
+
+    vm_int_result:
+      VM_PUSH(nvm_int2stack(tmp2));
+      DEBUGF(" = %d\n", VM_PEEK_INT(0));
+      VM_NEXT(1);
+
+    VM_CASE(OP_IRETURN)
 #ifdef NVM_USE_FLOAT
-       ||(instr == OP_FRETURN)
+    VM_CASE(OP_FRETURN)
 #endif
-      ) {
-	tmp1 = stack_pop();     // save result
-	DEBUGF("i");
-      }
+      tmp1 = VM_POP();     // save result
+      DEBUGF("i");
+      // fall through
 
+    VM_CASE(OP_RETURN)
       DEBUGF("return: ");
+      VM_STACK_SAVE();
 
-      // return from locally called method? other case: return
-      // from main() -> end of program
-      if(!stack_is_empty()) {
-	u08_t old_locals = mhdr.max_locals;
+#ifdef NVM_USE_SCOPED_ALLOC
+      // objects that didn't escape the method are garbage now
+      heap_scope_release(VM_SCOPE_OWNER());
+#endif
+
+      // return from main() -> end of program
+      if(stack_is_empty())
+	goto vm_leave;
+
+      // return from locally called method
+      {
+	u08_t old_locals = method->max_locals;
 	u08_t old_unsteal = VM_METHOD_CALL_REQUIREMENTS +
-	  mhdr.max_locals + mhdr.max_stack + mhdr.args;
+	  method->max_locals + method->max_stack + method->args;
 	u16_t old_localsoffset = stack_pop();
-	
+
 	// make space for locals on the stack
 	DEBUGF("Return from method with %d local(s) and %d "
-		   "stack elements - %d args\n", 
-		   mhdr.max_locals, mhdr.max_stack, mhdr.args);
-	
+		   "stack elements - %d args\n",
+		   method->max_locals, method->max_stack, method->args);
+
+	// get description of method to return to
 	mref = stack_pop();
-	
-	// read header of method to return to
-	mhdr_ptr = nvmfile_get_method_hdr(mref);
-	// load method header into ram
-	nvmfile_read(&mhdr, mhdr_ptr, sizeof(nvm_method_hdr_t));
-	
+	method = nvmfile_get_method(mref);
+
 	// restore pc
-	pc = (u08_t*)mhdr_ptr + stack_pop();
-	pc_inc = 3; // continue _behind_ calling invoke instruction
-	
+	pc = VM_PC_BASE() + stack_pop();
+
 	// and remove locals from stack and hope that method left
 	// an uncorrupted stack
 	stack_add_sp(-old_locals);
 	locals = stack_get_sp() - old_localsoffset;
-	
+
 	// give memory used by returning method back to heap
 	heap_unsteal(sizeof(nvm_stack_t) * old_unsteal);
-	
+	VM_STACK_LOAD();
+
         if(instr == OP_IRETURN){
-          stack_push(tmp1);
-          DEBUGF("ireturn val: %d\n", stack_peek_int(0));
+          VM_PUSH(tmp1);
+          DEBUGF("ireturn val: %d\n", VM_PEEK_INT(0));
         }
 #ifdef NVM_USE_FLOAT
         else if(instr == OP_FRETURN){
-	  stack_push(tmp1);
-          DEBUGF("freturn val: %f\n", stack_peek_float(0));
+	  VM_PUSH(tmp1);
+          DEBUGF("freturn val: %f\n", VM_PEEK_FLOAT(0));
 	}
 #endif
-	instr = OP_NOP;  // make vm continue
       }
-    }
+      // continue _behind_ calling invoke instruction
+      VM_NEXT(3);
 
     // discard both top stack items
-    else if(instr == OP_POP2) {
+    VM_CASE(OP_POP2)
       DEBUGF("ipop\n");
-      stack_pop(); stack_pop();
-    }
-    
+      VM_DROP(2);
+      VM_NEXT(1);
+
     // discard top stack item
-    else if(instr == OP_POP) {
+    VM_CASE(OP_POP)
       DEBUGF("pop\n");
-      stack_pop();
-    }
-    
+      VM_DROP(1);
+      VM_NEXT(1);
+
     // duplicate top stack item
-    else if(instr == OP_DUP) {
-      stack_push(stack_peek(0));
-      DEBUGF("dup ("DBG16")\n", stack_peek(0) & 0xffff);
-    }
+    VM_CASE(OP_DUP)
+      VM_PUSH(VM_PEEK(0));
+      DEBUGF("dup ("DBG16")\n", VM_PEEK(0) & 0xffff);
+      VM_NEXT(1);
 
     // duplicate top two stack items  (a,b -> a,b,a,b)
-    else if(instr == OP_DUP2) {
-      stack_push(stack_peek(1));
-      stack_push(stack_peek(1));
-      DEBUGF("dup2 ("DBG16","DBG16")\n", 
-	     stack_peek(0) & 0xffff, stack_peek(1) & 0xffff);
-    }
+    VM_CASE(OP_DUP2)
+      VM_PUSH(VM_PEEK(1));
+      VM_PUSH(VM_PEEK(1));
+      DEBUGF("dup2 ("DBG16","DBG16")\n",
+	     VM_PEEK(0) & 0xffff, VM_PEEK(1) & 0xffff);
+      VM_NEXT(1);
 
 #ifdef NVM_USE_EXTSTACKOPS
-    
+
     // duplicate top stack item and put it under the second
-    else if(instr == OP_DUP_X1) {
-      nvm_stack_t w1 = stack_pop();
-      nvm_stack_t w2 = stack_pop();
-      stack_push(w1);
-      stack_push(w2);
-      stack_push(w1);
-      DEBUGF("dup_x1 ("DBG16")\n", stack_peek(0) & 0xffff);
+    VM_CASE(OP_DUP_X1) {
+      nvm_stack_t w1 = VM_POP();
+      nvm_stack_t w2 = VM_POP();
+      VM_PUSH(w1);
+      VM_PUSH(w2);
+      VM_PUSH(w1);
+      DEBUGF("dup_x1 ("DBG16")\n", VM_PEEK(0) & 0xffff);
+      VM_NEXT(1);
     }
 
     // duplicate top stack item
-    else if(instr == OP_DUP_X2) {
-      nvm_stack_t w1 = stack_pop();
-      nvm_stack_t w2 = stack_pop();
-      nvm_stack_t w3 = stack_pop();
-      stack_push(w1);
-      stack_push(w2);
-      stack_push(w3);
-      stack_push(w1);
-      DEBUGF("dup ("DBG16")\n", stack_peek(0) & 0xffff);
+    VM_CASE(OP_DUP_X2) {
+      nvm_stack_t w1 = VM_POP();
+      nvm_stack_t w2 = VM_POP();
+      nvm_stack_t w3 = VM_POP();
+      VM_PUSH(w1);
+      VM_PUSH(w2);
+      VM_PUSH(w3);
+      VM_PUSH(w1);
+      DEBUGF("dup ("DBG16")\n", VM_PEEK(0) & 0xffff);
+      VM_NEXT(1);
     }
 
     // duplicate top two stack items  (a,b -> a,b,a,b)
-    else if(instr == OP_DUP2_X1) {
-      nvm_stack_t w1 = stack_pop();
-      nvm_stack_t w2 = stack_pop();
-      nvm_stack_t w3 = stack_pop();
-      stack_push(w1);
-      stack_push(w2);
-      stack_push(w3);
-      stack_push(w1);
-      stack_push(w2);
+    VM_CASE(OP_DUP2_X1) {
+      nvm_stack_t w1 = VM_POP();
+      nvm_stack_t w2 = VM_POP();
+      nvm_stack_t w3 = VM_POP();
+      VM_PUSH(w1);
+      VM_PUSH(w2);
+      VM_PUSH(w3);
+      VM_PUSH(w1);
+      VM_PUSH(w2);
       DEBUGF("dup2 ("DBG16","DBG16")\n",
-             stack_peek(0) & 0xffff, stack_peek(1) & 0xffff);
+             VM_PEEK(0) & 0xffff, VM_PEEK(1) & 0xffff);
+      VM_NEXT(1);
     }
 
     // duplicate top two stack items  (a,b -> a,b,a,b)
-    else if(instr == OP_DUP2_X2) {
-      nvm_stack_t w1 = stack_pop();
-      nvm_stack_t w2 = stack_pop();
-      nvm_stack_t w3 = stack_pop();
-      nvm_stack_t w4 = stack_pop();
-      stack_push(w1);
-      stack_push(w2);
-      stack_push(w3);
-      stack_push(w4);
-      stack_push(w1);
-      stack_push(w2);
+    VM_CASE(OP_DUP2_X2) {
+      nvm_stack_t w1 = VM_POP();
+      nvm_stack_t w2 = VM_POP();
+      nvm_stack_t w3 = VM_POP();
+      nvm_stack_t w4 = VM_POP();
+      VM_PUSH(w1);
+      VM_PUSH(w2);
+      VM_PUSH(w3);
+      VM_PUSH(w4);
+      VM_PUSH(w1);
+      VM_PUSH(w2);
       DEBUGF("dup2 ("DBG16","DBG16")\n",
-             stack_peek(0) & 0xffff, stack_peek(1) & 0xffff);
+             VM_PEEK(0) & 0xffff, VM_PEEK(1) & 0xffff);
+      VM_NEXT(1);
     }
-    
+
     // swap top two stack items  (a,b -> b,a)
-    else if(instr == OP_SWAP) {
-      nvm_stack_t w1 = stack_pop();
-      nvm_stack_t w2 = stack_pop();
-      stack_push(w1);
-      stack_push(w2);
-      DEBUGF("swap ("DBG16","DBG16")\n", stack_peek(0), stack_peek(1));
+    VM_CASE(OP_SWAP) {
+      nvm_stack_t w1 = VM_POP();
+      nvm_stack_t w2 = VM_POP();
+      VM_PUSH(w1);
+      VM_PUSH(w2);
+      DEBUGF("swap ("DBG16","DBG16")\n", VM_PEEK(0), VM_PEEK(1));
+      VM_NEXT(1);
     }
-    
+
 #endif
-    
-    
-#ifdef NVM_USE_TABLESWITCH
-    else if(instr == OP_TABLESWITCH) {
+
+
+#if defined(NVM_USE_TABLESWITCH) && defined(NVM_USE_PREDECODE)
+    VM_CASE(OP_TABLESWITCH) {
+      nvmcode_tableswitch_t *t = pc->target;
+      tmp1 = VM_POP_INT();               // get actual value
+      DEBUGF("tableswitch %d-%d (%d)\n", t->low, t->high, tmp1);
+
+      // value within range? no: use default
+      if((tmp1 < t->low)||(tmp1 > t->high))
+	VM_GOTO(t->def);
+
+      // yes: get target from table
+      VM_GOTO(t->target[tmp1 - t->low]);
+    }
+#elif defined(NVM_USE_TABLESWITCH)
+    VM_CASE(OP_TABLESWITCH)
       DEBUGF("TABLESWITCH\n");
       // padding was eliminated by generator
       tmp1 = ((nvmfile_read08(pc+7)<<8) |
 	      nvmfile_read08(pc+8));        // get low value
       tmp2 = ((nvmfile_read08(pc+11)<<8) |
 	      nvmfile_read08(pc+12));       // get high value
-      arg0.tmp = stack_pop();               // get actual value
+      arg0.tmp = VM_POP();               // get actual value
       DEBUGF("tableswitch %d-%d (%d)\n", tmp1, tmp2, arg0.w);
-      
+
       // value within range?
       if((arg0.tmp < tmp1)||(arg0.tmp > tmp2))
 	// no: use default
@@ -548,83 +976,79 @@ void   vm_run(u16_t mref) {
       else
 	// yes: get offset from table
 	tmp2 = 3 + 12 + ((arg0.tmp - tmp1)<<2);
-      
+
       // and do the jump
-      pc += ((nvmfile_read08(pc+tmp2+0)<<8) | 
-	     nvmfile_read08(pc+tmp2+1));
-      pc_inc = 0;
-    }
+      VM_NEXT((s16_t)((nvmfile_read08(pc+tmp2+0)<<8) |
+		      nvmfile_read08(pc+tmp2+1)));
 #endif
-    
-#ifdef NVM_USE_LOOKUPSWITCH
-    else if(instr == OP_LOOKUPSWITCH) {
+
+#if defined(NVM_USE_LOOKUPSWITCH) && defined(NVM_USE_PREDECODE)
+    VM_CASE(OP_LOOKUPSWITCH) {
+      nvmcode_lookupswitch_t *t = pc->target;
+      tmp1 = VM_POP_INT();                        // get actual value
+      DEBUGF("lookupswitch size %d (%d)\n", t->size, tmp1);
+
+      VM_GOTO(nvmcode_lookup(t, tmp1));
+    }
+#elif defined(NVM_USE_LOOKUPSWITCH)
+    VM_CASE(OP_LOOKUPSWITCH) {
       DEBUGF("LOOKUPSWITCH\n");
-      // padding was eliminated by generator
-     
-      arg0.tmp = 1 + 4;
-      u08_t size = nvmfile_read08(pc+arg0.tmp+3); // get table size (max for nvm is 30 cases!)
-      DEBUGF("  size: %d\n", size);
-      arg0.tmp += 4;
-      
-      tmp1 = stack_pop_int();                        // get actual value
-      DEBUGF("  val=: %d\n", tmp1);
-      
-      while(size)
-      {
-        if (
-#ifdef NVM_USE_32BIT_WORD
-             nvmfile_read08(pc+arg0.tmp+0)==(u08_t)(tmp1>>24) &&
-             nvmfile_read08(pc+arg0.tmp+1)==(u08_t)(tmp1>>16) &&
-#endif
-             nvmfile_read08(pc+arg0.tmp+2)==(u08_t)(tmp1>>8) &&
-             nvmfile_read08(pc+arg0.tmp+3)==(u08_t)(tmp1>>0)
-           )
-        {
-          DEBUGF("  value found, index is %d\n", (int)(arg0.tmp-pc_inc-8)/8);
-          arg0.tmp+=4;
+      // padding was eliminated by generator, the keys are sorted
+      u16_t lo = 0, hi = vm_read_key(pc+5);     // get table size
+      tmp2 = 1;                                 // default offset
+      tmp1 = VM_POP_INT();                      // get actual value
+      DEBUGF("  size: %d, val: %d\n", hi, tmp1);
+
+      // binary search, reading one whole key per step
+      while(lo < hi) {
+        u16_t mid = lo + (hi - lo) / 2;
+        s32_t key = vm_read_key(pc+9+8*mid);
+
+        if(key == (s32_t)tmp1) {
+          DEBUGF("  value found, index is %d\n", mid);
+          tmp2 = 9+8*mid+4;
           break;
         }
-        arg0.tmp+=8;
-        size--;
-      }
-      
-      if (size==0)
-      {
-        DEBUGF("  not found, using default!\n");
-        arg0.tmp = 1;
+
+        if(key < (s32_t)tmp1) lo = mid + 1;
+        else                  hi = mid;
       }
-      pc += ((nvmfile_read08(pc+arg0.tmp+2)<<8) |
-             nvmfile_read08(pc+arg0.tmp+3));
-      pc_inc = 0;
+
+      VM_NEXT((s16_t)((nvmfile_read08(pc+tmp2+2)<<8) |
+		      nvmfile_read08(pc+tmp2+3)));
     }
 #endif
 
     // get static field from class
-    else if(instr == OP_GETSTATIC) {
-      pc_inc = 3;   // prefetched data used
+    VM_CASE(OP_GETSTATIC)
       DEBUGF("getstatic #"DBG16"\n", arg0.w);
-      stack_push(stack_get_static(arg0.w));
-    }
-    
-    else if(instr == OP_PUTSTATIC) {
-      pc_inc = 3;
-      stack_set_static(arg0.w, stack_pop());
-      DEBUGF("putstatic #"DBG16" -> "DBG16"\n", 
+      VM_PUSH(stack_get_static(arg0.w));
+      VM_NEXT(3);
+
+    VM_CASE(OP_PUTSTATIC)
+      stack_set_static(arg0.w, VM_POP());
+      DEBUGF("putstatic #"DBG16" -> "DBG16"\n",
 	     arg0.w, stack_get_static(arg0.w));
-    }
-    
+      VM_NEXT(3);
+
     // push item from constant pool
-    else if(instr == OP_LDC) {
-      pc_inc = 2;
+    VM_CASE(OP_LDC)
+#if defined(NVM_USE_PREDECODE)
+      // constant has already been resolved by nvmcode_init()
+      DEBUGF("ldc "DBG_INT"\n", arg0.tmp);
+      VM_PUSH(arg0.tmp);
+#elif defined(NVM_USE_32BIT_WORD)
       DEBUGF("ldc #"DBG16"\n", arg0.z.bh);
-#ifdef NVM_USE_32BIT_WORD
-      stack_push(nvmfile_get_constant(arg0.z.bh));
+      VM_PUSH(nvmfile_get_constant(arg0.z.bh));
 #else
-      stack_push(NVM_TYPE_CONST | (arg0.z.bh-nvmfile_constant_count));
+      DEBUGF("ldc #"DBG16"\n", arg0.z.bh);
+      VM_PUSH(NVM_TYPE_CONST | (arg0.z.bh-nvmfile_constant_count));
 #endif
-    }
-    
-    else if((instr >= OP_INVOKEVIRTUAL)&&(instr <= OP_INVOKESTATIC)) {
+      VM_NEXT(2);
+
+    VM_CASE(OP_INVOKEVIRTUAL)
+    VM_CASE(OP_INVOKESPECIAL)
+    VM_CASE(OP_INVOKESTATIC)
       DEBUGF("invoke");
 
 #ifdef DEBUG
@@ -634,277 +1058,397 @@ void   vm_run(u16_t mref) {
 #endif
 
       DEBUGF(" #"DBG16"\n", 0xffff & arg0.w);
-      
+      VM_STACK_SAVE();
+
       // invoke a method. check if it's local (within the nvm file)
       // or native (implemented by the runtime environment)
-      if(arg0.z.bh < NATIVE_CLASS_BASE) {
-	DEBUGF("local method call from method %d to %d\n", mref, arg0.w);
-
-	// save current pc (relative to method start)
-	tmp1 = (u08_t*)pc-(u08_t*)mhdr_ptr;
-	
-	// get pointer to new method
-	mhdr_ptr = nvmfile_get_method_hdr(arg0.w);
-	
-	// load new method header into ram
-	nvmfile_read(&mhdr, mhdr_ptr, sizeof(nvm_method_hdr_t));
-	
+      if(arg0.z.bh >= NATIVE_CLASS_BASE) {
+	native_invoke(arg0.w);
+	VM_STACK_LOAD();
+	VM_NEXT(3);   // prefetched data used
+      }
+
+      DEBUGF("local method call from method %d to %d\n", mref, arg0.w);
+
+      // save current pc (relative to method start)
+      tmp1 = pc - VM_PC_BASE();
+
+      // get description of new method
+      method = nvmfile_get_method(arg0.w);
+
 #ifdef NVM_USE_INHERITANCE
-	// check class on stack. it may be not the one we expect.
-	// this happens due to inheritance
-	if(instr == OP_INVOKEVIRTUAL) { 
-	  DEBUGF("checking inheritance\n");
-
-	  // fetch class reference from stack and use it to address
-	  // the class instance on the heap. The first entry in this 
-	  // object is the class id of it
-	  nvm_ref_t mref = ((nvm_ref_t*)heap_get_addr(stack_peek(0) & ~NVM_TYPE_MASK))[0];
-	  DEBUGF("class ref on stack/ref: %d/%d\n", 
-		     NATIVE_ID2CLASS(mref), NATIVE_ID2CLASS(mhdr.id));
-
-	  if(NATIVE_ID2CLASS(mref) != NATIVE_ID2CLASS(mhdr.id)) {
-	    DEBUGF("stack/ref class mismatch -> inheritance\n");
-
-	    // get matching method in class on stack or its
-	    // super classes
-	    arg0.z.bl = nvmfile_get_method_by_class_and_id(
-	      NATIVE_ID2CLASS(mref), NATIVE_ID2METHOD(mhdr.id));
-
-	    // get pointer to new method
-	    mhdr_ptr = nvmfile_get_method_hdr(arg0.z.bl);
-	
-	    // load new method header into ram
-	    nvmfile_read(&mhdr, mhdr_ptr, sizeof(nvm_method_hdr_t));
-	  }
-	}
+      // check class on stack. it may be not the one we expect.
+      // this happens due to inheritance
+      if(instr == OP_INVOKEVIRTUAL) {
+	DEBUGF("checking inheritance\n");
+
+	// fetch the class of the object the method is called for
+	// (it's below the args on the stack) from the heap
+	u08_t class = heap_get_class(stack_peek(method->args-1) & ~NVM_TYPE_MASK);
+	DEBUGF("class ref on stack/ref: %d/%d\n",
+		   class, NATIVE_ID2CLASS(method->id));
+
+	if(class != NATIVE_ID2CLASS(method->id)) {
+	  DEBUGF("stack/ref class mismatch -> inheritance\n");
+
+	  // get matching method in class on stack or its
+	  // super classes
+#ifdef NVM_USE_INLINE_CACHE
+	  arg0.z.bl = vm_icache_resolve(mref, tmp1,
+	    class, NATIVE_ID2METHOD(method->id));
+#else
+	  arg0.z.bl = nvmfile_get_method_by_class_and_id(
+	    class, NATIVE_ID2METHOD(method->id));
 #endif
-	
-	// arguments are left on the stack by the calling
-	// method and expected in the locals by the called
-	// method. Thus we make this part of the old stack
-	// be the locals part of the method
-	DEBUGF("Remove %d args from stack\n", mhdr.args);
-	stack_add_sp(-mhdr.args);
-	
-	tmp2 = stack_get_sp() - locals;
-	
-	locals = stack_get_sp() + 1;
-	
-#ifdef DEBUG
-	if(instr == OP_INVOKEVIRTUAL) { 
-	  DEBUGF("virtual call with object reference "DBG16"\n",
-		     locals[0]); 
+
+	  // get description of new method
+	  method = nvmfile_get_method(arg0.z.bl);
 	}
+      }
 #endif
 
-	// make space for locals on the stack
-	DEBUGF("Allocating space for %d local(s) and %d "
-		   "stack elements - %d args\n", 
-		   mhdr.max_locals, mhdr.max_stack, mhdr.args);
-	
-	// increase stack space. locals will be put on the stack as 
-	// well. method arguments are part of the locals and are 
-	// already on the stack
-	heap_steal(sizeof(nvm_stack_t) *
-		   (VM_METHOD_CALL_REQUIREMENTS +
-		    mhdr.max_locals + mhdr.max_stack + mhdr.args));
-	
-	// add space for locals on stack
-	stack_add_sp(mhdr.max_locals);
-	
-	// push everything required to return onto the stack
-	stack_push(tmp1);   // pc offset
-	stack_push(mref);   // method reference
-	stack_push(tmp2);   // locals offset
-	
-	// set new pc (this is the actual call)
-	mref = arg0.w;
-	pc = (u08_t*)mhdr_ptr + mhdr.code_index;
-	pc_inc = 0;  // don't add further bytes to program counter
-      } else { 
-	native_invoke(arg0.w);
-	pc_inc = 3;   // prefetched data used
+#ifdef NVM_USE_AOT
+      // run the compiled version of the method if there is one
+      if(method->aot) {
+	vm_aot_call(method);
+	method = nvmfile_get_method(mref);
+	VM_STACK_LOAD();
+	VM_NEXT(3);
       }
-    }
-    
-    else if(instr == OP_GETFIELD) {
-      pc_inc = 3;
+#endif
+
+      // arguments are left on the stack by the calling
+      // method and expected in the locals by the called
+      // method. Thus we make this part of the old stack
+      // be the locals part of the method
+      DEBUGF("Remove %d args from stack\n", method->args);
+      stack_add_sp(-method->args);
+
+      tmp2 = stack_get_sp() - locals;
+
+      locals = stack_get_sp() + 1;
+
+#ifdef DEBUG
+      if(instr == OP_INVOKEVIRTUAL) {
+	DEBUGF("virtual call with object reference "DBG16"\n",
+		   locals[0]);
+      }
+#endif
+
+      // make space for locals on the stack
+      DEBUGF("Allocating space for %d local(s) and %d "
+		 "stack elements - %d args\n",
+		 method->max_locals, method->max_stack, method->args);
+
+      // increase stack space. locals will be put on the stack as
+      // well. method arguments are part of the locals and are
+      // already on the stack
+      heap_steal(sizeof(nvm_stack_t) *
+		 (VM_METHOD_CALL_REQUIREMENTS +
+		  method->max_locals + method->max_stack + method->args));
+
+      // add space for locals on stack
+      stack_add_sp(method->max_locals);
+
+      // push everything required to return onto the stack
+      stack_push(tmp1);   // pc offset
+      stack_push(mref);   // method reference
+      stack_push(tmp2);   // locals offset
+      VM_STACK_LOAD();
+
+      // set new pc (this is the actual call)
+      mref = arg0.w;
+      VM_GOTO(VM_PC_BASE());
+
+    VM_CASE(OP_GETFIELD)
       DEBUGF("getfield #%d\n", arg0.w);
-      stack_push(((nvm_word_t*)heap_get_addr(stack_pop() & ~NVM_TYPE_MASK))
-	      [VM_CLASS_CONST_ALLOC+arg0.w]);
-    }
-    
-    else if(instr == OP_PUTFIELD) {
-      pc_inc = 3;
-      tmp1 = stack_pop();
-      
+      VM_PUSH(((nvm_word_t*)heap_get_addr(VM_POP() & ~NVM_TYPE_MASK))
+	      [arg0.w]);
+      VM_NEXT(3);
+
+    VM_CASE(OP_PUTFIELD)
+      tmp1 = VM_POP();
+
       DEBUGF("putfield #%d\n", arg0.w);
-      ((nvm_word_t*)heap_get_addr(stack_pop() & ~NVM_TYPE_MASK))
-	[VM_CLASS_CONST_ALLOC+arg0.w] = tmp1;
-    }
-    
-    else if(instr == OP_NEW) {
-      pc_inc = 3;
+      {
+	heap_id_t obj = VM_POP() & ~NVM_TYPE_MASK;
+	nvm_word_t *field = (nvm_word_t*)heap_get_addr(obj) + arg0.w;
+	HEAP_WRITE_BARRIER(obj, *field, tmp1);
+	*field = tmp1;
+      }
+      VM_NEXT(3);
+
+    VM_CASE(OP_NEW)
       DEBUGF("new #"DBG16"\n", 0xffff & arg0.w);
+      VM_STACK_SAVE();
       vm_new(arg0.w);
-    }
-    
+      VM_STACK_LOAD();
+      VM_NEXT(3);
+
+#ifdef NVM_USE_SCOPED_ALLOC
+    VM_CASE(OP_NEW_SCOPED)
+      DEBUGF("new (scoped) #"DBG16"\n", 0xffff & arg0.w);
+      VM_STACK_SAVE();
+      vm_new(arg0.w);
+      heap_scope_add(stack_peek(0) & ~NVM_TYPE_MASK, VM_SCOPE_OWNER());
+      VM_STACK_LOAD();
+      VM_NEXT(3);
+#endif
+
 #ifdef NVM_USE_ARRAY
-    else if(instr == OP_NEWARRAY) {
-      pc_inc = 2;
-      stack_push(array_new(stack_pop(), arg0.z.bh) | NVM_TYPE_HEAP);
-    }
-    
-    else if(instr == OP_ARRAYLENGTH) {
-      stack_push(array_length(stack_pop() & ~NVM_TYPE_MASK));
-    }
-    
-    else if(instr == OP_BASTORE) {
-      tmp2 = stack_pop_int();       // value
-      tmp1 = stack_pop_int();         // index
+    VM_CASE(OP_NEWARRAY)
+      tmp1 = VM_POP();
+      VM_STACK_SAVE();
+      tmp1 = array_new(tmp1, arg0.z.bh) | NVM_TYPE_HEAP;
+      VM_STACK_LOAD();
+      VM_PUSH(tmp1);
+      VM_NEXT(2);
+
+    VM_CASE(OP_ARRAYLENGTH)
+      VM_PUSH(array_length(VM_POP() & ~NVM_TYPE_MASK));
+      VM_NEXT(1);
+
+    VM_CASE(OP_BASTORE)
+      tmp2 = VM_POP_INT();       // value
+      tmp1 = VM_POP_INT();         // index
       // third parm on stack: array reference
-      array_bastore(stack_pop() & ~NVM_TYPE_MASK, tmp1, tmp2);
-    }
-    
-    else if(instr == OP_IASTORE) {
-      tmp2 = stack_pop_int();       // value
-      tmp1 = stack_pop_int();       // index
+      array_bastore(VM_POP() & ~NVM_TYPE_MASK, tmp1, tmp2);
+      VM_NEXT(1);
+
+    VM_CASE(OP_IASTORE)
+      tmp2 = VM_POP_INT();       // value
+      tmp1 = VM_POP_INT();       // index
       // third parm on stack: array reference
-      array_iastore(stack_pop() & ~NVM_TYPE_MASK, tmp1, tmp2);
-    }
-    
-    else if(instr == OP_BALOAD) {
-      tmp1 = stack_pop_int();       // index
+      array_iastore(VM_POP() & ~NVM_TYPE_MASK, tmp1, tmp2);
+      VM_NEXT(1);
+
+    VM_CASE(OP_BALOAD)
+      tmp1 = VM_POP_INT();       // index
       // second parm on stack: array reference
-      stack_push(array_baload(stack_pop() & ~NVM_TYPE_MASK, tmp1));
-    }
-    
-    else if(instr == OP_IALOAD) {
-      tmp1 = stack_pop_int();       // index
+      VM_PUSH(array_baload(VM_POP() & ~NVM_TYPE_MASK, tmp1));
+      VM_NEXT(1);
+
+    VM_CASE(OP_IALOAD)
+      tmp1 = VM_POP_INT();       // index
       // second parm on stack: array reference
-      stack_push(array_iaload(stack_pop() & ~NVM_TYPE_MASK, tmp1));
-    }
+      VM_PUSH(array_iaload(VM_POP() & ~NVM_TYPE_MASK, tmp1));
+      VM_NEXT(1);
+
+    VM_CASE(OP_CASTORE)
+    VM_CASE(OP_SASTORE)
+      tmp2 = VM_POP_INT();       // value
+      tmp1 = VM_POP_INT();       // index
+      // third parm on stack: array reference
+      array_sastore(VM_POP() & ~NVM_TYPE_MASK, tmp1, tmp2);
+      VM_NEXT(1);
+
+    VM_CASE(OP_CALOAD)
+      tmp1 = VM_POP_INT();       // index
+      // second parm on stack: array reference
+      VM_PUSH(array_caload(VM_POP() & ~NVM_TYPE_MASK, tmp1));
+      VM_NEXT(1);
+
+    VM_CASE(OP_SALOAD)
+      tmp1 = VM_POP_INT();       // index
+      // second parm on stack: array reference
+      VM_PUSH(array_saload(VM_POP() & ~NVM_TYPE_MASK, tmp1));
+      VM_NEXT(1);
 #endif
 
 #ifdef NVM_USE_OBJ_ARRAY
-    else if(instr == OP_ANEWARRAY) {
-      // Object array is the same as int array...
-      pc_inc = 3;
-      stack_push(array_new(stack_pop(), T_INT) | NVM_TYPE_HEAP);
-    }
-    
-    else if(instr == OP_AASTORE) {
-      tmp2 = stack_pop_int();       // value
-      tmp1 = stack_pop_int();       // index
+    VM_CASE(OP_ANEWARRAY)
+      // object arrays are accessed like int arrays, but their
+      // elements are followed by the garbage collector
+      tmp1 = VM_POP();
+      VM_STACK_SAVE();
+      tmp1 = array_new(tmp1, T_OBJECT) | NVM_TYPE_HEAP;
+      VM_STACK_LOAD();
+      VM_PUSH(tmp1);
+      VM_NEXT(3);
+
+    VM_CASE(OP_AASTORE)
+      tmp2 = VM_POP_INT();       // value
+      tmp1 = VM_POP_INT();       // index
       // third parm on stack: array reference
-      array_iastore(stack_pop(), tmp1, tmp2);
-    }
-    
-    else if(instr == OP_AALOAD) {
-      tmp1 = stack_pop_int();       // index
+      array_aastore(VM_POP() & ~NVM_TYPE_MASK, tmp1, tmp2);
+      VM_NEXT(1);
+
+    VM_CASE(OP_AALOAD)
+      tmp1 = VM_POP_INT();       // index
       // second parm on stack: array reference
-      stack_push(array_iaload(stack_pop(), tmp1));
-    }
+      VM_PUSH(array_iaload(VM_POP() & ~NVM_TYPE_MASK, tmp1));
+      VM_NEXT(1);
+
+    VM_CASE(OP_MULTIANEWARRAY)
+      // the lengths of all dimensions are on the stack. The tool
+      // has replaced the class by the type of the innermost arrays
+      DEBUGF("multianewarray type %d, %d dims\n", arg0.z.bh, arg0.z.bl);
+      VM_STACK_SAVE();
+      array_new_multi(arg0.z.bh, arg0.z.bl);
+      VM_STACK_LOAD();
+      VM_NEXT(3);
+#endif
+
+#ifdef NVM_USE_FLAT_ARRAYS
+    VM_CASE(OP_ARRAYLOAD_2D)
+      tmp2 = VM_POP_INT();       // column
+      tmp1 = VM_POP_INT();       // row
+      // third parm on stack: array reference
+      VM_PUSH(array_load2(VM_POP() & ~NVM_TYPE_MASK, tmp1, tmp2));
+      VM_NEXT(1);
+
+    VM_CASE(OP_ARRAYSTORE_2D)
+      // array reference, row, column and value
+      array_store2(VM_PEEK(3) & ~NVM_TYPE_MASK, VM_PEEK_INT(2),
+		   VM_PEEK_INT(1), VM_PEEK(0));
+      VM_DROP(4);
+      VM_NEXT(1);
 #endif
 
 #ifdef NVM_USE_FLOAT
 # ifdef NVM_USE_ARRAY
-    else if(instr == OP_FALOAD) {
-      tmp1 = stack_pop_int();       // index
+    VM_CASE(OP_FALOAD)
+      tmp1 = VM_POP_INT();       // index
       // second parm on stack: array reference
-      stack_push(array_faload(stack_pop() & ~NVM_TYPE_MASK, tmp1));
-    }
-    else if(instr == OP_FASTORE) {
-      f0 = stack_pop_float();       // value
-      tmp1 = stack_pop_int();         // index
+      VM_PUSH(nvm_float2stack(array_faload(VM_POP() & ~NVM_TYPE_MASK, tmp1)));
+      VM_NEXT(1);
+
+    VM_CASE(OP_FASTORE)
+      f0 = VM_POP_FLOAT();       // value
+      tmp1 = VM_POP_INT();         // index
       // third parm on stack: array reference
-      array_fastore(stack_pop() & ~NVM_TYPE_MASK, tmp1, f0);
-    }
+      array_fastore(VM_POP() & ~NVM_TYPE_MASK, tmp1, f0);
+      VM_NEXT(1);
 # endif
 
-    else if(instr == OP_FCONST_0) {
-      stack_push(nvm_float2stack(0.0));
-      DEBUGF("fconst_%d\n", stack_peek_float(0));
-    }
-    else if(instr == OP_FCONST_1) {
-      stack_push(nvm_float2stack(1.0));
-      DEBUGF("fconst_%d\n", stack_peek_float(0));
-    }
-    else if(instr == OP_FCONST_2) {
-      stack_push(nvm_float2stack(2.0));
-      DEBUGF("fconst_%d\n", stack_peek_float(0));
-    }
-    else if(instr == OP_I2F) {
-      tmp1 = stack_pop_int();
-      stack_push(nvm_float2stack(tmp1));
-      DEBUGF("i2f %f\n", stack_peek_float(0));
-    }
-    else if(instr == OP_F2I) {
-      tmp1 = stack_pop_float();
-      stack_push(nvm_int2stack(tmp1));
-      DEBUGF("i2f %f\n", stack_peek_int(0));
-    }
-    
+    VM_CASE(OP_FCONST_0)
+      VM_PUSH(nvm_float2stack(0.0));
+      DEBUGF("fconst_%d\n", VM_PEEK_FLOAT(0));
+      VM_NEXT(1);
+
+    VM_CASE(OP_FCONST_1)
+      VM_PUSH(nvm_float2stack(1.0));
+      DEBUGF("fconst_%d\n", VM_PEEK_FLOAT(0));
+      VM_NEXT(1);
+
+    VM_CASE(OP_FCONST_2)
+      VM_PUSH(nvm_float2stack(2.0));
+      DEBUGF("fconst_%d\n", VM_PEEK_FLOAT(0));
+      VM_NEXT(1);
+
+    VM_CASE(OP_FNEG)
+      f0 = -VM_POP_FLOAT();
+      VM_PUSH(nvm_float2stack(f0));
+      DEBUGF("fneg (%f)\n", VM_PEEK_FLOAT(0));
+      VM_NEXT(1);
+
+    // two operand float arithmetic. fetch operands from stack,
+    // calculate and finally push result
+    VM_CASE(OP_FADD)
+      f0 = VM_POP_FLOAT(); f1 = VM_POP_FLOAT();
+      DEBUGF("fadd(%f,%f)", f1, f0);
+      f1 += f0;
+      goto vm_float_result;
+
+    VM_CASE(OP_FSUB)
+      f0 = VM_POP_FLOAT(); f1 = VM_POP_FLOAT();
+      DEBUGF("fsub(%f,%f)", f1, f0);
+      f1 -= f0;
+      goto vm_float_result;
+
+    VM_CASE(OP_FMUL)
+      f0 = VM_POP_FLOAT(); f1 = VM_POP_FLOAT();
+      DEBUGF("fmul(%f,%f)", f1, f0);
+      f1 *= f0;
+      goto vm_float_result;
+
+    VM_CASE(OP_FDIV)
+      f0 = VM_POP_FLOAT(); f1 = VM_POP_FLOAT();
+      DEBUGF("fdiv(%f,%f)", f1, f0);
+      if(!f0) error(ERROR_VM_DIVISION_BY_ZERO);
+      f1 /= f0;
+
+    vm_float_result:
+      VM_PUSH(nvm_float2stack(f1));
+      DEBUGF(" = %f\n", VM_PEEK_FLOAT(0));
+      VM_NEXT(1);
+
+    VM_CASE(OP_I2F)
+      tmp1 = VM_POP_INT();
+      VM_PUSH(nvm_float2stack(tmp1));
+      DEBUGF("i2f %f\n", VM_PEEK_FLOAT(0));
+      VM_NEXT(1);
+
+    VM_CASE(OP_F2I)
+      tmp1 = VM_POP_FLOAT();
+      VM_PUSH(nvm_int2stack(tmp1));
+      DEBUGF("i2f %f\n", VM_PEEK_INT(0));
+      VM_NEXT(1);
+
     // move float from stack into locals
-    else if(instr == OP_FSTORE) {
-      locals[arg0.z.bh] = stack_pop(); pc_inc = 2;
+    VM_CASE(OP_FSTORE)
+      locals[arg0.z.bh] = VM_POP();
       DEBUGF("fstore %d (%f)\n", arg0.z.bh, nvm_stack2float(locals[arg0.z.bh]));
-    } 
-    
+      VM_NEXT(2);
+
     // move integer from stack into locals
-    else if((instr >= OP_FSTORE_0) && (instr <= OP_FSTORE_3)) {
-      locals[instr - OP_FSTORE_0] = stack_pop();
+    VM_CASE(OP_FSTORE_0) VM_CASE(OP_FSTORE_1)
+    VM_CASE(OP_FSTORE_2) VM_CASE(OP_FSTORE_3)
+      locals[instr - OP_FSTORE_0] = VM_POP();
       DEBUGF("fstore_%d (%f)\n", instr - OP_FSTORE_0,
       nvm_stack2float(locals[instr - OP_FSTORE_0]));
-    } 
+      VM_NEXT(1);
 
     // load float from local variable (push local var)
-    else if(instr == OP_FLOAD) {
-      stack_push(locals[arg0.z.bh]); pc_inc = 2;
+    VM_CASE(OP_FLOAD)
+      VM_PUSH(locals[arg0.z.bh]);
       DEBUGF("fload %d (%f, "DBG16")\n", locals[arg0.z.bh],
-      stack_peek_float(0), stack_peek_int(0));
-    } 
+      VM_PEEK_FLOAT(0), VM_PEEK_INT(0));
+      VM_NEXT(2);
 
     // push local onto stack
-    else if((instr >= OP_FLOAD_0) && (instr <= OP_FLOAD_3)) {
-      stack_push(locals[instr - OP_FLOAD_0]);
+    VM_CASE(OP_FLOAD_0) VM_CASE(OP_FLOAD_1)
+    VM_CASE(OP_FLOAD_2) VM_CASE(OP_FLOAD_3)
+      VM_PUSH(locals[instr - OP_FLOAD_0]);
       DEBUGF("fload_%d (%f, "DBG16")\n", instr-OP_FLOAD_0,
-      stack_peek_float(0), stack_peek_int(0));
-    }
-    
+      VM_PEEK_FLOAT(0), VM_PEEK_INT(0));
+      VM_NEXT(1);
+
     // compare top values on stack
-    else if((instr == OP_FCMPL) || (instr == OP_FCMPG)) {
-      f1 = stack_pop_float();
-      f0 = stack_pop_float();
+    VM_CASE(OP_FCMPL) VM_CASE(OP_FCMPG)
+      f1 = VM_POP_FLOAT();
+      f0 = VM_POP_FLOAT();
       tmp1=0;
       if (f0<f1)
         tmp1=-1;
       else if (f0>f1)
         tmp1=1;
-      stack_push(nvm_int2stack(tmp1));
+      VM_PUSH(nvm_int2stack(tmp1));
       DEBUGF("fcmp%c (%f, %f, %i)\n", (instr==OP_FCMPL)?'l':'g',
-      f0, f1, stack_peek_int(0));
-    }
+      f0, f1, VM_PEEK_INT(0));
+      VM_NEXT(1);
 #endif
 
-    else {
+    VM_DEFAULT
       error(ERROR_VM_UNSUPPORTED_OPCODE);
     }
-    
-    // reset watchdog here if present
-
-    pc += pc_inc;
-  } while((instr != OP_IRETURN)&&(instr != OP_RETURN));
+  }
 
+ vm_leave:
   // and remove locals from stack and hope that method left
   // an uncorrupted stack
-  stack_add_sp(-mhdr.max_locals);
+  stack_add_sp(-VM_STACK_GUARD - method->max_locals);
 
 #ifdef NVM_USE_STACK_CHECK
   stack_verify_sp();
 #endif
 
   // give memory back to heap
-  heap_unsteal(sizeof(nvm_stack_t) * (mhdr.max_locals + mhdr.max_stack + mhdr.args));
+  heap_unsteal(sizeof(nvm_stack_t) * (VM_STACK_GUARD +
+    method->max_locals + method->max_stack + method->args));
 }
 
+#ifdef NVM_USE_COMPUTED_GOTO
+# pragma GCC diagnostic pop
+#endif
+
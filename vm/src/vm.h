@@ -28,26 +28,69 @@
 #include "heap.h"
 #include "nvmfile.h"
 
-// additional items to be allocated on heap during constructor call
-#define VM_CLASS_CONST_ALLOC  1
+#ifdef NVM_USE_INLINE_CACHE
+// number of entries of the invokevirtual inline cache, must be a
+// power of two. Every entry costs 5 bytes of ram on the avr
+#ifndef NVM_INLINE_CACHE_SIZE
+#define NVM_INLINE_CACHE_SIZE  4
+#endif
+
+#if NVM_INLINE_CACHE_SIZE & (NVM_INLINE_CACHE_SIZE-1)
+#error NVM_INLINE_CACHE_SIZE must be a power of two
+#endif
+
+extern u32_t vm_icache_hits, vm_icache_misses;
+#endif
 
 void   vm_init(void);
 void   vm_run(u16_t mref);
+void   vm_new(u16_t mref);
 bool_t vm_heap_id_in_use(heap_id_t id);
 
 // expand types
 void * vm_get_addr(nvm_ref_t ref);
 
+#ifdef NVM_USE_FULL_WORDS
+// ints and floats are kept as they are. Whether a stack item is a
+// reference only matters to the garbage collector. It takes
+// everything holding the id of an object for one (ids don't change
+// when objects are moved), so an int that happens to look like a
+// reference just keeps that object alive
+#define nvm_int2stack(x) ((nvm_stack_t)(x))
+#define nvm_stack2int(x) ((nvm_int_t)(x))
+
+#ifdef NVM_USE_FLOAT
+static inline nvm_stack_t nvm_float2stack(nvm_float_t val) {
+  nvm_union_t v;
+  v.f[0] = val;
+  return v.i[0];
+}
+
+static inline nvm_float_t nvm_stack2float(nvm_stack_t val) {
+  nvm_union_t v;
+  v.i[0] = val;
+  return v.f[0];
+}
+#endif
+
+// Integer.MIN_VALUE / -1 overflows (and traps on x86)
+#define nvm_int_div(a, b) (((b) == -1)?(nvm_int_t)(0-(nvm_uint_t)(a)):(a)/(b))
+#define nvm_int_rem(a, b) (((b) == -1)?0:(a)%(b))
+#else
 #define nvm_int2stack(x) (~NVM_IMMEDIATE_MASK & (x))
 nvm_int_t nvm_stack2int(nvm_stack_t val);
 
-#define nvm_ref2stack(x) (x)
-#define nvm_stack2ref(x) (x)
-
 #ifdef NVM_USE_FLOAT
 nvm_stack_t nvm_float2stack(nvm_float_t val);
 nvm_float_t nvm_stack2float(nvm_stack_t val);
 #endif
 
+#define nvm_int_div(a, b) ((a)/(b))
+#define nvm_int_rem(a, b) ((a)%(b))
+#endif
+
+#define nvm_ref2stack(x) (x)
+#define nvm_stack2ref(x) (x)
+
 
 #endif // VM_H